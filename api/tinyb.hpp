@@ -30,3 +30,12 @@
 #include "tinyb/BluetoothGattService.hpp"
 #include "tinyb/BluetoothGattCharacteristic.hpp"
 #include "tinyb/BluetoothGattDescriptor.hpp"
+#include "tinyb/BluetoothSampleSink.hpp"
+#include "tinyb/BluetoothDeliveryPolicy.hpp"
+#include "tinyb/BluetoothPropertyChange.hpp"
+#include "tinyb/BluetoothObjectChange.hpp"
+#include "tinyb/BluetoothPollScheduler.hpp"
+#include "tinyb/BluetoothDiscoveryFilter.hpp"
+#include "tinyb/BluetoothAdvertisement.hpp"
+#include "tinyb/BluetoothBroker.hpp"
+#include "tinyb/BluetoothGattServer.hpp"
@@ -25,6 +25,7 @@
 #pragma once
 #include "BluetoothObject.hpp"
 #include "BluetoothManager.hpp"
+#include "BluetoothDiscoveryFilter.hpp"
 #include <vector>
 
 /* Forward declaration of types */
@@ -54,6 +55,11 @@ private:
         const std::string &arg_device
     );
 
+    /** Closes the discovery sessions of a removed adapter. */
+    static void forget_discovery_sessions (
+        const std::string &path
+    );
+
 
 protected:
     BluetoothAdapter(Adapter1 *object);
@@ -75,6 +81,25 @@ public:
     virtual std::string get_object_path() const;
     virtual BluetoothType get_bluetooth_type() const;
 
+    /** The values of all properties of an adapter, read at once. Properties
+      * unknown to BlueZ are left empty or zero.
+      */
+    struct Snapshot {
+        std::string path;
+        std::string address;
+        std::string name;
+        std::string alias;
+        std::string modalias;
+        std::vector<std::string> uuids;
+        uint32_t device_class = 0;
+        uint32_t discoverable_timeout = 0;
+        uint32_t pairable_timeout = 0;
+        bool powered = false;
+        bool discoverable = false;
+        bool pairable = false;
+        bool discovering = false;
+    };
+
     BluetoothAdapter(const BluetoothAdapter &object);
     ~BluetoothAdapter();
     virtual BluetoothAdapter *clone() const;
@@ -102,6 +127,42 @@ public:
     bool stop_discovery (
     );
 
+    /** Sets the filter applied to device discovery. Replaces the filter
+      * of the discovery sessions until one is opened or closed.
+      * @param[in] filter The filter, a default one removes filtering
+      * @return TRUE if the filter was set
+      */
+    bool set_discovery_filter (
+        const BluetoothDiscoveryFilter &filter
+    );
+
+    /** Opens a discovery session on this adapter. Discovery runs while at
+      * least one session is open on the adapter, with a filter merged
+      * from the filters of all open sessions, so each session sees at
+      * least the devices matching its own filter. Discovery still runs
+      * unfiltered if the adapter does not support filters.
+      * Sessions share the discovery of this process with
+      * start_discovery() and stop_discovery(), which should not be used
+      * while sessions are open.
+      * @param[in] filter The devices this session is interested in
+      * @return An id to be passed to close_discovery_session(), 0 if
+      * discovery could not be started
+      */
+    unsigned int open_discovery_session (
+        const BluetoothDiscoveryFilter &filter = BluetoothDiscoveryFilter()
+    );
+
+    /** Closes a discovery session. Discovery stops when the last session
+      * of the adapter is closed, otherwise the filter is narrowed to the
+      * remaining sessions. The sessions of an adapter which is removed are
+      * closed with it.
+      * @param[in] id The id returned by open_discovery_session()
+      * @return TRUE if the session existed
+      */
+    static bool close_discovery_session (
+        unsigned int id
+    );
+
 
     /** Returns a list of BluetoothDevices visible from this adapter.
       * @return A list of BluetoothDevices visible on this adapter,
@@ -198,4 +259,20 @@ public:
       */
     std::unique_ptr<std::string> get_modalias ();
 
+    /** Returns the values of all properties of this adapter. They are read
+      * together on the event thread, so they are consistent with each other,
+      * unlike the results of separate getter calls.
+      * @return The properties of this adapter.
+      */
+    Snapshot snapshot ();
+
+    /** Reads the properties of several adapters in one pass, consistent
+      * across all of them.
+      * @param adapters The adapters to read
+      * @param snapshots Filled with one snapshot per adapter, in the same
+      * order; its storage is reused between calls
+      */
+    static void snapshot (
+        const std::vector<std::unique_ptr<BluetoothAdapter>> &adapters,
+        std::vector<Snapshot> &snapshots);
 };
@@ -0,0 +1,59 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tinyb {
+    struct BluetoothAdvertisement;
+}
+
+/**
+  * Advertised data of a device, as delivered by
+  * BluetoothManager::subscribe_advertisements().
+  */
+struct tinyb::BluetoothAdvertisement
+{
+    /** The D-Bus object path of the device */
+    std::string path;
+    std::string address;
+    std::string name;
+    int16_t rssi = 0;
+    /** False if the payload did not change since the last delivery of
+      * this device and it is only delivered as a heartbeat */
+    bool changed = true;
+    /** Manufacturer specific data, keyed by company identifier */
+    std::map<uint16_t, std::vector<unsigned char>> manufacturer_data;
+    /** Service data, keyed by service UUID */
+    std::map<std::string, std::vector<unsigned char>> service_data;
+};
+
+/** Callback receiving the advertised data of a device.
+  */
+typedef void (*BluetoothAdvertisementCallback)(
+    const tinyb::BluetoothAdvertisement &advertisement, void *data);
@@ -0,0 +1,260 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include "BluetoothPropertyChange.hpp"
+#include "BluetoothAdvertisement.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+/* Forward declaration of types */
+struct BrokerHeader;
+struct BrokerDevice;
+struct BrokerRecord;
+struct BrokerCompletions;
+struct _Device1;
+typedef struct _Device1 Device1;
+
+namespace tinyb {
+    class BluetoothBroker;
+    class BluetoothBrokerClient;
+    struct BluetoothBrokerDevice;
+    struct BluetoothBrokerEvent;
+}
+
+/**
+  * State of a device, as published by a BluetoothBroker.
+  */
+struct tinyb::BluetoothBrokerDevice
+{
+    std::string path;
+    std::string address;
+    std::string name;
+    int16_t rssi = 0;
+    bool connected = false;
+    bool paired = false;
+    bool trusted = false;
+    /** Monotonic time of the last change in microseconds */
+    int64_t updated = 0;
+};
+
+/**
+  * An event published by a BluetoothBroker.
+  */
+struct tinyb::BluetoothBrokerEvent
+{
+    enum class Type {
+        /** An advertisement of the device at path, data contains its
+          * manufacturer data as a sequence of company identifier (2 bytes),
+          * length (2 bytes), both little endian, and data */
+        ADVERTISEMENT = 1,
+        /** A new value of the characteristic at path, in data */
+        NOTIFICATION = 2,
+        /** The device at path was added or its state changed */
+        DEVICE_CHANGED = 3,
+        /** The device at path was removed */
+        DEVICE_REMOVED = 4,
+    };
+
+    Type type;
+    std::string path;
+    int16_t rssi = 0;
+    /** Monotonic time in microseconds */
+    int64_t timestamp = 0;
+    std::vector<unsigned char> data;
+};
+
+/**
+  * Publishes the state of this process' BluetoothManager to other
+  * processes, so that they do not need a D-Bus session of their own.
+  * Device states are kept in a table and advertisements, notifications
+  * and device changes are written to a ring, both in shared memory which
+  * clients map read-only. A control socket accepts the requests of the
+  * clients, like subscribing to the notifications of a characteristic.
+  */
+class tinyb::BluetoothBroker
+{
+private:
+    struct Client {
+        unsigned int id;
+        int fd;
+        /* Characteristic paths subscribed to by this client */
+        std::vector<std::string> subscriptions;
+        unsigned int discovery;
+    };
+
+    struct Stream {
+        unsigned int id;
+        unsigned int clients;
+    };
+
+    std::string name;
+    unsigned char *base;
+    size_t size;
+    BrokerHeader *header;
+
+    /* Serializes writes to the shared memory */
+    std::mutex lock;
+    std::map<std::string, uint32_t> device_slots;
+    std::vector<uint32_t> free_slots;
+    std::map<std::string, Stream> streams;
+
+    unsigned int property_id;
+    unsigned int advertisement_id;
+    unsigned long added_handler;
+    unsigned long removed_handler;
+
+    int listen_fd;
+    int stop_fd;
+    std::vector<Client> clients;
+    unsigned int last_client_id;
+    /* Replies of connect and disconnect requests, whose D-Bus calls
+     * complete on the event thread */
+    std::shared_ptr<BrokerCompletions> completions;
+    std::thread control;
+
+    BrokerDevice *get_device(const std::string &path, bool create);
+    void remove_device(const std::string &path);
+    void update_device(Device1 *device);
+    void write_record(uint16_t type, const std::string &path, int16_t rssi,
+        const unsigned char *data, size_t data_size);
+    std::string handle_request(Client &client, const std::string &request);
+    bool subscribe(const std::string &path);
+    bool unsubscribe(const std::string &path);
+    void release(Client &client);
+    void send_completions();
+    void control_loop();
+
+    static void property_callback(
+        const std::vector<BluetoothPropertyChange> &changes, void *data);
+    static void advertisement_callback(
+        const BluetoothAdvertisement &advertisement, void *data);
+    static void notification_callback(BluetoothGattCharacteristic &characteristic,
+        std::shared_ptr<const std::vector<unsigned char>> value, void *data);
+    static void object_added_callback(void *manager, void *object, void *data);
+    static void object_removed_callback(void *manager, void *object, void *data);
+
+public:
+    /** Starts publishing under name, replacing a previous broker of the
+      * same name which did not shut down. Throws std::runtime_error if the
+      * shared memory or the control socket cannot be created.
+      * @param name The name clients connect to
+      * @param device_capacity The maximum number of devices in the table
+      * @param ring_size The size of the event ring in bytes, rounded up to
+      * a power of two
+      */
+    BluetoothBroker(const std::string &name,
+        unsigned int device_capacity = 1024,
+        size_t ring_size = 4 * 1024 * 1024);
+    BluetoothBroker(const BluetoothBroker &) = delete;
+    ~BluetoothBroker();
+};
+
+/**
+  * Reads the state published by a BluetoothBroker in another process and
+  * sends it requests. Does not use D-Bus. Not thread safe.
+  */
+class tinyb::BluetoothBrokerClient
+{
+private:
+    int socket_fd;
+    const unsigned char *base;
+    size_t size;
+    const BrokerHeader *header;
+    uint64_t tail;
+    uint64_t lost;
+
+    bool request(const std::string &request);
+
+public:
+    /** Connects to the broker published under name. Throws
+      * std::runtime_error if there is no such broker.
+      * @param name The name passed to the broker
+      */
+    BluetoothBrokerClient(const std::string &name);
+    BluetoothBrokerClient(const BluetoothBrokerClient &) = delete;
+    ~BluetoothBrokerClient();
+
+    /** Returns the current state of all devices known to the broker.
+      * @return The devices
+      */
+    std::vector<BluetoothBrokerDevice> get_devices();
+
+    /** Reads the next event published after this client connected.
+      * @param event Receives the event
+      * @param timeout How long to wait for an event, zero to return
+      * immediately
+      * @return TRUE if an event was read
+      */
+    bool next(BluetoothBrokerEvent &event,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+
+    /** Returns how many times events were lost because this client read
+      * them too slowly and they were overwritten in the ring.
+      * @return The number of times events were lost
+      */
+    uint64_t get_lost();
+
+    /** Asks the broker to publish the notifications of a characteristic.
+      * @param path The object path of the characteristic
+      * @return TRUE if the broker subscribed to the characteristic
+      */
+    bool subscribe(const std::string &path);
+
+    /** Cancels a subscribe() request.
+      * @param path The object path of the characteristic
+      * @return TRUE if this client had subscribed to the characteristic
+      */
+    bool unsubscribe(const std::string &path);
+
+    /** Asks the broker to open a discovery session for this client, which
+      * is closed by stop_discovery() or when the client disconnects.
+      * @return TRUE if discovery is running
+      */
+    bool start_discovery();
+
+    /** Closes the discovery session of this client.
+      * @return TRUE if the client had a discovery session
+      */
+    bool stop_discovery();
+
+    /** Asks the broker to connect to a device.
+      * @param path The object path of the device
+      * @return TRUE if the device is connected
+      */
+    bool connect(const std::string &path);
+
+    /** Asks the broker to disconnect from a device.
+      * @param path The object path of the device
+      * @return TRUE if the device is disconnected
+      */
+    bool disconnect(const std::string &path);
+};
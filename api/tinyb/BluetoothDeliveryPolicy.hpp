@@ -0,0 +1,94 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include <cstddef>
+
+namespace tinyb {
+    class BluetoothDeliveryPolicy;
+}
+
+/**
+  * Selects how values are handed to a subscriber which may be slower than
+  * the values arrive. Except for DIRECT, the subscriber is called from a
+  * small pool of delivery threads shared by all subscriptions, so it can
+  * never stall tinyb's event thread, and the number of pending values is
+  * bounded. Deliveries to one subscriber never overlap.
+  */
+class tinyb::BluetoothDeliveryPolicy
+{
+public:
+    enum class Mode {
+        /** Called from the event thread for every value */
+        DIRECT,
+        /** Every value, queued up to a limit, the oldest values are
+          * dropped when the queue is full */
+        ALL,
+        /** Only the latest value, values arriving while the subscriber is
+          * busy replace the pending one */
+        LATEST,
+        /** The latest value, at most at a fixed rate */
+        SAMPLE
+    };
+
+private:
+    Mode mode;
+    size_t queue_size;
+    double rate;
+
+    BluetoothDeliveryPolicy(Mode mode, size_t queue_size, double rate) :
+        mode(mode), queue_size(queue_size), rate(rate) {}
+
+public:
+    static BluetoothDeliveryPolicy direct() {
+        return BluetoothDeliveryPolicy(Mode::DIRECT, 0, 0);
+    }
+
+    /** @param queue_size The maximum number of pending values */
+    static BluetoothDeliveryPolicy all(size_t queue_size) {
+        return BluetoothDeliveryPolicy(Mode::ALL, queue_size > 0 ? queue_size : 1, 0);
+    }
+
+    static BluetoothDeliveryPolicy latest() {
+        return BluetoothDeliveryPolicy(Mode::LATEST, 1, 0);
+    }
+
+    /** @param rate The maximum number of deliveries per second */
+    static BluetoothDeliveryPolicy sample(double rate) {
+        return BluetoothDeliveryPolicy(Mode::SAMPLE, 1, rate);
+    }
+
+    Mode get_mode() const {
+        return mode;
+    }
+
+    size_t get_queue_size() const {
+        return queue_size;
+    }
+
+    double get_rate() const {
+        return rate;
+    }
+};
@@ -51,6 +51,14 @@ friend class tinyb::BluetoothGattService;
 private:
     Device1 *object;
 
+    struct StateWatch;
+    static void state_changed_callback(void *object, void *pspec, void *data);
+    std::shared_ptr<StateWatch> watch_state(const char *property,
+        bool value, BluetoothCallback cb, void *data,
+        std::chrono::milliseconds timeout);
+    bool wait_state(const char *property, bool value,
+        std::chrono::milliseconds timeout);
+
 protected:
     BluetoothDevice(Device1 *object);
 
@@ -71,6 +79,28 @@ public:
     virtual std::string get_object_path() const;
     virtual BluetoothType get_bluetooth_type() const;
 
+    /** The values of all properties of a device, read at once. Properties
+      * unknown to BlueZ are left empty or zero.
+      */
+    struct Snapshot {
+        std::string path;
+        std::string address;
+        std::string name;
+        std::string alias;
+        std::string icon;
+        std::string modalias;
+        std::string adapter;
+        std::vector<std::string> uuids;
+        uint32_t device_class = 0;
+        uint16_t appearance = 0;
+        int16_t rssi = 0;
+        bool connected = false;
+        bool paired = false;
+        bool trusted = false;
+        bool blocked = false;
+        bool legacy_pairing = false;
+    };
+
     BluetoothDevice(const BluetoothDevice &object);
     ~BluetoothDevice();
     virtual BluetoothDevice *clone() const;
@@ -129,6 +159,78 @@ public:
     bool cancel_pairing (
     );
 
+    /** Waits until this device is connected. The wait is woken up by the
+      * property change signal of BlueZ, so it returns as soon as the state
+      * changes. It returns immediately if the device is already connected.
+      * @param timeout the function will return after timeout time, a
+      * value of zero means wait forever.
+      * @return TRUE if the device is connected
+      */
+    bool wait_connected (
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()
+    );
+
+    /** Waits until this device is disconnected.
+      * @param timeout the function will return after timeout time, a
+      * value of zero means wait forever.
+      * @return TRUE if the device is disconnected
+      */
+    bool wait_disconnected (
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()
+    );
+
+    /** Waits until this device is paired.
+      * @param timeout the function will return after timeout time, a
+      * value of zero means wait forever.
+      * @return TRUE if the device is paired
+      */
+    bool wait_paired (
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()
+    );
+
+    /** Calls cb once this device is connected, from tinyb's event thread.
+      * If the device is already connected, cb is called before returning.
+      * @param cb the callback, receiving this device and data
+      * @param data user data passed to the callback
+      * @param timeout the wait is canceled after timeout time, a value of
+      * zero means never. The returned pointer expires once the wait was
+      * canceled or cb was called.
+      * @return The BluetoothEvent generated by this function, allowing to
+      * cancel the wait.
+      */
+    std::weak_ptr<BluetoothEvent> wait_connected_async (
+        BluetoothCallback cb, void *data = nullptr,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()
+    );
+
+    /** Calls cb once this device is disconnected, from tinyb's event thread.
+      * @param cb the callback, receiving this device and data
+      * @param data user data passed to the callback
+      * @param timeout the wait is canceled after timeout time, a value of
+      * zero means never. The returned pointer expires once the wait was
+      * canceled or cb was called.
+      * @return The BluetoothEvent generated by this function, allowing to
+      * cancel the wait.
+      */
+    std::weak_ptr<BluetoothEvent> wait_disconnected_async (
+        BluetoothCallback cb, void *data = nullptr,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()
+    );
+
+    /** Calls cb once this device is paired, from tinyb's event thread.
+      * @param cb the callback, receiving this device and data
+      * @param data user data passed to the callback
+      * @param timeout the wait is canceled after timeout time, a value of
+      * zero means never. The returned pointer expires once the wait was
+      * canceled or cb was called.
+      * @return The BluetoothEvent generated by this function, allowing to
+      * cancel the wait.
+      */
+    std::weak_ptr<BluetoothEvent> wait_paired_async (
+        BluetoothCallback cb, void *data = nullptr,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()
+    );
+
     /** Returns a list of BluetoothGattServices available on this device.
       * @return A list of BluetoothGattServices available on this device,
       * NULL if an error occurred
@@ -224,4 +326,29 @@ public:
       * @return The adapter.
       */
     BluetoothAdapter get_adapter ();
+
+    /** Returns the values of all properties of this device. They are read
+      * together on the event thread, so they are consistent with each other,
+      * unlike the results of separate getter calls.
+      * @return The properties of this device.
+      */
+    Snapshot snapshot ();
+
+    /** Reads the properties of several devices in one pass, consistent
+      * across all of them.
+      * @param devices The devices to read
+      * @param snapshots Filled with one snapshot per device, in the same
+      * order; its storage is reused between calls
+      */
+    static void snapshot (
+        const std::vector<std::unique_ptr<BluetoothDevice>> &devices,
+        std::vector<Snapshot> &snapshots);
+
+    /** Reads the properties of all known devices in one pass, without
+      * making a BluetoothDevice for each of them.
+      * @param snapshots Filled with one snapshot per device; its storage is
+      * reused between calls
+      */
+    static void snapshot_all (
+        std::vector<Snapshot> &snapshots);
 };
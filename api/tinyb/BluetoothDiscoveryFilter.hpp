@@ -0,0 +1,70 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tinyb {
+    struct BluetoothDiscoveryFilter;
+}
+
+/**
+  * Restricts the devices reported by a discovery session, see
+  * BluetoothAdapter::open_discovery_session(). Follows SetDiscoveryFilter
+  * of the BlueZ adapter API, the default value of each field does not
+  * restrict anything.
+  */
+struct tinyb::BluetoothDiscoveryFilter
+{
+    enum class Transport {
+        AUTO,
+        BREDR,
+        LE
+    };
+
+    /** Value of rssi meaning no threshold */
+    static const int16_t RSSI_ANY = INT16_MIN;
+
+    /** Only report devices advertising one of these service UUIDs, any
+      * device if empty */
+    std::vector<std::string> uuids;
+    /** Only report devices received with at least this RSSI */
+    int16_t rssi = RSSI_ANY;
+    Transport transport = Transport::AUTO;
+    /** Report every advertisement instead of only property changes */
+    bool duplicate_data = false;
+
+    bool operator==(const BluetoothDiscoveryFilter &other) const {
+        return uuids == other.uuids && rssi == other.rssi &&
+            transport == other.transport &&
+            duplicate_data == other.duplicate_data;
+    }
+
+    bool operator!=(const BluetoothDiscoveryFilter &other) const {
+        return !(*this == other);
+    }
+};
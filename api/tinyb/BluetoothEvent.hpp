@@ -25,14 +25,20 @@
 #include <string>
 #include <condition_variable>
 #include <atomic>
+#include <thread>
+#include <functional>
 #include "BluetoothObject.hpp"
 #pragma once
 
 using namespace tinyb;
 
 typedef void (*BluetoothCallback)(BluetoothObject &, void *);
+/* Called with the data of the event when its timeout expires */
+typedef void (*BluetoothExpiredCallback)(void *);
 
 class tinyb::BluetoothEvent {
+friend class tinyb::BluetoothManager;
+
 private:
     std::string *name;
     std::string *identifier;
@@ -41,7 +47,13 @@ private:
     bool execute_once;
     BluetoothCallback cb;
     void *data;
-    bool canceled;
+    std::atomic_bool canceled;
+    /* Timer of the timeout, if any, owned by BluetoothManager */
+    uint64_t timeout_timer;
+    /* Run once by cancel(), to release what the event is waiting on */
+    std::function<void()> cancel_hook;
+    std::mutex hook_lock;
+    BluetoothExpiredCallback expired_cb;
 
 class BluetoothConditionVariable {
 
@@ -59,42 +71,44 @@ class BluetoothConditionVariable {
         triggered = false;
     }
 
+    /* triggered is checked under lock, so a notify() racing with a waiter
+     * going to sleep cannot be lost */
     BluetoothObject *wait() {
-        if (result != nullptr)
-            return result;
-
-        if (!triggered) {
-            std::unique_lock<std::mutex> lk(lock);
-            waiting++;
+        std::unique_lock<std::mutex> lk(lock);
+        waiting++;
+        while (!triggered)
             cv.wait(lk);
-            waiting--;
-        }
+        BluetoothObject *r = result;
+        lk.unlock();
+        waiting--;
 
-        return result;
+        return r;
     }
 
     BluetoothObject *wait_for(std::chrono::milliseconds timeout) {
-        if (result != nullptr)
-            return result;
-
-        if (!triggered) {
-            waiting++;
-            std::unique_lock<std::mutex> lk(lock);
-            cv.wait_for(lk, timeout);
-            waiting--;
-        }
-
-        return result;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::unique_lock<std::mutex> lk(lock);
+        waiting++;
+        while (!triggered)
+            if (cv.wait_until(lk, deadline) == std::cv_status::timeout)
+                break;
+        BluetoothObject *r = result;
+        lk.unlock();
+        waiting--;
+
+        return r;
     }
 
     void notify() {
+        std::lock_guard<std::mutex> lk(lock);
         triggered = true;
-        while (waiting != 0)
-            cv.notify_all();
+        cv.notify_all();
     }
 
     ~BluetoothConditionVariable() {
         notify();
+        while (waiting != 0)
+            std::this_thread::yield();
     }
 };
 
@@ -106,7 +120,8 @@ public:
 
     BluetoothEvent(BluetoothType type, std::string *name, std::string *identifier,
         BluetoothObject *parent, bool execute_once = true,
-        BluetoothCallback cb = generic_callback, void *data = NULL);
+        BluetoothCallback cb = generic_callback, void *data = NULL,
+        BluetoothExpiredCallback expired_cb = nullptr);
     ~BluetoothEvent();
 
     BluetoothType get_type() const {
@@ -130,12 +145,23 @@ public:
         return (cb != NULL);
     }
 
+    bool is_canceled() const {
+        return canceled;
+    }
+
    BluetoothObject *get_result() {
         return cv.result;
    }
 
    void cancel();
 
+   /* Cancels the event when its timeout expires, calling the expired
+    * callback unless it was already canceled */
+   void expire();
+
+   /* Sets a function run once when the event is canceled or expires */
+   void set_cancel_hook(std::function<void()> hook);
+
    void wait(std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
 
    bool operator==(BluetoothEvent const &other);
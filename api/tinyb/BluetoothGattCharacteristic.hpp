@@ -26,6 +26,7 @@
 #include "BluetoothObject.hpp"
 #include "BluetoothManager.hpp"
 #include "BluetoothGattDescriptor.hpp"
+#include "BluetoothDeliveryPolicy.hpp"
 #include <string>
 #include <vector>
 
@@ -35,6 +36,36 @@ typedef struct _Object Object;
 struct _GattCharacteristic1;
 typedef struct _GattCharacteristic1 GattCharacteristic1;
 
+/** Callback receiving the new value of a characteristic. The value buffer is
+  * shared between all subscribers of the characteristic and must not be
+  * modified, it can be kept for as long as needed. Depending on the
+  * BluetoothDeliveryPolicy of the subscription, it is called from the event
+  * thread or from a thread of the subscription.
+  */
+typedef void (*BluetoothNotificationCallback)(
+    tinyb::BluetoothGattCharacteristic &characteristic,
+    std::shared_ptr<const std::vector<unsigned char>> value,
+    void *data);
+
+/** Progress of BluetoothGattCharacteristic::transfer(), reported each time
+  * a chunk was written.
+  */
+struct BluetoothTransferProgress {
+    /** Offset up to which all data was written */
+    size_t offset;
+    /** Size of the whole buffer */
+    size_t total;
+    /** Bytes written per second since the transfer started */
+    double throughput;
+};
+
+/** Callback receiving the progress of a transfer, called on the thread
+  * calling transfer().
+  */
+typedef void (*BluetoothTransferCallback)(
+    tinyb::BluetoothGattCharacteristic &characteristic,
+    const BluetoothTransferProgress &progress, void *data);
+
 /**
   * Provides access to Bluetooth GATT characteristic. Follows the BlueZ adapter API
   * available at: http://git.kernel.org/cgit/bluetooth/bluez.git/tree/doc/gatt-api.txt
@@ -46,10 +77,14 @@ friend class tinyb::BluetoothGattService;
 friend class tinyb::BluetoothGattDescriptor;
 friend class tinyb::BluetoothManager;
 friend class tinyb::BluetoothEventManager;
+friend class tinyb::BluetoothBroker;
 
 private:
     GattCharacteristic1 *object;
 
+    static void value_changed_callback(void *object, void *pspec, void *data);
+    static void forget_session(const std::string &path);
+
 protected:
     BluetoothGattCharacteristic(GattCharacteristic1 *object);
 
@@ -70,6 +105,18 @@ public:
     virtual std::string get_object_path() const;
     virtual BluetoothType get_bluetooth_type() const;
 
+    /** The values of all properties of a GATT characteristic, read at once. Properties
+      * unknown to BlueZ are left empty or zero.
+      */
+    struct Snapshot {
+        std::string path;
+        std::string uuid;
+        std::string service;
+        std::vector<unsigned char> value;
+        std::vector<std::string> flags;
+        bool notifying = false;
+    };
+
     BluetoothGattCharacteristic(const BluetoothGattCharacteristic &object);
     ~BluetoothGattCharacteristic();
     virtual BluetoothGattCharacteristic *clone() const;
@@ -97,12 +144,75 @@ public:
       */
     bool write_value (const std::vector<unsigned char> &arg_value);
 
+    /** Writes a large buffer as a stream of chunks which fit the ATT MTU,
+      * e.g. for firmware updates. Each chunk is a separate write of the
+      * value, with up to window writes in flight. Writes without response
+      * are used if the characteristic allows them. The transfer stops at
+      * the first failed write, and can be resumed, e.g. after reconnecting,
+      * by passing the returned offset. Writes without response need the
+      * options of WriteValue, added in BlueZ 5.40; older releases reject
+      * them and the transfer falls back to plain write requests. Chunks
+      * follow the MTU property of BlueZ 5.62 and later, and the 23 byte
+      * minimum ATT MTU before.
+      * @param value The whole buffer
+      * @param offset The offset in value to start from
+      * @param window The maximum number of writes in flight
+      * @param cb Optional callback receiving the progress
+      * @param data User data passed to cb
+      * @return The offset up to which value was written, value.size() if
+      * the transfer is complete
+      */
+    size_t transfer (const std::vector<unsigned char> &value,
+        size_t offset = 0, unsigned int window = 4,
+        BluetoothTransferCallback cb = nullptr, void *data = nullptr);
+
+    /** Returns the ATT MTU negotiated for the connection of this
+      * characteristic, or the 23 byte minimum if BlueZ does not report it.
+      * @return The ATT MTU
+      */
+    uint16_t get_mtu ();
+
     bool start_notify (
     );
 
     bool stop_notify (
     );
 
+    /** Subscribes to value notifications of this characteristic. Sessions
+      * are reference counted per characteristic: the first subscriber
+      * enables notifications and the following ones share them. Each new
+      * value is offered to all subscribers, which receive it according to
+      * their delivery policy. Calling stop_notify() directly ends the
+      * session for all subscribers, until the next subscriber starts it
+      * again; so does the removal of the characteristic by BlueZ, the
+      * session following the object BlueZ creates under the same path.
+      * @param cb the callback receiving the values
+      * @param data user data passed to the callback
+      * @param policy how values are delivered if cb is slower than they
+      * arrive, by default cb is called directly from the event thread
+      * @return An id to be passed to unsubscribe(), 0 if notifications
+      * could not be enabled
+      */
+    unsigned int subscribe (BluetoothNotificationCallback cb,
+        void *data = nullptr,
+        const BluetoothDeliveryPolicy &policy = BluetoothDeliveryPolicy::direct());
+
+    /** Returns the number of values a subscription dropped, or replaced by
+      * newer ones, because its callback was too slow.
+      * @param id The id returned by subscribe()
+      * @return The number of values not delivered
+      */
+    uint64_t get_dropped (unsigned int id);
+
+    /** Removes a subscription created by subscribe(). Notifications are
+      * disabled when the last subscriber of this characteristic leaves. No
+      * callback of the subscription runs anymore once this returns, unless
+      * it is called from that callback.
+      * @param id The id returned by subscribe()
+      * @return TRUE if the subscription existed
+      */
+    bool unsubscribe (unsigned int id);
+
     /* D-Bus property accessors: */
     /** Get the UUID of this characteristic.
       * @return The 128 byte UUID of this characteristic, NULL if an error occurred
@@ -136,4 +246,20 @@ public:
       */
     std::vector<std::unique_ptr<BluetoothGattDescriptor>> get_descriptors ();
 
+    /** Returns the values of all properties of this characteristic. They are read
+      * together on the event thread, so they are consistent with each other,
+      * unlike the results of separate getter calls.
+      * @return The properties of this characteristic.
+      */
+    Snapshot snapshot ();
+
+    /** Reads the properties of several characteristics in one pass, consistent
+      * across all of them.
+      * @param characteristics The characteristics to read
+      * @param snapshots Filled with one snapshot per characteristic, in the same
+      * order; its storage is reused between calls
+      */
+    static void snapshot (
+        const std::vector<std::unique_ptr<BluetoothGattCharacteristic>> &characteristics,
+        std::vector<Snapshot> &snapshots);
 };
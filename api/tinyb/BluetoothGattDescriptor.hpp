@@ -68,6 +68,16 @@ public:
     virtual std::string get_object_path() const;
     virtual BluetoothType get_bluetooth_type() const;
 
+    /** The values of all properties of a GATT descriptor, read at once. Properties
+      * unknown to BlueZ are left empty or zero.
+      */
+    struct Snapshot {
+        std::string path;
+        std::string uuid;
+        std::string characteristic;
+        std::vector<unsigned char> value;
+    };
+
     BluetoothGattDescriptor(const BluetoothGattDescriptor &object);
     ~BluetoothGattDescriptor();
     virtual BluetoothGattDescriptor *clone() const;
@@ -104,4 +114,20 @@ public:
       */
     std::vector<unsigned char> get_value ();
 
+    /** Returns the values of all properties of this descriptor. They are read
+      * together on the event thread, so they are consistent with each other,
+      * unlike the results of separate getter calls.
+      * @return The properties of this descriptor.
+      */
+    Snapshot snapshot ();
+
+    /** Reads the properties of several descriptors in one pass, consistent
+      * across all of them.
+      * @param descriptors The descriptors to read
+      * @param snapshots Filled with one snapshot per descriptor, in the same
+      * order; its storage is reused between calls
+      */
+    static void snapshot (
+        const std::vector<std::unique_ptr<BluetoothGattDescriptor>> &descriptors,
+        std::vector<Snapshot> &snapshots);
 };
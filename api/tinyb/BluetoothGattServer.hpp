@@ -0,0 +1,140 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include "BluetoothAdapter.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tinyb {
+    class BluetoothGattServer;
+}
+
+/** Callback receiving the value of a local characteristic after a remote
+  * central wrote to it, called from the event thread. A write at an offset
+  * replaces the value from that offset on.
+  */
+typedef void (*BluetoothGattWriteCallback)(unsigned int characteristic,
+    const std::vector<unsigned char> &value, void *data);
+
+/**
+  * Local GATT services, registered with an adapter through BlueZ's
+  * GattManager1 so remote centrals can use them (peripheral role). The
+  * objects are exported on tinyb's connection with the ReadValue(a{sv})
+  * and WriteValue(ay, a{sv}) of BlueZ 5.40 and later, which is also the
+  * first release calling them with the offset option, honoured here.
+  *
+  * Values are shared with the caller, not copied, until they are
+  * serialized into a D-Bus message. Notifications are queued and sent in
+  * batches from the event thread, one signal per value, so none are lost
+  * however fast set_value() is called.
+  */
+class tinyb::BluetoothGattServer
+{
+private:
+    struct State;
+    std::shared_ptr<State> state;
+
+    static int flush_callback(void *data);
+    static void free_state(void *data);
+    static void free_handle(void *data);
+    static void method_call(void *connection, const char *sender,
+        const char *path, const char *interface, const char *method,
+        void *parameters, void *invocation, void *data);
+    static void *get_property(void *connection, const char *sender,
+        const char *path, const char *interface, const char *property,
+        void *error, void *data);
+    static void get_managed_objects(State &state, void *invocation);
+    static void read_value(State &state, unsigned int id, void *parameters,
+        void *invocation);
+    static void write_value(State &state, unsigned int id, void *parameters,
+        void *invocation);
+    static void set_notifying(State &state, unsigned int id, void *invocation,
+        bool notifying);
+    static bool export_objects(const std::shared_ptr<State> &state);
+    static void unexport_objects(State &state);
+
+public:
+    /** Creates an empty application.
+      * @param path The D-Bus object path under which the services are
+      * exported, must be unique in the process
+      */
+    BluetoothGattServer(const std::string &path = "/org/tinyb/gatt");
+    BluetoothGattServer(const BluetoothGattServer &) = delete;
+    /** Unregisters the application if it is registered. */
+    ~BluetoothGattServer();
+
+    /** Adds a service. Services and characteristics must be added before
+      * register_application().
+      * @param uuid The UUID of the service
+      * @param primary FALSE for a secondary service
+      * @return An id to be passed to add_characteristic()
+      */
+    unsigned int add_service(const std::string &uuid, bool primary = true);
+
+    /** Adds a characteristic to a service.
+      * @param service The id returned by add_service()
+      * @param uuid The UUID of the characteristic
+      * @param flags The BlueZ characteristic flags, e.g. "read", "write",
+      * "notify"
+      * @param cb Optional callback receiving the values written by centrals
+      * @param data User data passed to cb
+      * @return An id to be passed to set_value()
+      */
+    unsigned int add_characteristic(unsigned int service,
+        const std::string &uuid, const std::vector<std::string> &flags,
+        BluetoothGattWriteCallback cb = nullptr, void *data = nullptr);
+
+    /** Sets the value of a characteristic, which is returned to reads and
+      * notified if a central enabled notifications. Can be called from any
+      * thread. The buffer is kept, not copied, and must not be modified
+      * afterwards.
+      * @param characteristic The id returned by add_characteristic()
+      * @param value The new value
+      * @return TRUE if a notification was queued
+      */
+    bool set_value(unsigned int characteristic,
+        std::shared_ptr<const std::vector<unsigned char>> value);
+
+    /** Returns TRUE if a central enabled notifications of a characteristic.
+      * @param characteristic The id returned by add_characteristic()
+      * @return TRUE if notifications are enabled
+      */
+    bool get_notifying(unsigned int characteristic);
+
+    /** Exports the services and registers them with an adapter. BlueZ reads
+      * them back before replying, so this must not be called from the event
+      * thread.
+      * @param adapter The adapter to register with
+      * @return TRUE if the application was registered
+      */
+    bool register_application(BluetoothAdapter &adapter);
+
+    /** Unregisters the application and stops exporting it.
+      * @return TRUE if the application was registered
+      */
+    bool unregister_application();
+};
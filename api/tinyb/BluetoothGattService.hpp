@@ -70,6 +70,16 @@ public:
     virtual std::string get_object_path() const;
     virtual BluetoothType get_bluetooth_type() const;
 
+    /** The values of all properties of a GATT service, read at once. Properties
+      * unknown to BlueZ are left empty or zero.
+      */
+    struct Snapshot {
+        std::string path;
+        std::string uuid;
+        std::string device;
+        bool primary = false;
+    };
+
     BluetoothGattService(const BluetoothGattService &object);
     ~BluetoothGattService();
     virtual BluetoothGattService *clone() const;
@@ -105,4 +115,20 @@ public:
       */
     std::vector<std::unique_ptr<BluetoothGattCharacteristic>> get_characteristics ();
 
+    /** Returns the values of all properties of this service. They are read
+      * together on the event thread, so they are consistent with each other,
+      * unlike the results of separate getter calls.
+      * @return The properties of this service.
+      */
+    Snapshot snapshot ();
+
+    /** Reads the properties of several services in one pass, consistent
+      * across all of them.
+      * @param services The services to read
+      * @param snapshots Filled with one snapshot per service, in the same
+      * order; its storage is reused between calls
+      */
+    static void snapshot (
+        const std::vector<std::unique_ptr<BluetoothGattService>> &services,
+        std::vector<Snapshot> &snapshots);
 };
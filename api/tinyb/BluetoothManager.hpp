@@ -25,8 +25,15 @@
 #pragma once
 #include "BluetoothObject.hpp"
 #include "BluetoothEvent.hpp"
+#include "BluetoothPropertyChange.hpp"
+#include "BluetoothObjectChange.hpp"
+#include "BluetoothDeliveryPolicy.hpp"
+#include "BluetoothDiscoveryFilter.hpp"
+#include "BluetoothAdvertisement.hpp"
 #include <vector>
 #include <list>
+#include <poll.h>
+#include <mutex>
 
 class tinyb::BluetoothManager: public BluetoothObject
 {
@@ -36,15 +43,27 @@ friend class BluetoothGattService;
 friend class BluetoothGattCharacteristic;
 friend class BluetoothGattDescriptor;
 friend class BluetoothEventManager;
+friend class BluetoothEvent;
 
 private:
     std::unique_ptr<BluetoothAdapter> default_adapter;
     static BluetoothManager *bluetooth_manager;
+    static bool event_thread_enabled;
     std::list<std::shared_ptr<BluetoothEvent>> event_list;
+    std::mutex event_lock;
 
     BluetoothManager();
     BluetoothManager(const BluetoothManager &object);
 
+    void add_event_timeout(std::shared_ptr<BluetoothEvent> &event,
+        std::chrono::milliseconds timeout);
+    void remove_event_timeout(BluetoothEvent &event);
+
+    /* Returns the canonical wrapper of the object, adopting object if
+     * there is none */
+    std::shared_ptr<BluetoothObject> get_shared_object(
+        std::unique_ptr<BluetoothObject> object);
+
 protected:
 
     void handle_event(BluetoothType type, std::string *name,
@@ -70,23 +89,229 @@ public:
       */
     static BluetoothManager *get_bluetooth_manager();
 
+    /** Selects whether tinyb runs its own event thread. This must be called
+      * before the first call to get_bluetooth_manager(). When the event
+      * thread is disabled, no thread is started and the application has to
+      * drive tinyb from its own loop, using prepare_events() and
+      * dispatch_events(). All callbacks are then executed on the thread
+      * calling dispatch_events(), so blocking calls which wait for events,
+      * like find() with a timeout, must not be used from that thread.
+      * @param enabled FALSE to integrate tinyb into an external event loop
+      * @return TRUE if the mode was set, FALSE if the BluetoothManager was
+      * already initialized
+      */
+    static bool set_event_thread_enabled(bool enabled);
+
+    /** Returns true if tinyb runs its own event thread.
+      * @return True if tinyb runs its own event thread.
+      */
+    static bool get_event_thread_enabled();
+
+    /** Prepares an iteration of tinyb's event loop and returns the file
+      * descriptors which must be polled by the external event loop. Usually
+      * this is a single eventfd, which only changes if sources are added or
+      * removed. Only used when the event thread is disabled; every call must
+      * be followed by a call to dispatch_events() on the same thread.
+      * Waits while another thread briefly runs tinyb code on the loop,
+      * and throws std::runtime_error if it is still owned after a second.
+      * @param fds Filled with the file descriptors and events to poll for
+      * @return The maximum time in milliseconds the external loop may block
+      * before calling dispatch_events(), -1 meaning forever
+      */
+    int prepare_events(std::vector<struct pollfd> &fds);
+
+    /** Dispatches all pending events, running the callbacks on the calling
+      * thread. Must be called after polling the descriptors returned by
+      * prepare_events(), even if none of them became ready.
+      * @param fds The descriptors returned by prepare_events(), with the
+      * revents fields filled in by poll/epoll
+      */
+    void dispatch_events(const std::vector<struct pollfd> &fds);
+
+    /** Subscribes to the property changes of all BlueZ objects, delivered in
+      * batches. All changes received during one iteration of the event loop,
+      * or during the batch window if one is set, are delivered by a single
+      * call. Changes are only collected while there are subscribers.
+      * @param cb the callback receiving the batches
+      * @param data user data passed to the callback
+      * @param policy how batches are delivered if cb is slower than they
+      * arrive, by default cb is called directly from the event thread
+      * @return An id to be passed to unsubscribe_property_changes()
+      */
+    unsigned int subscribe_property_changes(BluetoothPropertyBatchCallback cb,
+        void *data = nullptr,
+        const BluetoothDeliveryPolicy &policy = BluetoothDeliveryPolicy::direct());
+
+    /** Removes a subscription created by subscribe_property_changes().
+      * @param id The id returned by subscribe_property_changes()
+      * @return TRUE if the subscription existed
+      */
+    bool unsubscribe_property_changes(unsigned int id);
+
+    /** Sets how long property changes are collected before a batch is
+      * delivered.
+      * @param window The collection window, zero to deliver the changes
+      * received in one iteration of the event loop
+      */
+    void set_property_batch_window(std::chrono::milliseconds window);
+
+    /** Subscribes to the advertisements of all devices. Advertisements are
+      * deduplicated by a cache of the last payload of each device: a
+      * device is only delivered when its advertised data changes, or
+      * again after the heartbeat interval, repeats are dropped. RSSI
+      * alone is not part of the payload.
+      * @param cb the callback receiving the advertisements
+      * @param data user data passed to the callback
+      * @param policy how advertisements are delivered if cb is slower than
+      * they arrive, by default cb is called directly from the event thread
+      * @return An id to be passed to unsubscribe_advertisements()
+      */
+    unsigned int subscribe_advertisements(BluetoothAdvertisementCallback cb,
+        void *data = nullptr,
+        const BluetoothDeliveryPolicy &policy = BluetoothDeliveryPolicy::direct());
+
+    /** Removes a subscription created by subscribe_advertisements().
+      * @param id The id returned by subscribe_advertisements()
+      * @return TRUE if the subscription existed
+      */
+    bool unsubscribe_advertisements(unsigned int id);
+
+    /** Configures the advertisement cache, clearing it. The least recently
+      * seen devices are evicted when it is full, so they are delivered
+      * again when they next advertise.
+      * @param memory The memory used by the cache in bytes, 64 KiB
+      * (1024 devices) by default
+      * @param heartbeat The interval after which an unchanged payload is
+      * delivered again, zero (the default) to never deliver it again
+      */
+    void set_advertisement_cache(size_t memory,
+        std::chrono::milliseconds heartbeat = std::chrono::milliseconds::zero());
+
+    /** Enables the removal of stale devices from BlueZ, which otherwise
+      * keeps every device ever seen. Devices which are neither paired,
+      * trusted nor connected are removed once no property of theirs
+      * changed for max_age, the oldest first. Every second only the
+      * devices which became stale are checked, and they are removed
+      * through asynchronous calls to BlueZ.
+      * @param max_age The time after which devices are removed, zero
+      * disables the removal
+      * @param rate The maximum number of devices removed per second
+      * @param allowlist Addresses of devices which are never removed
+      */
+    void set_device_eviction(std::chrono::seconds max_age,
+        unsigned int rate = 10,
+        const std::vector<std::string> &allowlist = std::vector<std::string>());
+
+    /** Returns the current epoch of the object tree. The epoch is
+      * increased by every object added or removed and every interface or
+      * property change, starting from the objects present at startup.
+      * @return The current epoch
+      */
+    uint64_t get_epoch();
+
+    /** Returns the objects added, modified or removed after epoch, one
+      * entry per object, in the order of their last change. The cost is
+      * proportional to the number of changed objects. Removed objects are
+      * only remembered for the last few thousand removals.
+      * @param epoch An epoch returned by a previous call, or 0
+      * @param changes Filled with the changed objects
+      * @param current Set to the epoch to pass to the next call
+      * @return TRUE if changes is complete. FALSE if removals after epoch
+      * were forgotten, changes then lists all current objects as ADDED and
+      * objects missing from it must be considered removed.
+      */
+    bool changes_since(uint64_t epoch,
+        std::vector<BluetoothObjectChange> &changes, uint64_t &current);
+
+    /** Publishes counters of this process in shared memory, for tools
+      * like tinyb-top: events, signals, notifications per characteristic,
+      * connection state per device, GATT call latencies and delivery queue
+      * depths. Recording is a few atomic increments once enabled. Stats
+      * stay enabled until the process exits.
+      * @param name The stats are published as /dev/shm/tinyb-stats-<name>,
+      * the process id if empty
+      * @return TRUE if stats are enabled
+      */
+    bool enable_stats(const std::string &name = std::string());
+
+    /** Starts logging the D-Bus traffic between tinyb and BlueZ to a binary
+      * file: every incoming signal and reply and every outgoing call, with
+      * monotonic timestamps. The current objects are requested first so a
+      * replay starts from the same state. Records are appended if the file
+      * exists.
+      * @param path The file to append to
+      * @return TRUE if recording started
+      */
+    bool start_recording(const std::string &path);
+
+    /** Stops a recording started by start_recording().
+      */
+    void stop_recording();
+
+    /** Makes tinyb replay a file written by start_recording() instead of
+      * connecting to BlueZ. The recorded signals are dispatched through the
+      * usual event handling and callbacks, calls are answered with the
+      * recorded replies. Must be called before the first call to
+      * get_bluetooth_manager().
+      * @param path The recording to replay
+      * @param realtime TRUE to keep the recorded timing, FALSE to replay as
+      * fast as possible
+      * @return TRUE if the file will be replayed, FALSE if the
+      * BluetoothManager was already initialized
+      */
+    static bool set_replay_file(const std::string &path, bool realtime = true);
+
+    /** Makes tinyb watch only the objects under the given paths, instead of
+      * every object of BlueZ, together with the adapters. tinyb then uses
+      * a private connection with match rules for these paths only, so the
+      * signals of unrelated devices, like their RSSI changes, are not sent
+      * to the process at all. Objects outside the paths are not reported,
+      * unless the discovery feed is enabled with set_discovery_feed(). Must
+      * be called before the first call to get_bluetooth_manager().
+      * @param paths The object paths of the devices to watch, e.g.
+      * "/org/bluez/hci0/dev_00_11_22_33_44_55", or of any of their parents.
+      * An empty list watches everything.
+      * @return TRUE if the paths were set, FALSE if the BluetoothManager
+      * was already initialized
+      */
+    static bool set_watched_paths(const std::vector<std::string> &paths);
+
+    /** In the mode selected by set_watched_paths(), sets whether objects
+      * added outside of the watched paths are reported, to find devices
+      * during discovery. Property changes of these objects are not
+      * received, and the objects reported meanwhile are kept once the feed
+      * is disabled.
+      * @param enabled TRUE to report all added objects
+      * @return TRUE if the feed was changed, FALSE if not watching
+      * selectively or the bus refused the match rule
+      */
+    bool set_discovery_feed(bool enabled);
+
+    /** Returns true once all recorded signals were replayed.
+      * @return True if the replay finished.
+      */
+    static bool get_replay_finished();
+
     /** Add event to checked against events generated by BlueZ. If an the event
       * matches an incoming event its' callback will be triggered. Events can be
       * the addition of a new Device, GattService, GattCharacteristic, etc. */
     void add_event(std::shared_ptr<BluetoothEvent> &event) {
+        std::lock_guard<std::mutex> lk(event_lock);
         event_list.push_back(event);
     }
 
     /** Remove event to checked against events generated by BlueZ.
       */
     void remove_event(std::shared_ptr<BluetoothEvent> &event) {
+        std::lock_guard<std::mutex> lk(event_lock);
         event_list.remove(event);
     }
 
     void remove_event(BluetoothEvent &event) {
+        std::lock_guard<std::mutex> lk(event_lock);
         for(auto it = event_list.begin(); it != event_list.end(); ++it) {
             if ((*it).get() == &event) {
-                event_list.remove(*it);
+                event_list.erase(it);
                 break;
             }
         }
@@ -155,14 +380,20 @@ public:
       * for Adapter or Device)
       * @parameter parent optionally specify the parent of the object you are
       * waiting for
-      * @parameter timeout the function will return after timeout time, a
-      * value of zero means wait forever. If object is not found during this time null will be returned.
+      * @parameter timeout the event is canceled after timeout time, a
+      * value of zero means never. The returned pointer expires once the
+      * event was canceled or, if execute_once is set, triggered.
+      * @parameter data user data passed to cb and expired_cb
+      * @parameter expired_cb optionally called from the event thread when
+      * the timeout expires before the event was triggered or canceled, it is
+      * not called for events canceled by the application
       * @return It returns the BluetoothEvent generated by this function, allowing to manage the parameters or cancel the event.
       */
     std::weak_ptr<BluetoothEvent> find(BluetoothType type, std::string *name,
         std::string* identifier, BluetoothObject *parent, BluetoothCallback cb,
         bool execute_once = true,
-        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero(),
+        void *data = nullptr, BluetoothExpiredCallback expired_cb = nullptr);
 
     /** Return a BluetoothObject of a type matching type. If parameters name,
       * identifier and parent are not null, the returned object will have to
@@ -218,6 +449,47 @@ public:
     std::vector<std::unique_ptr<BluetoothGattService>> get_services(
     );
 
+    /** Returns the canonical wrapper of the object at path. While it is
+      * held, every lookup of the same path returns the same instance, so
+      * per-object state can be kept in it. A new wrapper is made once the
+      * object was removed from BlueZ.
+      * @param path The D-Bus object path
+      * @return The shared wrapper or null if there is no such object
+      */
+    std::shared_ptr<BluetoothObject> get_shared_object(const std::string &path);
+
+    /** Returns the canonical wrapper of the object at path, see
+      * get_shared_object().
+      * @param path The D-Bus object path
+      * @return The shared wrapper or null if there is no object of type T
+      */
+    template<class T>
+    std::shared_ptr<T> get_shared(const std::string &path)
+    {
+        return std::dynamic_pointer_cast<T>(get_shared_object(path));
+    }
+
+    /** Returns the canonical wrappers of the discovered BluetoothDevices,
+      * only making wrappers for the devices which have none.
+      * @return A list of shared BluetoothDevices
+      */
+    std::vector<std::shared_ptr<BluetoothDevice>> get_shared_devices(
+    );
+
+    /** Like find(), but returns the canonical wrapper of the object found,
+      * see get_shared_object().
+      */
+    template<class T>
+    std::shared_ptr<T> find_shared(std::string *name,
+        std::string* identifier, BluetoothObject *parent,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero())
+    {
+        std::unique_ptr<BluetoothObject> obj = find(T::class_type(), name, identifier, parent, timeout);
+        if (obj == nullptr)
+            return std::shared_ptr<T>();
+        return std::dynamic_pointer_cast<T>(get_shared_object(std::move(obj)));
+    }
+
     /** Sets a default adapter to use for discovery.
       * @return TRUE if the device was set
       */
@@ -238,4 +510,22 @@ public:
       */
     bool stop_discovery(
     );
+
+    /** Opens a discovery session on the default adapter, see
+      * BluetoothAdapter::open_discovery_session().
+      * @param[in] filter The devices the session is interested in
+      * @return An id to be passed to close_discovery_session(), 0 if
+      * discovery could not be started
+      */
+    unsigned int open_discovery_session(
+        const BluetoothDiscoveryFilter &filter = BluetoothDiscoveryFilter()
+    );
+
+    /** Closes a discovery session opened on any adapter.
+      * @param[in] id The id returned by open_discovery_session()
+      * @return TRUE if the session existed
+      */
+    bool close_discovery_session(
+        unsigned int id
+    );
 };
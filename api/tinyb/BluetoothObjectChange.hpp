@@ -0,0 +1,56 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include <cstdint>
+#include <string>
+
+namespace tinyb {
+    struct BluetoothObjectChange;
+}
+
+/**
+  * An object added, modified or removed since a given epoch, as returned by
+  * BluetoothManager::changes_since().
+  */
+struct tinyb::BluetoothObjectChange
+{
+    enum class Kind {
+        /** The object appeared after the epoch, possibly changing since */
+        ADDED,
+        /** An interface or property of the object changed after the epoch */
+        MODIFIED,
+        /** The object existed at the epoch and was removed since */
+        REMOVED
+    };
+
+    /** The type of the object, from its first BlueZ interface */
+    BluetoothType type = BluetoothType::NONE;
+    /** The D-Bus object path of the object */
+    std::string path;
+    Kind kind = Kind::MODIFIED;
+    /** The epoch of the last change of the object */
+    uint64_t epoch = 0;
+};
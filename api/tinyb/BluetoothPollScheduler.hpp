@@ -0,0 +1,87 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include "BluetoothGattCharacteristic.hpp"
+#include <chrono>
+#include <memory>
+
+namespace tinyb {
+    class BluetoothPollScheduler;
+}
+
+/**
+  * Periodically reads characteristics which cannot notify. All polls are
+  * driven by a timing wheel on tinyb's event thread and use asynchronous
+  * reads, so no thread is blocked. First reads are spread over the period
+  * of each poll to avoid bursts. Only one read per device is in flight at
+  * a time; a poll whose previous read has not completed yet when it is due
+  * again skips that read and counts it as dropped.
+  */
+class tinyb::BluetoothPollScheduler
+{
+private:
+    struct State;
+    std::shared_ptr<State> state;
+
+    static int tick_callback(void *data);
+    static void read_callback(void *source, void *res, void *data);
+    static void free_state(void *data);
+
+public:
+    /** Creates a scheduler.
+      * @param resolution The tick of the timing wheel, periods are rounded
+      * up to a multiple of it
+      */
+    BluetoothPollScheduler(
+        std::chrono::milliseconds resolution = std::chrono::milliseconds(10));
+    BluetoothPollScheduler(const BluetoothPollScheduler &) = delete;
+    ~BluetoothPollScheduler();
+
+    /** Starts polling a characteristic. cb is called from the event thread
+      * with each value read.
+      * @param characteristic The characteristic to read
+      * @param period The time between reads
+      * @param cb the callback receiving the values
+      * @param data user data passed to the callback
+      * @return An id to be passed to remove()
+      */
+    unsigned int add(BluetoothGattCharacteristic &characteristic,
+        std::chrono::milliseconds period, BluetoothNotificationCallback cb,
+        void *data = nullptr);
+
+    /** Stops a poll. A read in flight completes without calling the
+      * callback.
+      * @param id The id returned by add()
+      * @return TRUE if the poll existed
+      */
+    bool remove(unsigned int id);
+
+    /** Returns the number of reads a poll skipped because of overload.
+      * @param id The id returned by add()
+      * @return The number of skipped reads
+      */
+    uint64_t get_dropped(unsigned int id);
+};
@@ -0,0 +1,77 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tinyb {
+    struct BluetoothPropertyChange;
+}
+
+/**
+  * A change of a D-Bus property of a BlueZ object, as delivered in batches
+  * by BluetoothManager::subscribe_property_changes().
+  */
+struct tinyb::BluetoothPropertyChange
+{
+    enum class Kind {
+        /** The property was invalidated and has no value */
+        INVALIDATED,
+        /** The value is in boolean */
+        BOOLEAN,
+        /** The value is in integer, for all D-Bus integer types */
+        INTEGER,
+        /** The value is in string, for strings and object paths */
+        STRING,
+        /** The value is in bytes */
+        BYTES,
+        /** The value is in strings, for string and object path arrays */
+        STRINGS,
+        /** Any other type, string contains the value in GVariant text
+          * format, e.g. ManufacturerData */
+        OTHER
+    };
+
+    /** The type of the object, from the interface of the property */
+    BluetoothType type = BluetoothType::NONE;
+    /** The D-Bus object path of the object */
+    std::string path;
+    /** The name of the property, e.g. RSSI */
+    std::string property;
+    Kind kind = Kind::INVALIDATED;
+    bool boolean = false;
+    int64_t integer = 0;
+    std::string string;
+    std::vector<unsigned char> bytes;
+    std::vector<std::string> strings;
+};
+
+/** Callback receiving a batch of property changes, in the order in which
+  * they were received.
+  */
+typedef void (*BluetoothPropertyBatchCallback)(
+    const std::vector<tinyb::BluetoothPropertyChange> &changes, void *data);
@@ -0,0 +1,206 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "BluetoothObject.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+namespace tinyb {
+    class BluetoothSampleSink;
+    class BluetoothSampleReader;
+}
+
+/**
+  * Appends timestamped characteristic values to fixed-size, memory-mapped
+  * segment files in a directory. Each segment starts with an index of the
+  * streams, usually characteristic object paths, it contains. Appending is
+  * a copy into the mapped segment; syncing to disk, preparing the next
+  * segment and removing old segments is done by a background thread. If
+  * the next segment is not ready when the current one is full, samples are
+  * dropped and counted rather than creating it on the appending thread.
+  */
+class tinyb::BluetoothSampleSink
+{
+private:
+    struct Segment {
+        int fd;
+        unsigned char *base;
+        size_t size;
+        size_t synced;
+        std::string path;
+    };
+
+    std::string directory;
+    size_t segment_size;
+    std::chrono::milliseconds sync_interval;
+    unsigned int max_segments;
+    unsigned int max_streams;
+    size_t data_offset;
+
+    std::mutex lock;
+    Segment current;
+    Segment spare;
+    std::vector<Segment> retired;
+    std::map<std::string, uint16_t> streams;
+    uint64_t next_sequence;
+    uint64_t dropped;
+    /* Set while the flusher cannot create a spare segment, which it then
+     * retries once per sync interval */
+    bool spare_failed;
+
+    std::thread flusher;
+    std::condition_variable flusher_cv;
+    bool sync_requested;
+    bool stopping;
+
+    bool open_segment(Segment &segment, uint64_t sequence);
+    void close_segment(Segment &segment);
+    bool rotate();
+    void remove_old_segments(const std::string &current_path,
+        const std::string &spare_path);
+    void flush_loop();
+
+public:
+    /** Creates a sink writing to directory, continuing the numbering of the
+      * segments already there.
+      * @param directory An existing directory for the segment files
+      * @param segment_size The size of each segment file in bytes
+      * @param sync_interval Written data is synced to disk in batches at
+      * this interval
+      * @param max_segments Oldest segments are removed when there are more,
+      * zero keeps all of them
+      * @param max_streams The number of streams a segment can hold, at most
+      * 65535. A segment is rotated once it is full, so this should be at
+      * least the number of characteristics stored.
+      */
+    BluetoothSampleSink(const std::string &directory,
+        size_t segment_size = 4 * 1024 * 1024,
+        std::chrono::milliseconds sync_interval = std::chrono::milliseconds(1000),
+        unsigned int max_segments = 0,
+        unsigned int max_streams = 256);
+    BluetoothSampleSink(const BluetoothSampleSink &) = delete;
+    ~BluetoothSampleSink();
+
+    /** Appends a sample.
+      * @param stream The stream of the sample, at most 95 characters
+      * @param data The value
+      * @param size The size of the value, at most 65535 bytes
+      * @param timestamp The time of the sample in microseconds since epoch
+      * @return TRUE if the sample was stored, FALSE if it was invalid or
+      * dropped because the next segment was not ready
+      */
+    bool append(const std::string &stream, const unsigned char *data,
+        size_t size, int64_t timestamp);
+
+    /** Appends a value of a characteristic, timestamped with the current
+      * time and using the object path of the characteristic as stream.
+      * @param characteristic The characteristic the value belongs to
+      * @param value The value
+      * @return TRUE if the sample was stored
+      */
+    bool append(BluetoothGattCharacteristic &characteristic,
+        const std::vector<unsigned char> &value);
+
+    /** Syncs all appended samples to disk before returning.
+      */
+    void sync();
+
+    /** Returns the number of samples dropped because the next segment was
+      * not ready yet.
+      * @return The number of dropped samples
+      */
+    uint64_t get_dropped();
+
+    /** Notification callback storing values in the sink passed as data,
+      * to be used with BluetoothGattCharacteristic::subscribe().
+      */
+    static void notification_callback(BluetoothGattCharacteristic &characteristic,
+        std::shared_ptr<const std::vector<unsigned char>> value, void *data);
+};
+
+/**
+  * Reads a segment written by BluetoothSampleSink. The segment is mapped
+  * and samples point directly into it, they stay valid for the lifetime of
+  * the reader. A segment which is still written can be read, new samples
+  * become visible to next() as they are appended.
+  */
+class tinyb::BluetoothSampleReader
+{
+private:
+    int fd;
+    const unsigned char *base;
+    size_t size;
+    size_t offset;
+    uint32_t max_streams;
+    size_t data_offset;
+
+public:
+    struct Sample {
+        int64_t timestamp;
+        uint16_t stream;
+        const unsigned char *data;
+        size_t size;
+    };
+
+    /** Returns the segment files of a directory, oldest first.
+      * @param directory The directory of a BluetoothSampleSink
+      * @return A list of paths
+      */
+    static std::vector<std::string> list_segments(const std::string &directory);
+
+    BluetoothSampleReader(const std::string &path);
+    BluetoothSampleReader(const BluetoothSampleReader &) = delete;
+    ~BluetoothSampleReader();
+
+    /** Returns the streams stored in this segment, the position in the
+      * list being the stream id of their samples.
+      * @return A list of streams
+      */
+    std::vector<std::string> get_streams() const;
+
+    /** Returns the number of samples of a stream and their time range.
+      * @param stream The stream id
+      * @param first Set to the timestamp of the first sample
+      * @param last Set to the timestamp of the last sample
+      * @return The number of samples
+      */
+    uint32_t get_stream_info(uint16_t stream, int64_t &first, int64_t &last) const;
+
+    /** Reads the next sample.
+      * @param sample Set to the sample, its data points into the segment
+      * @return FALSE if there are no more samples
+      */
+    bool next(Sample &sample);
+
+    /** Restarts reading from the first sample.
+      */
+    void rewind();
+};
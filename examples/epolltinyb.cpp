@@ -0,0 +1,102 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <tinyb.hpp>
+
+#include <vector>
+#include <iostream>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace tinyb;
+
+/** This program shows how to run tinyb without its own event thread, driving
+  * it from an application epoll loop. It starts discovery and prints the
+  * number of known devices every time tinyb dispatched events.
+  */
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    /* Must be selected before the manager is initialized */
+    BluetoothManager::set_event_thread_enabled(false);
+
+    BluetoothManager *manager = nullptr;
+    try {
+        manager = BluetoothManager::get_bluetooth_manager();
+    } catch(const std::runtime_error& e) {
+        std::cerr << "Error while initializing libtinyb: " << e.what() << std::endl;
+        exit(1);
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        std::cerr << "Cannot create epoll instance" << std::endl;
+        exit(1);
+    }
+
+    bool ret = manager->start_discovery();
+    std::cout << "Started = " << (ret ? "true" : "false") << std::endl;
+
+    std::vector<struct pollfd> fds, registered;
+    for (int i = 0; i < 30; ++i) {
+        int timeout = manager->prepare_events(fds);
+
+        /* The descriptors rarely change, only update the epoll set when they do */
+        bool changed = fds.size() != registered.size();
+        for (unsigned j = 0; !changed && j < fds.size(); j++)
+            changed = fds[j].fd != registered[j].fd || fds[j].events != registered[j].events;
+        if (changed) {
+            for (auto &pfd : registered)
+                epoll_ctl(epfd, EPOLL_CTL_DEL, pfd.fd, nullptr);
+            for (unsigned j = 0; j < fds.size(); j++) {
+                struct epoll_event ev;
+                ev.events = fds[j].events;
+                ev.data.u32 = j;
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fds[j].fd, &ev);
+            }
+            registered = fds;
+        }
+
+        /* Other application descriptors would be part of the same set */
+        struct epoll_event events[16];
+        if (timeout < 0 || timeout > 1000)
+            timeout = 1000;
+        int n = epoll_wait(epfd, events, 16, timeout);
+        for (int j = 0; j < n; j++)
+            if (events[j].data.u32 < fds.size())
+                fds[events[j].data.u32].revents = events[j].events;
+
+        manager->dispatch_events(fds);
+
+        std::cout << "Known devices: " << manager->get_devices().size() << std::endl;
+    }
+
+    ret = manager->stop_discovery();
+    std::cout << "Stopped = " << (ret ? "true" : "false") << std::endl;
+
+    close(epfd);
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tinyb_stats.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/* Copy of the counters at one point in time */
+struct Sample {
+    double time;
+    uint64_t counters[(int) StatsCounter::COUNT];
+    uint64_t latency[(int) StatsOperation::COUNT][STATS_LATENCY_BUCKETS];
+    std::vector<uint64_t> notifications;
+};
+
+static std::string find_stats()
+{
+    std::vector<std::string> found;
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *entry;
+
+    if (dir == NULL)
+        return "";
+    while ((entry = readdir(dir)) != NULL)
+        if (strncmp(entry->d_name, "tinyb-stats-", 12) == 0)
+            found.push_back(entry->d_name + 12);
+    closedir(dir);
+
+    if (found.size() != 1) {
+        fprintf(stderr, found.empty() ? "No tinyb process publishes stats\n" :
+            "Several tinyb processes publish stats, pass a name:\n");
+        for (auto &name : found)
+            fprintf(stderr, "  %s\n", name.c_str());
+        return "";
+    }
+    return found[0];
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void take_sample(const StatsHeader *header, const StatsEntry *entries,
+    uint32_t count, Sample &sample)
+{
+    sample.time = now();
+    for (int i = 0; i < (int) StatsCounter::COUNT; i++)
+        sample.counters[i] = header->counters[i].load(std::memory_order_relaxed);
+    for (int i = 0; i < (int) StatsOperation::COUNT; i++)
+        for (int b = 0; b < STATS_LATENCY_BUCKETS; b++)
+            sample.latency[i][b] = header->latency[i][b].load(std::memory_order_relaxed);
+    sample.notifications.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+        sample.notifications[i] = entries[i].notifications.load(std::memory_order_relaxed);
+}
+
+static long rss_kib(uint32_t pid)
+{
+    char path[64], line[256];
+    long rss = -1;
+
+    snprintf(path, sizeof(path), "/proc/%u/status", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+            break;
+    fclose(f);
+    return rss;
+}
+
+/* Upper bound of the bucket holding the given fraction of calls, in ms */
+static double percentile(const uint64_t *buckets, uint64_t total, double fraction)
+{
+    uint64_t seen = 0;
+
+    for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= fraction * total)
+            return ((2ULL << b) - 2) / 1000.0;
+    }
+    return 0;
+}
+
+static void print_latency(const char *name, const Sample &previous,
+    const Sample &current, StatsOperation operation)
+{
+    uint64_t buckets[STATS_LATENCY_BUCKETS];
+    uint64_t total = 0;
+
+    for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+        buckets[b] = current.latency[(int) operation][b] -
+            previous.latency[(int) operation][b];
+        total += buckets[b];
+    }
+
+    if (total == 0) {
+        printf("%-8s %8d %9s %9s %9s\n", name, 0, "-", "-", "-");
+        return;
+    }
+    printf("%-8s %8llu %9.2f %9.2f %9.2f\n", name, (unsigned long long) total,
+        percentile(buckets, total, 0.5), percentile(buckets, total, 0.9),
+        percentile(buckets, total, 0.99));
+}
+
+/** Shows the stats published by a tinyb process with
+ * BluetoothManager::enable_stats(), refreshed in place.
+ * Run as: tinyb-top [name] [interval in ms]
+ * The name defaults to the only process publishing stats.
+ */
+int main(int argc, char **argv)
+{
+    std::string name = argc > 1 ? argv[1] : find_stats();
+    int interval = argc > 2 ? atoi(argv[2]) : 1000;
+    if (name.empty())
+        return 1;
+    if (interval <= 0)
+        interval = 1000;
+
+    std::string path = stats_path(name);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(StatsHeader)) {
+        fprintf(stderr, "Cannot open %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    const StatsHeader *header = static_cast<const StatsHeader *>(map);
+    if (memcmp(header->magic, STATS_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != STATS_VERSION ||
+        header->entries_offset + header->entry_capacity * sizeof(StatsEntry) >
+            (size_t) st.st_size) {
+        fprintf(stderr, "%s does not contain tinyb stats\n", path.c_str());
+        return 1;
+    }
+    const StatsEntry *entries = reinterpret_cast<const StatsEntry *>(
+        static_cast<const unsigned char *>(map) + header->entries_offset);
+
+    Sample previous, current;
+    take_sample(header, entries, 0, previous);
+
+    while (true) {
+        usleep(interval * 1000);
+
+        if (kill(header->pid, 0) != 0 && errno == ESRCH) {
+            printf("Process %u exited\n", header->pid);
+            return 0;
+        }
+
+        uint32_t count = std::min(header->entry_count.load(std::memory_order_acquire),
+            header->entry_capacity);
+        take_sample(header, entries, count, current);
+        previous.notifications.resize(count, 0);
+        /* Entries reused for another object restart from zero */
+        for (uint32_t i = 0; i < count; i++)
+            if (current.notifications[i] < previous.notifications[i])
+                previous.notifications[i] = 0;
+
+        double elapsed = current.time - previous.time;
+        auto counter = [&](StatsCounter c) {
+            return current.counters[(int) c];
+        };
+        auto rate = [&](StatsCounter c) {
+            return (current.counters[(int) c] - previous.counters[(int) c]) / elapsed;
+        };
+
+        struct winsize ws;
+        int rows = 24;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0)
+            rows = ws.ws_row;
+
+        long uptime = time(NULL) - header->started / 1000000;
+        long rss = rss_kib(header->pid);
+
+        /* Home and clear, so that the screen is redrawn in place */
+        printf("\033[H\033[2J");
+        printf("tinyb-top - %s - pid %u - up %ld:%02ld:%02ld - RSS %.1f MiB\n",
+            name.c_str(), header->pid, uptime / 3600, uptime / 60 % 60,
+            uptime % 60, rss / 1024.0);
+        printf("objects %lld (+%.1f/s -%.1f/s)  signals %.1f/s  "
+            "properties %.1f/s  events %.1f/s\n",
+            (long long) (counter(StatsCounter::OBJECTS_ADDED) -
+                counter(StatsCounter::OBJECTS_REMOVED)),
+            rate(StatsCounter::OBJECTS_ADDED), rate(StatsCounter::OBJECTS_REMOVED),
+            rate(StatsCounter::SIGNALS), rate(StatsCounter::PROPERTY_CHANGES),
+            rate(StatsCounter::EVENTS));
+        printf("notifications %.1f/s  gatt calls %.1f/s  errors %.1f/s  "
+            "queued %lld  dropped %.1f/s\n\n",
+            rate(StatsCounter::NOTIFICATIONS), rate(StatsCounter::GATT_CALLS),
+            rate(StatsCounter::GATT_ERRORS),
+            (long long) counter(StatsCounter::QUEUED), rate(StatsCounter::DROPPED));
+
+        printf("%-8s %8s %9s %9s %9s\n", "GATT", "CALLS", "P50 MS", "P90 MS", "P99 MS");
+        print_latency("read", previous, current, StatsOperation::READ);
+        print_latency("write", previous, current, StatsOperation::WRITE);
+        printf("\n");
+
+        /* Connected devices, then characteristics by notification rate */
+        std::vector<uint32_t> connected, characteristics;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t flags = entries[i].flags.load(std::memory_order_acquire);
+            if (!(flags & STATS_FLAG_PRESENT))
+                continue;
+            if (entries[i].type == STATS_ENTRY_DEVICE &&
+                (flags & STATS_FLAG_CONNECTED))
+                connected.push_back(i);
+            else if (entries[i].type == STATS_ENTRY_CHARACTERISTIC)
+                characteristics.push_back(i);
+        }
+        std::sort(characteristics.begin(), characteristics.end(),
+            [&](uint32_t a, uint32_t b) {
+                return current.notifications[a] - previous.notifications[a] >
+                    current.notifications[b] - previous.notifications[b];
+            });
+
+        int left = rows - 11;
+        if (header->entry_used.load(std::memory_order_relaxed) >=
+            header->entry_capacity) {
+            printf("Entry table full (%u), some objects are not shown\n\n",
+                header->entry_capacity);
+            left -= 2;
+        }
+        printf("CONNECTED DEVICE\n");
+        for (size_t i = 0; i < connected.size() && left > 2; i++, left--)
+            printf("%.127s\n", entries[connected[i]].path);
+        printf("\n%-60s %10s %12s\n", "CHARACTERISTIC", "NOTIF/S", "TOTAL");
+        for (size_t i = 0; i < characteristics.size() && left > 1; i++, left--) {
+            uint32_t c = characteristics[i];
+            printf("%-60.127s %10.1f %12llu\n", entries[c].path,
+                (current.notifications[c] - previous.notifications[c]) / elapsed,
+                (unsigned long long) current.notifications[c]);
+        }
+        fflush(stdout);
+
+        previous = current;
+    }
+}
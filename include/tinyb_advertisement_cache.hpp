@@ -0,0 +1,200 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace tinyb {
+
+/* Last advertised payload of each device, keyed by address, in an open
+ * addressing table with linear probing. The table is sized from a memory
+ * budget and kept at most half full; when it holds capacity devices the
+ * least recently seen one is evicted. Not thread safe. */
+class AdvertisementCache {
+public:
+    enum class Result {
+        /** Same payload as the last notified one */
+        REPEAT,
+        /** New device or different payload */
+        CHANGED,
+        /** Same payload, but the heartbeat interval has passed */
+        HEARTBEAT
+    };
+
+private:
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        /* address + 1, 0 for a free slot */
+        uint64_t key;
+        uint64_t hash;
+        int64_t notified;
+        /* Neighbours in the LRU list, as slot indices */
+        uint32_t older;
+        uint32_t newer;
+    };
+
+    std::vector<Entry> slots;
+    size_t mask;
+    size_t count;
+    size_t capacity;
+    uint32_t oldest;
+    uint32_t newest;
+    uint64_t evictions;
+
+    size_t home(uint64_t key) const {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key & mask;
+    }
+
+    void unlink(size_t i) {
+        Entry &e = slots[i];
+        if (e.older != NONE)
+            slots[e.older].newer = e.newer;
+        else
+            oldest = e.newer;
+        if (e.newer != NONE)
+            slots[e.newer].older = e.older;
+        else
+            newest = e.older;
+    }
+
+    void link_newest(size_t i) {
+        slots[i].older = newest;
+        slots[i].newer = NONE;
+        if (newest != NONE)
+            slots[newest].newer = i;
+        else
+            oldest = i;
+        newest = i;
+    }
+
+    /* Moves the entry in slot from to the free slot to */
+    void move(size_t from, size_t to) {
+        Entry &e = slots[to];
+        e = slots[from];
+        if (e.older != NONE)
+            slots[e.older].newer = to;
+        else
+            oldest = to;
+        if (e.newer != NONE)
+            slots[e.newer].older = to;
+        else
+            newest = to;
+    }
+
+    /* Frees slot i, shifting back the entries of the following cluster
+     * which would not be found anymore */
+    void erase(size_t i) {
+        unlink(i);
+        for (size_t j = (i + 1) & mask; slots[j].key != 0; j = (j + 1) & mask) {
+            size_t k = home(slots[j].key);
+            /* Entry j may move to i unless its home is cyclically in (i, j] */
+            bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                move(j, i);
+                i = j;
+            }
+        }
+        slots[i].key = 0;
+        count--;
+    }
+
+public:
+    /* Uses at most memory bytes, for at least 8 devices */
+    AdvertisementCache(size_t memory) : count(0), oldest(NONE), newest(NONE),
+        evictions(0) {
+        size_t size = 16;
+        while (size * 2 * sizeof(Entry) <= memory && size * 2 < NONE)
+            size *= 2;
+        slots.assign(size, Entry());
+        mask = size - 1;
+        capacity = size / 2;
+    }
+
+    /* Records a payload seen for address at time now. A repeated payload
+     * is reported again once heartbeat has passed since it was last
+     * reported, never if heartbeat is 0. */
+    Result update(uint64_t address, uint64_t hash, int64_t now, int64_t heartbeat) {
+        uint64_t key = address + 1;
+        size_t i = home(key);
+
+        for (; slots[i].key != 0; i = (i + 1) & mask) {
+            if (slots[i].key != key)
+                continue;
+
+            Entry &e = slots[i];
+            unlink(i);
+            link_newest(i);
+            if (e.hash != hash) {
+                e.hash = hash;
+                e.notified = now;
+                return Result::CHANGED;
+            }
+            if (heartbeat > 0 && now - e.notified >= heartbeat) {
+                e.notified = now;
+                return Result::HEARTBEAT;
+            }
+            return Result::REPEAT;
+        }
+
+        if (count == capacity) {
+            erase(oldest);
+            evictions++;
+            for (i = home(key); slots[i].key != 0; i = (i + 1) & mask);
+        }
+
+        slots[i].key = key;
+        slots[i].hash = hash;
+        slots[i].notified = now;
+        link_newest(i);
+        count++;
+        return Result::CHANGED;
+    }
+
+    void clear() {
+        slots.assign(slots.size(), Entry());
+        count = 0;
+        oldest = newest = NONE;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t get_capacity() const {
+        return capacity;
+    }
+
+    uint64_t get_evictions() const {
+        return evictions;
+    }
+};
+
+}
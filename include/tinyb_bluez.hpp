@@ -0,0 +1,286 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "tinyb_bluez_types.hpp"
+
+#include <gio/gio.h>
+#include <stdexcept>
+
+/* Typed access to the properties and methods of the BlueZ interfaces. The
+ * tag types of tinyb_bluez_types.hpp are generated from org.bluez.xml at
+ * build time, so adding a property there is enough to use it as
+ *     get_property<bluez::Device1::RSSI>(proxy)
+ * Values are converted directly from the GVariants cached by the proxy,
+ * the conversion being selected at compile time from the C++ type. */
+
+namespace tinyb {
+
+template <typename T> struct VariantTraits;
+
+template <> struct VariantTraits<bool> {
+    static bool get(GVariant *v) { return g_variant_get_boolean(v); }
+    static GVariant *make(bool value, const char *) { return g_variant_new_boolean(value); }
+};
+
+template <> struct VariantTraits<uint8_t> {
+    static uint8_t get(GVariant *v) { return g_variant_get_byte(v); }
+    static GVariant *make(uint8_t value, const char *) { return g_variant_new_byte(value); }
+};
+
+template <> struct VariantTraits<int16_t> {
+    static int16_t get(GVariant *v) { return g_variant_get_int16(v); }
+    static GVariant *make(int16_t value, const char *) { return g_variant_new_int16(value); }
+};
+
+template <> struct VariantTraits<uint16_t> {
+    static uint16_t get(GVariant *v) { return g_variant_get_uint16(v); }
+    static GVariant *make(uint16_t value, const char *) { return g_variant_new_uint16(value); }
+};
+
+template <> struct VariantTraits<int32_t> {
+    static int32_t get(GVariant *v) { return g_variant_get_int32(v); }
+    static GVariant *make(int32_t value, const char *) { return g_variant_new_int32(value); }
+};
+
+template <> struct VariantTraits<uint32_t> {
+    static uint32_t get(GVariant *v) { return g_variant_get_uint32(v); }
+    static GVariant *make(uint32_t value, const char *) { return g_variant_new_uint32(value); }
+};
+
+template <> struct VariantTraits<int64_t> {
+    static int64_t get(GVariant *v) { return g_variant_get_int64(v); }
+    static GVariant *make(int64_t value, const char *) { return g_variant_new_int64(value); }
+};
+
+template <> struct VariantTraits<uint64_t> {
+    static uint64_t get(GVariant *v) { return g_variant_get_uint64(v); }
+    static GVariant *make(uint64_t value, const char *) { return g_variant_new_uint64(value); }
+};
+
+template <> struct VariantTraits<double> {
+    static double get(GVariant *v) { return g_variant_get_double(v); }
+    static GVariant *make(double value, const char *) { return g_variant_new_double(value); }
+};
+
+/* Strings and object paths */
+template <> struct VariantTraits<std::string> {
+    static std::string get(GVariant *v) {
+        return g_variant_get_string(v, NULL);
+    }
+    static GVariant *make(const std::string &value, const char *signature) {
+        if (signature[0] == 'o')
+            return g_variant_new_object_path(value.c_str());
+        return g_variant_new_string(value.c_str());
+    }
+};
+
+/* Arrays of strings and of object paths */
+template <> struct VariantTraits<std::vector<std::string>> {
+    static std::vector<std::string> get(GVariant *v) {
+        std::vector<std::string> result;
+        gsize n = g_variant_n_children(v);
+        result.reserve(n);
+        for (gsize i = 0; i < n; i++) {
+            GVariant *child = g_variant_get_child_value(v, i);
+            result.push_back(g_variant_get_string(child, NULL));
+            g_variant_unref(child);
+        }
+        return result;
+    }
+    static GVariant *make(const std::vector<std::string> &value, const char *signature) {
+        std::vector<const gchar *> strings;
+        for (auto &s : value)
+            strings.push_back(s.c_str());
+        strings.push_back(NULL);
+        if (signature[1] == 'o')
+            return g_variant_new_objv(strings.data(), value.size());
+        return g_variant_new_strv(strings.data(), value.size());
+    }
+};
+
+template <> struct VariantTraits<std::vector<unsigned char>> {
+    static std::vector<unsigned char> get(GVariant *v) {
+        gsize n;
+        const unsigned char *data = static_cast<const unsigned char *>(
+            g_variant_get_fixed_array(v, &n, 1));
+        return std::vector<unsigned char>(data, data + n);
+    }
+    static GVariant *make(const std::vector<unsigned char> &value, const char *) {
+        return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, value.data(),
+            value.size(), 1);
+    }
+};
+
+/** Returns whether the proxy has a cached value for property P
+  */
+template <typename P>
+bool has_property(GDBusProxy *proxy)
+{
+    GVariant *value = g_dbus_proxy_get_cached_property(proxy, P::name());
+    if (value == NULL)
+        return false;
+    g_variant_unref(value);
+    return true;
+}
+
+/** Reads the cached value of property P into value
+  * @return FALSE if there is none or its type does not match the interface
+  * description, value is unchanged then
+  */
+template <typename P>
+bool read_property(GDBusProxy *proxy, typename P::type &value)
+{
+    GVariant *cached = g_dbus_proxy_get_cached_property(proxy, P::name());
+    if (cached == NULL)
+        return false;
+
+    bool valid = g_variant_is_of_type(cached, G_VARIANT_TYPE(P::signature()));
+    if (valid)
+        value = VariantTraits<typename P::type>::get(cached);
+    g_variant_unref(cached);
+    return valid;
+}
+
+/** Returns the cached value of property P, throws std::runtime_error if
+  * there is none or its type does not match the interface description
+  */
+template <typename P>
+typename P::type get_property(GDBusProxy *proxy)
+{
+    GVariant *value = g_dbus_proxy_get_cached_property(proxy, P::name());
+    if (value == NULL)
+        throw std::runtime_error(std::string("Property ") + P::name() +
+            " is not available");
+
+    if (!g_variant_is_of_type(value, G_VARIANT_TYPE(P::signature()))) {
+        g_variant_unref(value);
+        throw std::runtime_error(std::string("Property ") + P::name() +
+            " has an unexpected type");
+    }
+
+    typename P::type result = VariantTraits<typename P::type>::get(value);
+    g_variant_unref(value);
+    return result;
+}
+
+/** Sets property P, printing the error if it fails
+  * @return TRUE if the property was set
+  */
+template <typename P>
+bool set_property(GDBusProxy *proxy, const typename P::type &value)
+{
+    static_assert(P::writable(), "Property is read-only");
+
+    GError *error = NULL;
+    GVariant *result = g_dbus_proxy_call_sync(proxy,
+        "org.freedesktop.DBus.Properties.Set",
+        g_variant_new("(ssv)", P::interface(), P::name(),
+            VariantTraits<typename P::type>::make(value, P::signature())),
+        G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        return false;
+    }
+    g_variant_unref(result);
+    return true;
+}
+
+template <typename M>
+void add_arguments(GVariantBuilder *, unsigned int)
+{
+}
+
+template <typename M, typename A, typename... Args>
+void add_arguments(GVariantBuilder *builder, unsigned int i, const A &arg,
+    const Args &... args)
+{
+    g_variant_builder_add_value(builder,
+        VariantTraits<A>::make(arg, M::in_signature(i)));
+    add_arguments<M>(builder, i + 1, args...);
+}
+
+template <typename M, typename... Args>
+GVariant *call_method_sync(GDBusProxy *proxy, const Args &... args)
+{
+    static_assert(sizeof...(Args) == M::in_count, "Wrong number of arguments");
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
+    add_arguments<M>(&builder, 0, args...);
+
+    GError *error = NULL;
+    GVariant *result = g_dbus_proxy_call_sync(proxy, M::name(),
+        g_variant_builder_end(&builder), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        &error);
+
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    if (!g_variant_is_of_type(result, G_VARIANT_TYPE(M::out_signature()))) {
+        g_printerr("Error: %s returned an unexpected type\n", M::name());
+        g_variant_unref(result);
+        return NULL;
+    }
+    return result;
+}
+
+/** Calls method M with arguments args, of the C++ types of its in
+  * arguments, printing the error if it fails
+  * @return TRUE if the call succeeded
+  */
+template <typename M, typename... Args>
+bool call_method(GDBusProxy *proxy, const Args &... args)
+{
+    GVariant *result = call_method_sync<M>(proxy, args...);
+    if (result == NULL)
+        return false;
+    g_variant_unref(result);
+    return true;
+}
+
+/** Calls method M, which has an out argument, storing it in value
+  * @return TRUE if the call succeeded, value is unchanged otherwise
+  */
+template <typename M, typename... Args>
+bool call_method(GDBusProxy *proxy, typename M::out_type &value,
+    const Args &... args)
+{
+    GVariant *result = call_method_sync<M>(proxy, args...);
+    if (result == NULL)
+        return false;
+
+    GVariant *child = g_variant_get_child_value(result, 0);
+    value = VariantTraits<typename M::out_type>::get(child);
+    g_variant_unref(child);
+    g_variant_unref(result);
+    return true;
+}
+
+};
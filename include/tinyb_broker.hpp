@@ -0,0 +1,117 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/* Layout of the shared memory published by BluetoothBroker and mapped
+ * read-only by BluetoothBrokerClient. All integers are in host order, the
+ * memory is only shared between processes of the same machine. */
+
+#define BROKER_MAGIC "TINYBSHM"
+#define BROKER_VERSION 1
+
+/* The memory is /dev/shm/tinyb-<name>, the control socket sits next to it */
+static inline std::string broker_memory_path(const std::string &name)
+{
+    return "/dev/shm/tinyb-" + name;
+}
+
+static inline std::string broker_socket_path(const std::string &name)
+{
+    return "/dev/shm/tinyb-" + name + ".sock";
+}
+
+struct BrokerHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t device_capacity;
+    uint64_t devices_offset;
+    uint64_t ring_offset;
+    /* A power of two */
+    uint64_t ring_size;
+    /* Slots below this are in use or free, see BrokerDevice */
+    std::atomic<uint32_t> device_count;
+    /* Futex incremented after each record written to the ring */
+    std::atomic<uint32_t> ring_wake;
+    /* Bytes written to the ring since it was created */
+    std::atomic<uint64_t> ring_head;
+    /* Bytes the broker started writing, ahead of ring_head while a record
+     * is being written. Readers check it after copying a record to detect
+     * that it was overwritten meanwhile. */
+    std::atomic<uint64_t> ring_reserved;
+};
+
+#define BROKER_DEVICE_PRESENT 1
+#define BROKER_DEVICE_CONNECTED 2
+#define BROKER_DEVICE_PAIRED 4
+#define BROKER_DEVICE_TRUSTED 8
+
+/* Device table entry. The sequence is odd while the broker updates the
+ * entry; readers copy it and retry if the sequence was odd or changed. */
+struct BrokerDevice {
+    std::atomic<uint32_t> sequence;
+    uint32_t flags;
+    int16_t rssi;
+    uint16_t reserved;
+    uint32_t reserved2;
+    /* Monotonic time of the last update in microseconds */
+    int64_t updated;
+    char path[128];
+    char address[24];
+    char name[64];
+};
+
+enum class BrokerRecordType : uint16_t {
+    /* Fills the end of the ring, to be skipped */
+    PADDING = 0,
+    ADVERTISEMENT = 1,
+    NOTIFICATION = 2,
+    DEVICE_CHANGED = 3,
+    DEVICE_REMOVED = 4,
+};
+
+/* Ring record, followed by path_size bytes of object path and data_size
+ * bytes of data, padded to 8 bytes. Records never wrap around the end of
+ * the ring; if fewer than sizeof(BrokerRecord) bytes are left there, they
+ * are skipped without a PADDING record. */
+struct BrokerRecord {
+    uint32_t size;
+    BrokerRecordType type;
+    uint16_t path_size;
+    uint32_t data_size;
+    int16_t rssi;
+    uint16_t reserved;
+    /* Monotonic time in microseconds */
+    int64_t timestamp;
+};
+
+static inline size_t broker_align8(size_t n)
+{
+    return (n + 7) & ~(size_t) 7;
+}
@@ -0,0 +1,238 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "BluetoothDeliveryPolicy.hpp"
+#include "tinyb_stats.hpp"
+
+#include <deque>
+#include <queue>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+namespace tinyb {
+
+/* Work item of the DeliveryWorker, run() delivers one value */
+class DeliveryTask {
+public:
+    virtual ~DeliveryTask() {}
+    virtual void run() = 0;
+};
+
+/* A small pool of threads shared by all queues. Tasks which are due are
+ * kept in a ready list, the others in a heap ordered by their due time. */
+class DeliveryWorker {
+private:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    struct Timer {
+        TimePoint due;
+        uint64_t order;
+        std::weak_ptr<DeliveryTask> task;
+    };
+
+    struct TimerLater {
+        bool operator()(const Timer &a, const Timer &b) const {
+            return a.due > b.due || (a.due == b.due && a.order > b.order);
+        }
+    };
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<std::weak_ptr<DeliveryTask>> ready;
+    std::priority_queue<Timer, std::vector<Timer>, TimerLater> timers;
+    uint64_t last_order;
+    unsigned int threads;
+
+    DeliveryWorker() : last_order(0), threads(0) {}
+    void loop();
+
+public:
+    static DeliveryWorker &get();
+
+    /* Runs task once a thread is free, not before due */
+    void schedule(std::shared_ptr<DeliveryTask> task, TimePoint due);
+};
+
+/* Hands values to a subscriber according to a BluetoothDeliveryPolicy.
+ * offer() is called from the event thread and never blocks on the
+ * subscriber; except for DIRECT, deliveries run on the DeliveryWorker, one
+ * at a time and in order for each queue. */
+template <typename T>
+class DeliveryQueue {
+private:
+    /* Shared with the worker, which may still hold it while the queue is
+     * stopped from within a delivery */
+    struct State : public DeliveryTask,
+        public std::enable_shared_from_this<State> {
+        BluetoothDeliveryPolicy policy;
+        std::function<void(T &)> deliver;
+        std::chrono::steady_clock::duration period;
+        std::mutex lock;
+        /* Held during DIRECT deliveries, so that stop() can wait for them;
+         * recursive as a delivery may stop its own queue */
+        std::recursive_mutex direct_lock;
+        std::condition_variable cv;
+        std::deque<T> pending;
+        /* The last values of pending which are counted in the QUEUED
+         * gauge, values offered before stats were enabled are not */
+        size_t counted;
+        /* SAMPLE deliveries are not started before this */
+        std::chrono::steady_clock::time_point due;
+        uint64_t dropped;
+        /* Queued on the worker or running */
+        bool scheduled;
+        bool running;
+        std::thread::id runner;
+        bool stopping;
+
+        State(const BluetoothDeliveryPolicy &policy,
+            std::function<void(T &)> deliver) :
+            policy(policy), deliver(deliver),
+            period(std::chrono::steady_clock::duration::zero()),
+            counted(0), due(std::chrono::steady_clock::now()), dropped(0),
+            scheduled(false), running(false), stopping(false) {
+            if (policy.get_mode() == BluetoothDeliveryPolicy::Mode::SAMPLE &&
+                policy.get_rate() > 0)
+                period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(1.0 / policy.get_rate()));
+        }
+
+        /* Must be called with lock held before the front value is removed */
+        void uncount_front() {
+            if (counted == pending.size()) {
+                counted--;
+                stats_add(StatsCounter::QUEUED, -1);
+            }
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lk(lock);
+            if (stopping || pending.empty()) {
+                scheduled = false;
+                return;
+            }
+
+            uncount_front();
+            T value = std::move(pending.front());
+            pending.pop_front();
+            running = true;
+            runner = std::this_thread::get_id();
+            lk.unlock();
+
+            deliver(value);
+
+            lk.lock();
+            running = false;
+            cv.notify_all();
+            due = std::chrono::steady_clock::now() + period;
+            if (stopping || pending.empty()) {
+                scheduled = false;
+                return;
+            }
+            auto next = due;
+            lk.unlock();
+
+            DeliveryWorker::get().schedule(this->shared_from_this(), next);
+        }
+    };
+
+    std::shared_ptr<State> state;
+
+public:
+    DeliveryQueue(const BluetoothDeliveryPolicy &policy,
+        std::function<void(T &)> deliver) :
+        state(std::make_shared<State>(policy, deliver)) {}
+
+    DeliveryQueue(const DeliveryQueue &) = delete;
+
+    ~DeliveryQueue() {
+        stop();
+    }
+
+    void offer(T value) {
+        if (state->policy.get_mode() == BluetoothDeliveryPolicy::Mode::DIRECT) {
+            std::lock_guard<std::recursive_mutex> lk(state->direct_lock);
+            if (!state->stopping)
+                state->deliver(value);
+            return;
+        }
+
+        std::chrono::steady_clock::time_point due;
+        {
+            std::lock_guard<std::mutex> lk(state->lock);
+            if (state->stopping)
+                return;
+            if (state->pending.size() >= state->policy.get_queue_size()) {
+                state->uncount_front();
+                state->pending.pop_front();
+                state->dropped++;
+                stats_add(StatsCounter::DROPPED);
+            }
+            state->pending.push_back(std::move(value));
+            if (stats_header != NULL) {
+                state->counted++;
+                stats_add(StatsCounter::QUEUED);
+            }
+
+            /* Values arriving until it runs replace the pending one */
+            if (state->scheduled)
+                return;
+            state->scheduled = true;
+            due = state->due;
+        }
+
+        DeliveryWorker::get().schedule(state, due);
+    }
+
+    /* Number of values which were dropped or replaced */
+    uint64_t get_dropped() {
+        std::lock_guard<std::mutex> lk(state->lock);
+        return state->dropped;
+    }
+
+    /* No delivery is running or will start once this returns, unless it is
+     * called from a delivery itself */
+    void stop() {
+        std::lock_guard<std::recursive_mutex> direct(state->direct_lock);
+        std::unique_lock<std::mutex> lk(state->lock);
+
+        stats_add(StatsCounter::QUEUED, -(int64_t) state->counted);
+        state->counted = 0;
+        state->stopping = true;
+        state->pending.clear();
+
+        while (state->running && state->runner != std::this_thread::get_id())
+            state->cv.wait(lk);
+    }
+};
+
+};
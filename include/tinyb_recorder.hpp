@@ -0,0 +1,57 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+/* Recording and replay of the D-Bus traffic between tinyb and BlueZ.
+ *
+ * A log starts with the 8 byte magic "TINYBREC" followed by records:
+ *   guint64 timestamp of the monotonic clock, in microseconds
+ *   guint8  direction, TINYB_RECORD_INCOMING or TINYB_RECORD_OUTGOING
+ *   guint32 size of the message
+ *   the message in D-Bus wire format
+ * Integers are stored in host byte order. Recording appends to existing
+ * logs.
+ */
+
+#define TINYB_RECORD_MAGIC "TINYBREC"
+#define TINYB_RECORD_INCOMING 0
+#define TINYB_RECORD_OUTGOING 1
+
+namespace tinyb {
+    /* Starts logging all messages of connection, name being the owner of
+     * the objects whose state is recorded first, NULL for peer connections */
+    bool recorder_start(GDBusConnection *connection, const gchar *name,
+        const gchar *path, GError **error);
+    void recorder_stop();
+
+    /* Returns a connection served from the log at path. Calls are answered
+     * with the recorded replies and signals are emitted once the initial
+     * state was requested, with their original timing if realtime is set */
+    GDBusConnection *replayer_new_connection(const gchar *path, bool realtime,
+        GError **error);
+    bool replayer_finished();
+};
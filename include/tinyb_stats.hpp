@@ -0,0 +1,148 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/* Counters of a tinyb process, published in shared memory by
+ * BluetoothManager::enable_stats() for tools like tinyb-top, which map it
+ * read-only. Recording is a relaxed atomic operation on the mapping, or a
+ * single test when stats are disabled. */
+
+#define STATS_MAGIC "TINYBSTA"
+#define STATS_VERSION 2
+#define STATS_LATENCY_BUCKETS 32
+#define STATS_ENTRIES 1024
+
+static inline std::string stats_path(const std::string &name)
+{
+    return "/dev/shm/tinyb-stats-" + name;
+}
+
+enum class StatsCounter {
+    /* Property change signals received */
+    SIGNALS,
+    /* Properties changed by these signals */
+    PROPERTY_CHANGES,
+    OBJECTS_ADDED,
+    OBJECTS_REMOVED,
+    /* Events handled by BluetoothManager */
+    EVENTS,
+    NOTIFICATIONS,
+    GATT_CALLS,
+    GATT_ERRORS,
+    /* Values waiting in delivery queues, a gauge */
+    QUEUED,
+    /* Values dropped by delivery queues */
+    DROPPED,
+    COUNT
+};
+
+enum class StatsOperation {
+    READ,
+    WRITE,
+    COUNT
+};
+
+#define STATS_ENTRY_DEVICE 1
+#define STATS_ENTRY_CHARACTERISTIC 2
+
+#define STATS_FLAG_CONNECTED 1
+/* The entry is in use, type and path are set before the flag */
+#define STATS_FLAG_PRESENT 2
+
+/* A device or characteristic. The entries of removed objects are reused,
+ * so readers skip entries without STATS_FLAG_PRESENT and expect the
+ * notifications of an entry to restart from zero. */
+struct StatsEntry {
+    uint32_t type;
+    std::atomic<uint32_t> flags;
+    std::atomic<uint64_t> notifications;
+    char path[128];
+};
+
+struct StatsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    /* Real time of enable_stats() in microseconds */
+    int64_t started;
+    std::atomic<uint64_t> counters[(int) StatsCounter::COUNT];
+    /* Bucket b counts calls which took from 2^b - 1 to 2^(b+1) - 2
+     * microseconds, the last one all longer calls */
+    std::atomic<uint64_t> latency[(int) StatsOperation::COUNT][STATS_LATENCY_BUCKETS];
+    /* Entries ever used, including free ones */
+    std::atomic<uint32_t> entry_count;
+    /* Entries in use */
+    std::atomic<uint32_t> entry_used;
+    uint32_t entry_capacity;
+    uint64_t entries_offset;
+};
+
+/* The mapped stats, NULL while disabled */
+extern StatsHeader *stats_header;
+
+bool stats_enable(const std::string &name);
+
+static inline void stats_add(StatsCounter counter, int64_t n = 1)
+{
+    if (stats_header != NULL)
+        stats_header->counters[(int) counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+static inline void stats_latency(StatsOperation operation, int64_t usec, bool error)
+{
+    if (stats_header == NULL)
+        return;
+
+    unsigned int bucket = 0;
+    for (uint64_t n = usec + 1; n > 1 && bucket < STATS_LATENCY_BUCKETS - 1; n >>= 1)
+        bucket++;
+    stats_header->latency[(int) operation][bucket].fetch_add(1,
+        std::memory_order_relaxed);
+    stats_add(StatsCounter::GATT_CALLS);
+    if (error)
+        stats_add(StatsCounter::GATT_ERRORS);
+}
+
+/* Returns the entry of the characteristic at path, NULL while stats are
+ * disabled or while the table is full. The entry is reused once the
+ * characteristic is removed, so callers on the event thread may keep it
+ * until then, others must not. */
+StatsEntry *stats_characteristic(const char *path);
+
+static inline void stats_notification(StatsEntry *entry)
+{
+    if (stats_header == NULL)
+        return;
+
+    stats_add(StatsCounter::NOTIFICATIONS);
+    if (entry != NULL)
+        entry->notifications.fetch_add(1, std::memory_order_relaxed);
+}
+
+void stats_device(const char *path, bool connected);
@@ -0,0 +1,169 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <iterator>
+#include <vector>
+#include <unordered_map>
+
+namespace tinyb {
+
+/* Hierarchical timing wheel with LEVELS levels of SLOTS slots. Times are
+ * in ticks, the unit being chosen by the user. A timer is stored in the
+ * lowest level whose block of slots also contains the current tick and is
+ * moved down when that block is reached, so scheduling, canceling and
+ * advancing by one tick are O(1). Not thread safe. */
+template <typename T>
+class TimingWheel {
+public:
+    static const unsigned int LEVEL_BITS = 6;
+    static const unsigned int SLOTS = 1 << LEVEL_BITS;
+    static const unsigned int LEVELS = 4;
+
+private:
+    struct Timer {
+        uint64_t id;
+        uint64_t expiry;
+        T payload;
+    };
+
+    typedef std::list<Timer> Slot;
+
+    struct Position {
+        Slot *slot;
+        typename Slot::iterator timer;
+    };
+
+    Slot slots[LEVELS][SLOTS];
+    /* Timers beyond the range of the top level */
+    Slot overflow;
+    std::unordered_map<uint64_t, Position> index;
+    uint64_t current;
+    uint64_t last_id;
+
+    void insert(Timer &&timer) {
+        Slot *slot = &overflow;
+
+        for (unsigned int level = 0; level < LEVELS; level++) {
+            unsigned int shift = LEVEL_BITS * (level + 1);
+            if ((timer.expiry >> shift) == (current >> shift)) {
+                slot = &slots[level][(timer.expiry >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+                break;
+            }
+        }
+
+        uint64_t id = timer.id;
+        slot->push_back(std::move(timer));
+        index[id] = Position{slot, std::prev(slot->end())};
+    }
+
+    void reinsert(Slot &slot) {
+        Slot timers;
+        timers.swap(slot);
+        for (auto &timer : timers)
+            insert(std::move(timer));
+    }
+
+public:
+    TimingWheel(uint64_t start = 0) : current(start), last_id(0) {}
+
+    uint64_t get_current() const {
+        return current;
+    }
+
+    bool empty() const {
+        return index.empty();
+    }
+
+    size_t size() const {
+        return index.size();
+    }
+
+    /* Moves an empty wheel to tick, to be called before scheduling on a
+     * wheel which was not advanced while it was empty */
+    void reset(uint64_t tick) {
+        if (index.empty() && tick > current)
+            current = tick;
+    }
+
+    /* Schedules payload at tick expiry, at the next tick if it already
+     * passed. Returns an id for cancel(), never 0. */
+    uint64_t schedule(uint64_t expiry, T payload) {
+        if (expiry <= current)
+            expiry = current + 1;
+
+        uint64_t id = ++last_id;
+        insert(Timer{id, expiry, std::move(payload)});
+        return id;
+    }
+
+    bool cancel(uint64_t id) {
+        auto it = index.find(id);
+        if (it == index.end())
+            return false;
+
+        it->second.slot->erase(it->second.timer);
+        index.erase(it);
+        return true;
+    }
+
+    /* Advances to tick, appending the payloads of expired timers to
+     * expired in expiry order. Ticks without timers left are skipped. */
+    void advance(uint64_t tick, std::vector<T> &expired) {
+        while (current < tick) {
+            if (index.empty()) {
+                current = tick;
+                break;
+            }
+
+            current++;
+
+            /* Higher levels first, so their timers can still be moved into
+             * the lower level slots reached at this tick */
+            unsigned int top = 0;
+            while (top + 1 < LEVELS &&
+                (current & ((uint64_t(1) << (LEVEL_BITS * (top + 1))) - 1)) == 0)
+                top++;
+
+            if (top + 1 == LEVELS &&
+                (current & ((uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1)) == 0)
+                reinsert(overflow);
+            for (unsigned int level = top; level > 0; level--)
+                reinsert(slots[level][(current >> (LEVEL_BITS * level)) & (SLOTS - 1)]);
+
+            Slot &slot = slots[0][current & (SLOTS - 1)];
+            for (auto &timer : slot) {
+                index.erase(timer.id);
+                expired.push_back(std::move(timer.payload));
+            }
+            slot.clear();
+        }
+    }
+};
+
+};
@@ -34,4 +34,32 @@ extern GDBusObjectManager *gdbus_manager;
 namespace tinyb {
     std::vector<unsigned char> from_gbytes_to_vector(const GBytes *bytes);
     GBytes *from_vector_to_gbytes(const std::vector<unsigned char>& array);
+    bool is_same_object(BluetoothObject *object, BluetoothType type, const gchar *path);
+
+    /* Runs fn on the thread dispatching tinyb's events and waits for it.
+     * The proxy caches are only updated there, so fn sees the properties
+     * of all objects as they were after the same D-Bus message. */
+    void run_on_event_thread(void (*fn)(void *), void *data);
+
+    /* Fills snapshots[i] from proxies[i] with fill, all in one pass on the
+     * event thread */
+    template <typename Proxy, typename Snapshot>
+    void take_snapshots(const std::vector<Proxy *> &proxies,
+        std::vector<Snapshot> &snapshots, void (*fill)(Proxy *, Snapshot &))
+    {
+        struct Batch {
+            const std::vector<Proxy *> *proxies;
+            std::vector<Snapshot> *snapshots;
+            void (*fill)(Proxy *, Snapshot &);
+        } batch = { &proxies, &snapshots, fill };
+
+        snapshots.resize(proxies.size());
+        run_on_event_thread([](void *data) {
+            Batch *batch = static_cast<Batch *>(data);
+            for (size_t i = 0; i < batch->proxies->size(); i++) {
+                (*batch->snapshots)[i] = Snapshot();
+                batch->fill((*batch->proxies)[i], (*batch->snapshots)[i]);
+            }
+        }, &batch);
+    }
 };
@@ -0,0 +1,61 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include <string>
+#include <vector>
+
+/* Selective watch mode, where tinyb only receives the traffic of the
+ * objects under a set of watched paths, of the adapters and, on request,
+ * the objects added anywhere (the discovery feed).
+ *
+ * The object manager client would add a match rule for every signal of
+ * BlueZ and fetch every object. On a private connection, a filter rewrites
+ * that rule into one for the properties of the adapters and adds narrow
+ * rules for each watched path, so unrelated signals are not even sent by
+ * the bus. The filter also drops the unwatched objects from the replies of
+ * GetManagedObjects, and any unwatched signal which still arrives.
+ */
+
+namespace tinyb {
+    /* Sets the paths whose objects are watched, the mode is enabled if it
+     * is not empty. Must be called before watch_start(). */
+    void watch_set_paths(const std::vector<std::string> &paths);
+    bool watch_enabled();
+
+    /* Returns a connection to the system bus which is not shared with the
+     * rest of the process, so no other match rule applies to it */
+    GDBusConnection *watch_new_connection(GError **error);
+
+    /* Filters connection, name being the owner of the objects, NULL for
+     * peer connections which have no match rules */
+    bool watch_start(GDBusConnection *connection, const gchar *name,
+        GError **error);
+
+    /* Adds or removes the match rule for the objects added anywhere */
+    bool watch_set_discovery(bool enabled, GError **error);
+};
@@ -0,0 +1,137 @@
+/*
+ * Author: Andrei Vasiliu <andrei.vasiliu@intel.com>
+ * Copyright (c) 2016 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+package tinyb;
+
+/**
+  * State of all known devices at one point in time, stored as parallel
+  * arrays indexed by device. It is filled by a single native call, see
+  * BluetoothManager.getDeviceSnapshot().
+  */
+public class BluetoothDeviceSnapshot
+{
+    /** Flag bits, see getFlags() */
+    public static final byte CONNECTED = 1;
+    public static final byte PAIRED = 2;
+    public static final byte TRUSTED = 4;
+    public static final byte BLOCKED = 8;
+
+    private final long[] addresses;
+    private final short[] rssi;
+    private final byte[] flags;
+    private final String[] names;
+
+    private BluetoothDeviceSnapshot(long[] addresses, short[] rssi, byte[] flags,
+        String[] names) {
+        this.addresses = addresses;
+        this.rssi = rssi;
+        this.flags = flags;
+        this.names = names;
+    }
+
+    /** Returns the number of devices in this snapshot.
+      * @return The number of devices.
+      */
+    public int size() {
+        return addresses.length;
+    }
+
+    /** Returns the addresses of all devices, the 48 bits of each address
+      * being stored in the low bits, most significant byte first.
+      * @return The addresses, the array is not copied.
+      */
+    public long[] getAddresses() {
+        return addresses;
+    }
+
+    /** Returns the RSSI of all devices, 0 if unknown.
+      * @return The RSSI values, the array is not copied.
+      */
+    public short[] getRSSI() {
+        return rssi;
+    }
+
+    /** Returns the flags of all devices, combinations of CONNECTED,
+      * PAIRED, TRUSTED and BLOCKED.
+      * @return The flags, the array is not copied.
+      */
+    public byte[] getFlags() {
+        return flags;
+    }
+
+    /** Returns the names of all devices, or their alias if they have none.
+      * @return The names, the array is not copied.
+      */
+    public String[] getNames() {
+        return names;
+    }
+
+    public long getAddress(int index) {
+        return addresses[index];
+    }
+
+    /** Returns the address of a device in the usual string form, like
+      * BluetoothDevice.getAddress().
+      */
+    public String getAddressString(int index) {
+        return addressToString(addresses[index]);
+    }
+
+    public short getRSSI(int index) {
+        return rssi[index];
+    }
+
+    public String getName(int index) {
+        return names[index];
+    }
+
+    public boolean isConnected(int index) {
+        return (flags[index] & CONNECTED) != 0;
+    }
+
+    public boolean isPaired(int index) {
+        return (flags[index] & PAIRED) != 0;
+    }
+
+    public boolean isTrusted(int index) {
+        return (flags[index] & TRUSTED) != 0;
+    }
+
+    public boolean isBlocked(int index) {
+        return (flags[index] & BLOCKED) != 0;
+    }
+
+    /** Converts an address from getAddresses() to the form
+      * XX:XX:XX:XX:XX:XX.
+      */
+    public static String addressToString(long address) {
+        StringBuilder result = new StringBuilder(17);
+        for (int shift = 40; shift >= 0; shift -= 8) {
+            if (shift != 40)
+                result.append(':');
+            result.append(String.format("%02X", (address >> shift) & 0xff));
+        }
+        return result.toString();
+    }
+}
@@ -25,10 +25,28 @@
 package tinyb;
 
 import java.util.*;
+import java.lang.ref.Cleaner;
 
-public class BluetoothEvent
+public class BluetoothEvent implements AutoCloseable
 {
     private long nativeInstance;
+    private final Cleaner.Cleanable cleanable;
+
+    /* Releases the native event without referencing the Java object. */
+    private static class Deallocator implements Runnable
+    {
+        private final long instance;
+
+        Deallocator(long instance)
+        {
+            this.instance = instance;
+        }
+
+        public void run()
+        {
+            deleteInstance(instance);
+        }
+    }
 
     public native BluetoothType getType();
     public native String getName();
@@ -38,16 +56,22 @@ public class BluetoothEvent
 
     private native void init(BluetoothType type, String name, String identifier,
                             BluetoothObject parent, BluetoothCallback cb, Object data);
-    private native void delete();
+    private static native void deleteInstance(long instance);
 
     public BluetoothEvent(BluetoothType type, String name, String identifier,
                             BluetoothObject parent, BluetoothCallback cb, Object data)
     {
         init(type, name, identifier, parent, cb, data);
+        cleanable = BluetoothObject.cleaner.register(this, new Deallocator(nativeInstance));
     }
 
-    protected void finalize()
+    /** Releases the native event. It is released anyway once this object
+      * becomes unreachable, calling close() frees it without waiting for
+      * the garbage collector. Calling close() more than once has no effect.
+      */
+    public void close()
     {
-        delete();
+        nativeInstance = 0;
+        cleanable.clean();
     }
 }
@@ -180,6 +180,13 @@ public class BluetoothManager
       */
     public native List<BluetoothDevice> getDevices();
 
+    /** Returns the address, name, RSSI and flags of all discovered devices
+      * in parallel arrays, using a single native call instead of one call
+      * per device and property.
+      * @return A snapshot of the discovered devices
+      */
+    public native BluetoothDeviceSnapshot getDeviceSnapshot();
+
     /** Returns a list of available BluetoothGattServices
       * @return A list of available BluetoothGattServices
       */
@@ -25,11 +25,32 @@
 package tinyb;
 
 import java.util.*;
+import java.lang.ref.Cleaner;
 
-public class BluetoothObject implements Cloneable
+public class BluetoothObject implements Cloneable, AutoCloseable
 {
     protected long nativeInstance;
 
+    static final Cleaner cleaner = Cleaner.create();
+    private final Cleaner.Cleanable cleanable;
+
+    /* Releases the native object, it must not reference the Java object
+     * or the latter would never become unreachable. */
+    private static class Deallocator implements Runnable
+    {
+        private final long instance;
+
+        Deallocator(long instance)
+        {
+            this.instance = instance;
+        }
+
+        public void run()
+        {
+            deleteInstance(instance);
+        }
+    }
+
     static {
         try {
             System.loadLibrary("javatinyb");
@@ -51,17 +72,35 @@ public class BluetoothObject implements Cloneable
       */
     public native BluetoothObject clone();
 
-    private native void delete();
+    private static native void deleteInstance(long instance);
     private native boolean operatorEqual(BluetoothObject obj);
 
     protected BluetoothObject(long instance)
     {
         nativeInstance = instance;
+        cleanable = cleaner.register(this, new Deallocator(instance));
+    }
+
+    /** Releases the native object. It is released anyway once this object
+      * becomes unreachable, calling close() frees it without waiting for
+      * the garbage collector. Calling close() more than once has no effect,
+      * other methods throw after it.
+      */
+    public void close()
+    {
+        nativeInstance = 0;
+        cleanable.clean();
     }
 
-    protected void finalize()
+    /** Closes all objects of a collection, for example the list returned
+      * by BluetoothManager.getDevices(). Null elements are skipped.
+      * @param objects The objects to close
+      */
+    public static void closeAll(Iterable<? extends BluetoothObject> objects)
     {
-        delete();
+        for (BluetoothObject object : objects)
+            if (object != null)
+                object.close();
     }
 
     public boolean equals(Object obj)
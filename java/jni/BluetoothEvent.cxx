@@ -78,9 +78,10 @@ void Java_tinyb_BluetoothEvent_init(JNIEnv *env, jobject obj, jobject type, jstr
     (void)arg_data;
 }
 
-void Java_tinyb_BluetoothEvent_delete(JNIEnv *env, jobject obj)
+void Java_tinyb_BluetoothEvent_deleteInstance(JNIEnv *env, jclass clazz, jlong instance)
 {
     (void)env;
-    (void)obj;
+    (void)clazz;
+    (void)instance;
 }
 
@@ -27,6 +27,9 @@
 #include "tinyb/BluetoothGattService.hpp"
 #include "tinyb/BluetoothManager.hpp"
 
+#include <algorithm>
+#include <cstdio>
+
 #include "tinyb_BluetoothManager.h"
 
 #include "helper.hpp"
@@ -271,6 +274,86 @@ jobject Java_tinyb_BluetoothManager_getDevices(JNIEnv *env, jobject obj)
     return nullptr;
 }
 
+static jlong address_to_long(const std::string &address)
+{
+    jlong result = 0;
+    unsigned int byte;
+    size_t pos = 0;
+
+    for (int i = 0; i < 6; i++, pos += 3) {
+        if (sscanf(address.c_str() + std::min(pos, address.size()), "%2x", &byte) != 1)
+            return 0;
+        result = (result << 8) | byte;
+    }
+    return result;
+}
+
+jobject Java_tinyb_BluetoothManager_getDeviceSnapshot(JNIEnv *env, jobject obj)
+{
+    try {
+        (void) obj;
+
+        /* All values are read together on the event thread */
+        std::vector<BluetoothDevice::Snapshot> devices;
+        BluetoothDevice::snapshot_all(devices);
+        jsize size = devices.size();
+
+        std::vector<jlong> addresses(size);
+        std::vector<jshort> rssi(size);
+        std::vector<jbyte> flags(size);
+
+        jclass string_class = search_class(env, "java/lang/String");
+        jobjectArray names = env->NewObjectArray(size, string_class, NULL);
+        if (!names)
+            throw std::bad_alloc();
+
+        for (jsize i = 0; i < size; i++) {
+            BluetoothDevice::Snapshot &device = devices[i];
+
+            addresses[i] = address_to_long(device.address);
+            rssi[i] = device.rssi;
+            flags[i] = (device.connected ? 1 : 0) |
+                       (device.paired ? 2 : 0) |
+                       (device.trusted ? 4 : 0) |
+                       (device.blocked ? 8 : 0);
+
+            jstring name = env->NewStringUTF(device.name.c_str());
+            env->SetObjectArrayElement(names, i, name);
+            env->DeleteLocalRef(name);
+        }
+
+        jlongArray addresses_array = env->NewLongArray(size);
+        jshortArray rssi_array = env->NewShortArray(size);
+        jbyteArray flags_array = env->NewByteArray(size);
+        if (!addresses_array || !rssi_array || !flags_array)
+            throw std::bad_alloc();
+        env->SetLongArrayRegion(addresses_array, 0, size, addresses.data());
+        env->SetShortArrayRegion(rssi_array, 0, size, rssi.data());
+        env->SetByteArrayRegion(flags_array, 0, size, flags.data());
+
+        jclass clazz = search_class(env, JAVA_PACKAGE "/BluetoothDeviceSnapshot");
+        jmethodID ctor = search_method(env, clazz, "<init>",
+            "([J[S[B[Ljava/lang/String;)V", false);
+
+        jobject result = env->NewObject(clazz, ctor, addresses_array, rssi_array,
+            flags_array, names);
+        if (!result)
+        {
+            throw std::runtime_error("cannot create instance of class\n");
+        }
+        return result;
+    } catch (std::bad_alloc &e) {
+        raise_java_oom_exception(env, e);
+    } catch (std::runtime_error &e) {
+        raise_java_runtime_exception(env, e);
+    } catch (std::invalid_argument &e) {
+        raise_java_invalid_arg_exception(env, e);
+    } catch (std::exception &e) {
+        raise_java_exception(env, e);
+    }
+    return nullptr;
+}
+
 jobject Java_tinyb_BluetoothManager_getServices(JNIEnv *env, jobject obj)
 {
     try {
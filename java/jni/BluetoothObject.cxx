@@ -42,11 +42,12 @@ jobject Java_tinyb_BluetoothObject_clone(JNIEnv *env, jobject obj)
     return generic_clone<BluetoothObject>(env, obj);
 }
 
-void Java_tinyb_BluetoothObject_delete(JNIEnv *env, jobject obj)
+void Java_tinyb_BluetoothObject_deleteInstance(JNIEnv *env, jclass clazz, jlong instance)
 {
-    BluetoothObject *obj_b = getInstance<BluetoothObject>(env, obj);
+    (void)env;
+    (void)clazz;
 
-    delete obj_b;
+    delete reinterpret_cast<BluetoothObject *>(instance);
 }
 
 jboolean Java_tinyb_BluetoothObject_operatorEqual(JNIEnv *env, jobject obj, jobject other)
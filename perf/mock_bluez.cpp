@@ -0,0 +1,426 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "generated-code.h"
+#include "mock_bluez.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#define ADAPTER_PATH "/org/bluez/hci0"
+
+const char *const MockBluez::SERVICE_UUID =
+    "0000babe-0000-1000-8000-00805f9b34fb";
+const char *const MockBluez::CHARACTERISTIC_UUID =
+    "0000beef-0000-1000-8000-00805f9b34fb";
+
+static gboolean on_start_notify(GattCharacteristic1 *object,
+    GDBusMethodInvocation *invocation, gpointer data)
+{
+    (void) data;
+    gatt_characteristic1_set_notifying(object, TRUE);
+    gatt_characteristic1_complete_start_notify(object, invocation);
+    return TRUE;
+}
+
+static gboolean on_stop_notify(GattCharacteristic1 *object,
+    GDBusMethodInvocation *invocation, gpointer data)
+{
+    (void) data;
+    gatt_characteristic1_set_notifying(object, FALSE);
+    gatt_characteristic1_complete_stop_notify(object, invocation);
+    return TRUE;
+}
+
+static const char *const gatt_manager_xml =
+    "<node>"
+    "  <interface name='org.bluez.GattManager1'>"
+    "    <method name='RegisterApplication'>"
+    "      <arg name='application' type='o' direction='in'/>"
+    "      <arg name='options' type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <method name='UnregisterApplication'>"
+    "      <arg name='application' type='o' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+static std::string device_path(unsigned int i)
+{
+    std::string path = ADAPTER_PATH "/dev_" + MockBluez::device_address(i);
+    for (auto &c : path)
+        if (c == ':')
+            c = '_';
+    return path;
+}
+
+static void export_object(GDBusObjectManagerServer *server, ObjectSkeleton *object)
+{
+    g_dbus_object_manager_server_export(server, G_DBUS_OBJECT_SKELETON(object));
+    g_object_unref(object);
+}
+
+MockBluez::MockBluez(const std::string &bus_address, unsigned int device_count) :
+    bus_address(bus_address), device_count(device_count), ready(false),
+    context(nullptr), loop(nullptr), characteristic(nullptr),
+    notify_left(0), notify_rate(0), notify_start(0), notify_sent(0),
+    connection(nullptr), application_ready(false)
+{
+    thread = std::thread(&MockBluez::run, this);
+
+    std::unique_lock<std::mutex> lk(lock);
+    ready_cv.wait(lk, [this] { return ready; });
+    if (!error.empty()) {
+        lk.unlock();
+        thread.join();
+        throw std::runtime_error(error);
+    }
+}
+
+MockBluez::~MockBluez()
+{
+    g_main_loop_quit(loop);
+    thread.join();
+}
+
+std::string MockBluez::device_address(unsigned int i)
+{
+    char address[18];
+    snprintf(address, sizeof(address), "00:00:%02X:%02X:%02X:%02X",
+        (i >> 24) & 0xff, (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+    return address;
+}
+
+void MockBluez::run()
+{
+    GError *gerror = NULL;
+
+    context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+    loop = g_main_loop_new(context, FALSE);
+
+    GDBusConnection *connection = g_dbus_connection_new_for_address_sync(
+        bus_address.c_str(),
+        (GDBusConnectionFlags) (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+            G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+        NULL, NULL, &gerror);
+
+    GDBusObjectManagerServer *server = g_dbus_object_manager_server_new("/");
+    ObjectSkeleton *object;
+
+    object = object_skeleton_new(ADAPTER_PATH);
+    Adapter1 *adapter = adapter1_skeleton_new();
+    adapter1_set_address(adapter, "00:11:22:33:44:55");
+    adapter1_set_name(adapter, "hci0");
+    adapter1_set_alias(adapter, "hci0");
+    adapter1_set_powered(adapter, TRUE);
+    object_skeleton_set_adapter1(object, adapter);
+    g_object_unref(adapter);
+    export_object(server, object);
+
+    for (unsigned int i = 0; i < device_count; i++) {
+        std::string address = device_address(i);
+        std::string name = "mock" + std::to_string(i);
+
+        object = object_skeleton_new(device_path(i).c_str());
+        Device1 *device = device1_skeleton_new();
+        device1_set_address(device, address.c_str());
+        device1_set_name(device, name.c_str());
+        device1_set_alias(device, name.c_str());
+        device1_set_adapter(device, ADAPTER_PATH);
+        device1_set_rssi(device, -60);
+        object_skeleton_set_device1(object, device);
+        g_object_unref(device);
+        export_object(server, object);
+    }
+
+    std::string service_path = device_path(0) + "/service0001";
+    object = object_skeleton_new(service_path.c_str());
+    GattService1 *service = gatt_service1_skeleton_new();
+    gatt_service1_set_uuid(service, SERVICE_UUID);
+    gatt_service1_set_device(service, device_path(0).c_str());
+    gatt_service1_set_primary(service, TRUE);
+    object_skeleton_set_gatt_service1(object, service);
+    g_object_unref(service);
+    export_object(server, object);
+
+    const gchar *flags[] = { "read", "notify", NULL };
+    object = object_skeleton_new((service_path + "/char0002").c_str());
+    characteristic = gatt_characteristic1_skeleton_new();
+    gatt_characteristic1_set_uuid(characteristic, CHARACTERISTIC_UUID);
+    gatt_characteristic1_set_service(characteristic, service_path.c_str());
+    gatt_characteristic1_set_flags(characteristic, flags);
+    g_signal_connect(characteristic, "handle-start-notify",
+        G_CALLBACK(on_start_notify), NULL);
+    g_signal_connect(characteristic, "handle-stop-notify",
+        G_CALLBACK(on_stop_notify), NULL);
+    object_skeleton_set_gatt_characteristic1(object, characteristic);
+    export_object(server, object);
+
+    GVariant *reply = NULL;
+    GDBusNodeInfo *gatt_manager = g_dbus_node_info_new_for_xml(gatt_manager_xml, NULL);
+    if (connection != NULL) {
+        static const GDBusInterfaceVTable vtable = {
+            (GDBusInterfaceMethodCallFunc) gatt_manager_call, NULL, NULL, { 0 }
+        };
+
+        this->connection = connection;
+        g_dbus_object_manager_server_set_connection(server, connection);
+        g_dbus_connection_register_object(connection, ADAPTER_PATH,
+            gatt_manager->interfaces[0], &vtable, this, NULL, NULL);
+        /* DBUS_NAME_FLAG_DO_NOT_QUEUE */
+        reply = g_dbus_connection_call_sync(connection, "org.freedesktop.DBus",
+            "/org/freedesktop/DBus", "org.freedesktop.DBus", "RequestName",
+            g_variant_new("(su)", "org.bluez", 4), G_VARIANT_TYPE("(u)"),
+            G_DBUS_CALL_FLAGS_NONE, -1, NULL, &gerror);
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        guint32 result = 0;
+        if (reply != NULL) {
+            g_variant_get(reply, "(u)", &result);
+            g_variant_unref(reply);
+        }
+        if (gerror != NULL) {
+            error = gerror->message;
+            g_error_free(gerror);
+        } else if (result != 1) {
+            error = "org.bluez is already owned";
+        }
+        ready = true;
+        ready_cv.notify_all();
+    }
+
+    if (error.empty())
+        g_main_loop_run(loop);
+
+    g_object_unref(characteristic);
+    g_object_unref(server);
+    g_dbus_node_info_unref(gatt_manager);
+    if (connection != NULL)
+        g_object_unref(connection);
+    g_main_context_pop_thread_default(context);
+    g_main_loop_unref(loop);
+    g_main_context_unref(context);
+}
+
+void MockBluez::notify(unsigned int count, unsigned int rate)
+{
+    GSource *source = g_timeout_source_new(1);
+
+    notify_left = count;
+    notify_rate = rate;
+    notify_sent = 0;
+    notify_start = g_get_monotonic_time();
+
+    g_source_set_callback(source, (GSourceFunc) notify_callback, this, NULL);
+    g_source_attach(source, context);
+    g_source_unref(source);
+}
+
+int MockBluez::notify_callback(void *data)
+{
+    MockBluez *mock = static_cast<MockBluez *>(data);
+    gint64 now = g_get_monotonic_time();
+    long long due = (now - mock->notify_start) * mock->notify_rate / 1000000;
+
+    /* Catches up on the timer granularity */
+    while (mock->notify_left > 0 && mock->notify_sent < due) {
+        unsigned char value[12];
+        gint64 timestamp = g_get_monotonic_time();
+        memcpy(value, &timestamp, 8);
+        memcpy(value + 8, &mock->notify_sent, 4);
+
+        GBytes *bytes = g_bytes_new(value, sizeof(value));
+        gatt_characteristic1_set_value(mock->characteristic, bytes);
+        g_bytes_unref(bytes);
+        /* One PropertiesChanged signal per value instead of coalescing */
+        g_dbus_interface_skeleton_flush(
+            G_DBUS_INTERFACE_SKELETON(mock->characteristic));
+
+        mock->notify_sent++;
+        mock->notify_left--;
+    }
+
+    return mock->notify_left > 0 ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/* Like BlueZ, reads the objects of the application before replying */
+void MockBluez::gatt_manager_call(GDBusConnection *connection, const char *sender,
+    const char *path, const char *interface, const char *method,
+    void *parameters, void *invocation, void *data)
+{
+    MockBluez *mock = static_cast<MockBluez *>(data);
+    const gchar *application;
+
+    (void) path;
+    (void) interface;
+
+    if (strcmp(method, "UnregisterApplication") == 0) {
+        g_dbus_method_invocation_return_value((GDBusMethodInvocation *) invocation, NULL);
+        return;
+    }
+
+    g_variant_get((GVariant *) parameters, "(&o@a{sv})", &application, NULL);
+    {
+        std::lock_guard<std::mutex> lk(mock->lock);
+        mock->application_sender = sender;
+    }
+
+    g_dbus_connection_call(connection, sender, application,
+        "org.freedesktop.DBus.ObjectManager", "GetManagedObjects", NULL,
+        G_VARIANT_TYPE("(a{oa{sa{sv}}})"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        (GAsyncReadyCallback) application_objects_callback,
+        new std::pair<MockBluez *, GDBusMethodInvocation *>(mock,
+            (GDBusMethodInvocation *) invocation));
+}
+
+void MockBluez::application_objects_callback(void *source, void *res, void *data)
+{
+    std::unique_ptr<std::pair<MockBluez *, GDBusMethodInvocation *>> call(
+        static_cast<std::pair<MockBluez *, GDBusMethodInvocation *> *>(data));
+    MockBluez *mock = call->first;
+    GError *error = NULL;
+
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+        G_ASYNC_RESULT(res), &error);
+    if (reply == NULL) {
+        g_dbus_method_invocation_return_gerror(call->second, error);
+        g_error_free(error);
+        return;
+    }
+
+    /* The first characteristic which can notify */
+    std::string found;
+    GVariantIter *objects;
+    const gchar *object_path;
+    GVariant *interfaces;
+    g_variant_get(reply, "(a{oa{sa{sv}}})", &objects);
+    while (found.empty() &&
+        g_variant_iter_next(objects, "{&o@a{sa{sv}}}", &object_path, &interfaces)) {
+        GVariant *properties = g_variant_lookup_value(interfaces,
+            "org.bluez.GattCharacteristic1", G_VARIANT_TYPE("a{sv}"));
+        if (properties != NULL) {
+            const gchar **flags;
+            if (g_variant_lookup(properties, "Flags", "^a&s", &flags)) {
+                for (int i = 0; flags[i] != NULL; i++)
+                    if (strcmp(flags[i], "notify") == 0)
+                        found = object_path;
+                g_free(flags);
+            }
+            g_variant_unref(properties);
+        }
+        g_variant_unref(interfaces);
+    }
+    g_variant_iter_free(objects);
+    g_variant_unref(reply);
+
+    if (found.empty()) {
+        g_dbus_method_invocation_return_dbus_error(call->second,
+            "org.bluez.Error.InvalidArguments", "No characteristic can notify");
+        return;
+    }
+    g_dbus_method_invocation_return_value(call->second, NULL);
+
+    std::string sender;
+    {
+        std::lock_guard<std::mutex> lk(mock->lock);
+        mock->application_characteristic = found;
+        sender = mock->application_sender;
+    }
+
+    g_dbus_connection_signal_subscribe(mock->connection, sender.c_str(),
+        "org.freedesktop.DBus.Properties", "PropertiesChanged", found.c_str(),
+        "org.bluez.GattCharacteristic1", G_DBUS_SIGNAL_FLAGS_NONE,
+        (GDBusSignalCallback) application_value_callback, mock, NULL);
+    g_dbus_connection_call(mock->connection, sender.c_str(), found.c_str(),
+        "org.bluez.GattCharacteristic1", "StartNotify", NULL, NULL,
+        G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        (GAsyncReadyCallback) application_notify_callback, mock);
+}
+
+void MockBluez::application_notify_callback(void *source, void *res, void *data)
+{
+    MockBluez *mock = static_cast<MockBluez *>(data);
+    GError *error = NULL;
+
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+        G_ASYNC_RESULT(res), &error);
+    if (reply == NULL) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+    g_variant_unref(reply);
+
+    std::lock_guard<std::mutex> lk(mock->lock);
+    mock->application_ready = true;
+    mock->ready_cv.notify_all();
+}
+
+void MockBluez::application_value_callback(GDBusConnection *connection,
+    const char *sender, const char *path, const char *interface,
+    const char *signal, void *parameters, void *data)
+{
+    MockBluez *mock = static_cast<MockBluez *>(data);
+    gint64 now = g_get_monotonic_time();
+    GVariant *changed;
+
+    (void) connection;
+    (void) sender;
+    (void) path;
+    (void) interface;
+    (void) signal;
+
+    g_variant_get((GVariant *) parameters, "(&s@a{sv}@as)", NULL, &changed, NULL);
+    GVariant *value = g_variant_lookup_value(changed, "Value", G_VARIANT_TYPE("ay"));
+    g_variant_unref(changed);
+    if (value == NULL)
+        return;
+
+    gsize size;
+    const unsigned char *bytes = static_cast<const unsigned char *>(
+        g_variant_get_fixed_array(value, &size, 1));
+    if (size >= sizeof(gint64)) {
+        gint64 sent;
+        memcpy(&sent, bytes, sizeof(sent));
+        std::lock_guard<std::mutex> lk(mock->lock);
+        mock->application_latencies.push_back((now - sent) / 1000.0);
+    }
+    g_variant_unref(value);
+}
+
+bool MockBluez::wait_application(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lk(lock);
+    return ready_cv.wait_for(lk, timeout, [this] { return application_ready; });
+}
+
+std::vector<double> MockBluez::get_application_latencies()
+{
+    std::lock_guard<std::mutex> lk(lock);
+    return application_latencies;
+}
@@ -0,0 +1,114 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+/* Forward declaration of types */
+struct _GMainContext;
+typedef struct _GMainContext GMainContext;
+struct _GMainLoop;
+typedef struct _GMainLoop GMainLoop;
+struct _GattCharacteristic1;
+typedef struct _GattCharacteristic1 GattCharacteristic1;
+struct _GDBusConnection;
+typedef struct _GDBusConnection GDBusConnection;
+
+/* A scripted org.bluez stand-in, exporting one adapter with a number of
+ * devices through the GDBus skeletons of generated-code.c. The first
+ * device has a service with one characteristic which can send
+ * notifications. It runs on its own thread and connection, so tinyb in
+ * the same process talks to it over the bus like to BlueZ. The adapter
+ * also accepts GATT applications through GattManager1, acting as a remote
+ * central which enables notifications of their first notifying
+ * characteristic. */
+class MockBluez
+{
+private:
+    std::string bus_address;
+    unsigned int device_count;
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable ready_cv;
+    bool ready;
+    std::string error;
+
+    GMainContext *context;
+    GMainLoop *loop;
+    GattCharacteristic1 *characteristic;
+
+    /* Notifications still to send, at rate per second */
+    unsigned int notify_left;
+    unsigned int notify_rate;
+    long long notify_start;
+    unsigned int notify_sent;
+
+    /* The registered application, notifications enabled */
+    GDBusConnection *connection;
+    std::string application_sender;
+    std::string application_characteristic;
+    bool application_ready;
+    std::vector<double> application_latencies;
+
+    void run();
+    static int notify_callback(void *data);
+    static void gatt_manager_call(GDBusConnection *connection, const char *sender,
+        const char *path, const char *interface, const char *method,
+        void *parameters, void *invocation, void *data);
+    static void application_objects_callback(void *source, void *res, void *data);
+    static void application_notify_callback(void *source, void *res, void *data);
+    static void application_value_callback(GDBusConnection *connection,
+        const char *sender, const char *path, const char *interface,
+        const char *signal, void *parameters, void *data);
+
+public:
+    static const char *const SERVICE_UUID;
+    static const char *const CHARACTERISTIC_UUID;
+
+    MockBluez(const std::string &bus_address, unsigned int device_count);
+    ~MockBluez();
+
+    /* Address of device i */
+    static std::string device_address(unsigned int i);
+
+    /* Sends count notifications at rate per second, each value being the
+     * monotonic time at which it was sent in microseconds, 8 bytes,
+     * followed by its 4 byte sequence number */
+    void notify(unsigned int count, unsigned int rate);
+
+    /* Waits until an application registered and its notifications are
+     * enabled, returns FALSE on timeout */
+    bool wait_application(std::chrono::milliseconds timeout);
+
+    /* Latencies in milliseconds of the notifications received from the
+     * application, whose values must start like the ones of notify() */
+    std::vector<double> get_application_latencies();
+};
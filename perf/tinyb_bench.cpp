@@ -0,0 +1,278 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <tinyb.hpp>
+#include <gio/gio.h>
+
+#include "mock_bluez.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+using namespace tinyb;
+
+#define ENUMERATE_DEVICES 10000
+#define FIND_DEVICES 1000
+#define FIND_THREADS 100
+#define NOTIFY_RATE 1000
+#define NOTIFY_SECONDS 5
+
+typedef std::map<std::string, double> Metrics;
+
+static double elapsed_ms(gint64 start)
+{
+    return (g_get_monotonic_time() - start) / 1000.0;
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t i = (size_t) (p / 100 * (values.size() - 1) + 0.5);
+    return values[i];
+}
+
+/* Startup includes fetching all managed objects from the mock */
+static void run_enumerate(Metrics &metrics)
+{
+    MockBluez mock(getenv("DBUS_SESSION_BUS_ADDRESS"), ENUMERATE_DEVICES);
+
+    gint64 start = g_get_monotonic_time();
+    BluetoothManager *manager = BluetoothManager::get_bluetooth_manager();
+    metrics["startup_10k_ms"] = elapsed_ms(start);
+
+    start = g_get_monotonic_time();
+    auto devices = manager->get_devices();
+    metrics["enumerate_10k_ms"] = elapsed_ms(start);
+
+    if (devices.size() != ENUMERATE_DEVICES)
+        throw std::runtime_error("Enumerated " + std::to_string(devices.size()) +
+            " devices instead of " + std::to_string(ENUMERATE_DEVICES));
+}
+
+static void run_find(Metrics &metrics)
+{
+    MockBluez mock(getenv("DBUS_SESSION_BUS_ADDRESS"), FIND_DEVICES);
+    BluetoothManager *manager = BluetoothManager::get_bluetooth_manager();
+
+    std::vector<double> latencies(FIND_THREADS);
+    std::atomic<unsigned int> missing(0);
+    std::vector<std::thread> threads;
+
+    gint64 start = g_get_monotonic_time();
+    for (unsigned int i = 0; i < FIND_THREADS; i++) {
+        threads.emplace_back([&, i] {
+            /* Spread over the object list, the last one is the worst case */
+            std::string address = MockBluez::device_address(
+                FIND_DEVICES - 1 - i * (FIND_DEVICES / FIND_THREADS));
+            gint64 begin = g_get_monotonic_time();
+            auto device = manager->find<BluetoothDevice>(nullptr, &address,
+                nullptr, std::chrono::seconds(5));
+            latencies[i] = elapsed_ms(begin);
+            if (device == nullptr)
+                missing++;
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    metrics["find_total_ms"] = elapsed_ms(start);
+    metrics["find_p99_ms"] = percentile(latencies, 99);
+
+    if (missing > 0)
+        throw std::runtime_error(std::to_string(missing) + " devices not found");
+}
+
+struct NotifyResults {
+    std::mutex lock;
+    std::vector<double> latencies;
+};
+
+static void notify_callback(BluetoothGattCharacteristic &characteristic,
+    std::shared_ptr<const std::vector<unsigned char>> value, void *data)
+{
+    (void) characteristic;
+    NotifyResults *results = static_cast<NotifyResults *>(data);
+    gint64 sent;
+
+    if (value->size() < sizeof(sent))
+        return;
+    memcpy(&sent, value->data(), sizeof(sent));
+
+    std::lock_guard<std::mutex> lk(results->lock);
+    results->latencies.push_back((g_get_monotonic_time() - sent) / 1000.0);
+}
+
+static void run_notify(Metrics &metrics)
+{
+    MockBluez mock(getenv("DBUS_SESSION_BUS_ADDRESS"), 1);
+    BluetoothManager *manager = BluetoothManager::get_bluetooth_manager();
+    NotifyResults results;
+
+    std::string uuid = MockBluez::CHARACTERISTIC_UUID;
+    auto characteristic = manager->find<BluetoothGattCharacteristic>(nullptr,
+        &uuid, nullptr, std::chrono::seconds(5));
+    if (characteristic == nullptr)
+        throw std::runtime_error("Characteristic not found");
+
+    unsigned int id = characteristic->subscribe(notify_callback, &results);
+    if (id == 0)
+        throw std::runtime_error("Could not subscribe");
+
+    unsigned int count = NOTIFY_RATE * NOTIFY_SECONDS;
+    mock.notify(count, NOTIFY_RATE);
+    std::this_thread::sleep_for(std::chrono::seconds(NOTIFY_SECONDS + 1));
+    characteristic->unsubscribe(id);
+
+    std::lock_guard<std::mutex> lk(results.lock);
+    metrics["notify_p99_ms"] = percentile(results.latencies, 99);
+    metrics["notify_lost"] = count - results.latencies.size();
+}
+
+/* Values set on a local characteristic, notified to the mock which
+ * registered as a central through GattManager1 */
+static void run_server(Metrics &metrics)
+{
+    MockBluez mock(getenv("DBUS_SESSION_BUS_ADDRESS"), 1);
+    BluetoothManager *manager = BluetoothManager::get_bluetooth_manager();
+    BluetoothGattServer server;
+
+    unsigned int service = server.add_service(MockBluez::SERVICE_UUID);
+    unsigned int characteristic = server.add_characteristic(service,
+        MockBluez::CHARACTERISTIC_UUID, {"read", "notify"});
+
+    if (!server.register_application(*manager->get_default_adapter()))
+        throw std::runtime_error("Could not register the application");
+    if (!mock.wait_application(std::chrono::seconds(5)))
+        throw std::runtime_error("Notifications were not started");
+
+    unsigned int count = NOTIFY_RATE * NOTIFY_SECONDS;
+    gint64 start = g_get_monotonic_time();
+    for (unsigned int i = 0; i < count; i++) {
+        gint64 due = start + (gint64) i * G_USEC_PER_SEC / NOTIFY_RATE;
+        gint64 now = g_get_monotonic_time();
+        if (due > now)
+            std::this_thread::sleep_for(std::chrono::microseconds(due - now));
+
+        auto value = std::make_shared<std::vector<unsigned char>>(12);
+        now = g_get_monotonic_time();
+        memcpy(value->data(), &now, sizeof(now));
+        memcpy(value->data() + sizeof(now), &i, sizeof(i));
+        server.set_value(characteristic, value);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    server.unregister_application();
+
+    auto latencies = mock.get_application_latencies();
+    metrics["server_notify_p99_ms"] = percentile(latencies, 99);
+    metrics["server_notify_lost"] = count - latencies.size();
+}
+
+/* Each line is: metric limit tolerance_percent */
+static bool check(const std::string &baselines, const Metrics &metrics)
+{
+    std::ifstream file(baselines);
+    std::string line;
+    bool ok = true;
+
+    if (!file)
+        throw std::runtime_error("Cannot open " + baselines);
+
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double limit, tolerance;
+
+        if (line.empty() || line[0] == '#')
+            continue;
+        if (!(fields >> name >> limit >> tolerance))
+            throw std::runtime_error("Invalid baseline: " + line);
+
+        auto it = metrics.find(name);
+        if (it == metrics.end())
+            continue;
+
+        double allowed = limit * (1 + tolerance / 100);
+        bool pass = it->second <= allowed;
+        printf("%-20s %12.3f  limit %12.3f  %s\n", name.c_str(), it->second,
+            allowed, pass ? "ok" : "REGRESSION");
+        if (!pass)
+            ok = false;
+    }
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <baselines> <enumerate|find|notify|server> [--print]\n",
+            argv[0]);
+        return 2;
+    }
+
+    /* The mock owns org.bluez on a private session bus, see CMakeLists.txt */
+    const char *address = getenv("DBUS_SESSION_BUS_ADDRESS");
+    if (address == NULL) {
+        fprintf(stderr, "DBUS_SESSION_BUS_ADDRESS is not set, run under dbus-run-session\n");
+        return 2;
+    }
+    setenv("DBUS_SYSTEM_BUS_ADDRESS", address, 1);
+
+    std::string scenario = argv[2];
+    bool print = argc > 3 && strcmp(argv[3], "--print") == 0;
+    Metrics metrics;
+
+    try {
+        if (scenario == "enumerate")
+            run_enumerate(metrics);
+        else if (scenario == "find")
+            run_find(metrics);
+        else if (scenario == "notify")
+            run_notify(metrics);
+        else if (scenario == "server")
+            run_server(metrics);
+        else
+            throw std::runtime_error("Unknown scenario " + scenario);
+
+        if (print) {
+            for (auto &metric : metrics)
+                printf("%s %.3f\n", metric.first.c_str(), metric.second);
+            exit(0);
+        }
+
+        /* exit() instead of returning, the manager is never torn down */
+        exit(check(argv[1], metrics) ? 0 : 1);
+    } catch (std::exception &e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        exit(1);
+    }
+}
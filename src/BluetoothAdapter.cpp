@@ -24,12 +24,78 @@
 
 #include "generated-code.h"
 #include "tinyb_utils.hpp"
+#include "tinyb_bluez.hpp"
 #include "BluetoothAdapter.hpp"
 #include "BluetoothDevice.hpp"
 #include "BluetoothManager.hpp"
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 using namespace tinyb;
 
+/* Discovery sessions of one adapter, keyed by adapter path. The D-Bus
+ * calls are made without discovery_lock, busy is set meanwhile and the
+ * other callers for the same adapter wait on discovery_cv. */
+struct DiscoverySessions {
+    Adapter1 *object = nullptr;
+    std::map<unsigned int, BluetoothDiscoveryFilter> filters;
+    /* The merged filter last set on the adapter */
+    BluetoothDiscoveryFilter applied;
+    bool busy = false;
+    /* Set once the adapter object was removed */
+    bool removed = false;
+
+    ~DiscoverySessions() {
+        if (object != nullptr)
+            g_object_unref(object);
+    }
+};
+
+static std::mutex discovery_lock;
+static std::condition_variable discovery_cv;
+static std::map<std::string, std::shared_ptr<DiscoverySessions>> discovery_adapters;
+static std::map<unsigned int, std::string> discovery_sessions;
+static unsigned int last_discovery_session = 0;
+
+/* Returns the least restrictive filter which lets through every device
+ * matched by one of the filters */
+static BluetoothDiscoveryFilter merge_discovery_filters(
+    const std::map<unsigned int, BluetoothDiscoveryFilter> &filters)
+{
+    BluetoothDiscoveryFilter merged;
+    bool first = true;
+
+    for (auto &it : filters) {
+        const BluetoothDiscoveryFilter &filter = it.second;
+
+        if (first) {
+            merged = filter;
+            first = false;
+        } else {
+            if (merged.uuids.empty() || filter.uuids.empty())
+                merged.uuids.clear();
+            else
+                merged.uuids.insert(merged.uuids.end(),
+                    filter.uuids.begin(), filter.uuids.end());
+            merged.rssi = std::min(merged.rssi, filter.rssi);
+            if (merged.transport != filter.transport)
+                merged.transport = BluetoothDiscoveryFilter::Transport::AUTO;
+            merged.duplicate_data |= filter.duplicate_data;
+        }
+    }
+
+    for (auto &uuid : merged.uuids)
+        std::transform(uuid.begin(), uuid.end(), uuid.begin(), ::tolower);
+    std::sort(merged.uuids.begin(), merged.uuids.end());
+    merged.uuids.erase(std::unique(merged.uuids.begin(), merged.uuids.end()),
+        merged.uuids.end());
+    return merged;
+}
+
 std::string BluetoothAdapter::get_class_name() const
 {
     return std::string("BluetoothAdapter");
@@ -56,9 +122,9 @@ BluetoothAdapter::BluetoothAdapter(Adapter1 *object)
     g_object_ref(object);
 }
 
-BluetoothAdapter::BluetoothAdapter(const BluetoothAdapter &object)
+BluetoothAdapter::BluetoothAdapter(const BluetoothAdapter &object) :
+    BluetoothAdapter(object.object)
 {
-    BluetoothAdapter(object.object);
 }
 
 BluetoothAdapter *BluetoothAdapter::clone() const
@@ -77,7 +143,7 @@ std::unique_ptr<BluetoothAdapter> BluetoothAdapter::make(Object *object,
 {
     Adapter1 *adapter;
     if((type == BluetoothType::NONE || type == BluetoothType::ADAPTER) &&
-        (adapter = object_get_adapter1(object)) != NULL) {
+        (adapter = object_peek_adapter1(object)) != NULL) {
 
         std::unique_ptr<BluetoothAdapter> p(new BluetoothAdapter(adapter));
 
@@ -138,6 +204,178 @@ bool BluetoothAdapter::stop_discovery ()
     return result;
 }
 
+bool BluetoothAdapter::set_discovery_filter (
+    const BluetoothDiscoveryFilter &filter)
+{
+    GError *error = NULL;
+    GVariantBuilder builder;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    if (!filter.uuids.empty()) {
+        GVariantBuilder uuids;
+        g_variant_builder_init(&uuids, G_VARIANT_TYPE("as"));
+        for (auto &uuid : filter.uuids)
+            g_variant_builder_add(&uuids, "s", uuid.c_str());
+        g_variant_builder_add(&builder, "{sv}", "UUIDs",
+            g_variant_builder_end(&uuids));
+    }
+    if (filter.rssi != BluetoothDiscoveryFilter::RSSI_ANY)
+        g_variant_builder_add(&builder, "{sv}", "RSSI",
+            g_variant_new_int16(filter.rssi));
+    if (filter.transport == BluetoothDiscoveryFilter::Transport::BREDR)
+        g_variant_builder_add(&builder, "{sv}", "Transport",
+            g_variant_new_string("bredr"));
+    else if (filter.transport == BluetoothDiscoveryFilter::Transport::LE)
+        g_variant_builder_add(&builder, "{sv}", "Transport",
+            g_variant_new_string("le"));
+    if (filter.duplicate_data)
+        g_variant_builder_add(&builder, "{sv}", "DuplicateData",
+            g_variant_new_boolean(TRUE));
+
+    GVariant *result = g_dbus_proxy_call_sync(
+        G_DBUS_PROXY(object),
+        "SetDiscoveryFilter",
+        g_variant_new("(a{sv})", &builder),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        NULL,
+        &error
+    );
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+    }
+    if (result == NULL)
+        return false;
+    g_variant_unref(result);
+    return true;
+}
+
+unsigned int BluetoothAdapter::open_discovery_session (
+    const BluetoothDiscoveryFilter &filter)
+{
+    std::unique_lock<std::mutex> lk(discovery_lock);
+    std::string path = get_object_path();
+    std::shared_ptr<DiscoverySessions> sessions;
+
+    for (;;) {
+        auto it = discovery_adapters.find(path);
+        if (it != discovery_adapters.end()) {
+            sessions = it->second;
+        } else {
+            sessions = std::make_shared<DiscoverySessions>();
+            sessions->object = object;
+            g_object_ref(object);
+            discovery_adapters[path] = sessions;
+        }
+        if (!sessions->busy)
+            break;
+        discovery_cv.wait(lk);
+    }
+
+    bool first = sessions->filters.empty();
+    unsigned int id = ++last_discovery_session;
+    if (id == 0)
+        id = ++last_discovery_session;
+    sessions->filters[id] = filter;
+
+    BluetoothDiscoveryFilter merged = merge_discovery_filters(sessions->filters);
+    bool set_filter = first || merged != sessions->applied;
+    sessions->busy = true;
+
+    /* Set the filter before discovery starts, so that it does not
+     * restart right away */
+    lk.unlock();
+    bool filter_set = set_filter && set_discovery_filter(merged);
+    bool started = !first || start_discovery();
+    lk.lock();
+
+    sessions->busy = false;
+    discovery_cv.notify_all();
+    if (filter_set)
+        sessions->applied = merged;
+
+    if (!started || sessions->removed) {
+        sessions->filters.erase(id);
+        auto it = discovery_adapters.find(path);
+        if (sessions->filters.empty() && it != discovery_adapters.end() &&
+            it->second == sessions)
+            discovery_adapters.erase(it);
+        return 0;
+    }
+
+    discovery_sessions[id] = path;
+    return id;
+}
+
+bool BluetoothAdapter::close_discovery_session (
+    unsigned int id)
+{
+    std::unique_lock<std::mutex> lk(discovery_lock);
+    std::shared_ptr<DiscoverySessions> sessions;
+    std::string path;
+
+    for (;;) {
+        auto it = discovery_sessions.find(id);
+        if (it == discovery_sessions.end())
+            return false;
+        path = it->second;
+        sessions = discovery_adapters[path];
+        if (!sessions->busy)
+            break;
+        discovery_cv.wait(lk);
+    }
+    discovery_sessions.erase(id);
+    sessions->filters.erase(id);
+
+    /* Do not leave the filter to start_discovery() once the last one
+     * is closed */
+    bool last = sessions->filters.empty();
+    BluetoothDiscoveryFilter merged;
+    if (!last)
+        merged = merge_discovery_filters(sessions->filters);
+    bool set_filter = merged != sessions->applied;
+    if (!last && !set_filter)
+        return true;
+
+    BluetoothAdapter adapter(sessions->object);
+    sessions->busy = true;
+
+    lk.unlock();
+    if (last)
+        adapter.stop_discovery();
+    bool filter_set = set_filter && adapter.set_discovery_filter(merged);
+    lk.lock();
+
+    sessions->busy = false;
+    discovery_cv.notify_all();
+    if (filter_set)
+        sessions->applied = merged;
+
+    auto it = discovery_adapters.find(path);
+    if (sessions->filters.empty() && it != discovery_adapters.end() &&
+        it->second == sessions)
+        discovery_adapters.erase(it);
+    return true;
+}
+
+void BluetoothAdapter::forget_discovery_sessions (
+    const std::string &path)
+{
+    std::lock_guard<std::mutex> lk(discovery_lock);
+
+    auto it = discovery_adapters.find(path);
+    if (it == discovery_adapters.end())
+        return;
+
+    /* The ids are closed, a call in flight sees removed */
+    for (auto &filter : it->second->filters)
+        discovery_sessions.erase(filter.first);
+    it->second->filters.clear();
+    it->second->removed = true;
+    discovery_adapters.erase(it);
+}
+
 bool BluetoothAdapter::remove_device (
     const std::string &arg_device)
 {
@@ -253,3 +491,40 @@ std::unique_ptr<std::string> BluetoothAdapter::get_modalias ()
         return std::unique_ptr<std::string>();
     return std::unique_ptr<std::string>(new std::string(modalias));
 }
+
+static void fill_snapshot(Adapter1 *object, BluetoothAdapter::Snapshot &snapshot)
+{
+    GDBusProxy *proxy = G_DBUS_PROXY(object);
+
+    snapshot.path = g_dbus_proxy_get_object_path(proxy);
+    read_property<bluez::Adapter1::Address>(proxy, snapshot.address);
+    read_property<bluez::Adapter1::Name>(proxy, snapshot.name);
+    read_property<bluez::Adapter1::Alias>(proxy, snapshot.alias);
+    read_property<bluez::Adapter1::Modalias>(proxy, snapshot.modalias);
+    read_property<bluez::Adapter1::UUIDs>(proxy, snapshot.uuids);
+    read_property<bluez::Adapter1::Class>(proxy, snapshot.device_class);
+    read_property<bluez::Adapter1::DiscoverableTimeout>(proxy, snapshot.discoverable_timeout);
+    read_property<bluez::Adapter1::PairableTimeout>(proxy, snapshot.pairable_timeout);
+    read_property<bluez::Adapter1::Powered>(proxy, snapshot.powered);
+    read_property<bluez::Adapter1::Discoverable>(proxy, snapshot.discoverable);
+    read_property<bluez::Adapter1::Pairable>(proxy, snapshot.pairable);
+    read_property<bluez::Adapter1::Discovering>(proxy, snapshot.discovering);
+}
+
+BluetoothAdapter::Snapshot BluetoothAdapter::snapshot ()
+{
+    std::vector<Snapshot> snapshots;
+    take_snapshots(std::vector<Adapter1 *>{object}, snapshots, fill_snapshot);
+    return snapshots[0];
+}
+
+void BluetoothAdapter::snapshot (
+    const std::vector<std::unique_ptr<BluetoothAdapter>> &adapters,
+    std::vector<Snapshot> &snapshots)
+{
+    std::vector<Adapter1 *> proxies;
+    proxies.reserve(adapters.size());
+    for (auto &p : adapters)
+        proxies.push_back(p->object);
+    take_snapshots(proxies, snapshots, fill_snapshot);
+}
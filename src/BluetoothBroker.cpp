@@ -0,0 +1,655 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "generated-code.h"
+#include "tinyb_utils.hpp"
+#include "tinyb_broker.hpp"
+#include "BluetoothBroker.hpp"
+#include "BluetoothManager.hpp"
+#include "BluetoothGattCharacteristic.hpp"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+using namespace tinyb;
+
+/* Results of connect and disconnect requests, completed on the event thread
+ * and replied by the control thread, which polls fd. Shared with the calls
+ * in flight, which may outlive the broker. */
+struct BrokerCompletions {
+    std::mutex lock;
+    /* Client id and result */
+    std::vector<std::pair<unsigned int, bool>> results;
+    int fd;
+
+    BrokerCompletions() : fd(eventfd(0, EFD_CLOEXEC)) {}
+    ~BrokerCompletions() {
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+struct BrokerCall {
+    std::shared_ptr<BrokerCompletions> completions;
+    unsigned int client;
+};
+
+static void call_callback(GObject *source, GAsyncResult *res, gpointer data)
+{
+    std::unique_ptr<BrokerCall> call(static_cast<BrokerCall *>(data));
+    GError *error = NULL;
+
+    GVariant *result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res,
+        &error);
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+    } else {
+        g_variant_unref(result);
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(call->completions->lock);
+        call->completions->results.push_back(
+            std::make_pair(call->client, result != NULL));
+    }
+    uint64_t one = 1;
+    if (write(call->completions->fd, &one, sizeof(one)) != sizeof(one))
+        g_printerr("Error: cannot wake the broker control thread\n");
+}
+
+static void copy_string(char *dest, size_t size, const char *src)
+{
+    if (src == NULL)
+        src = "";
+    strncpy(dest, src, size - 1);
+    dest[size - 1] = '\0';
+}
+
+static void begin_update(BrokerDevice *device)
+{
+    device->sequence.store(device->sequence.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void end_update(BrokerDevice *device)
+{
+    device->updated = g_get_monotonic_time();
+    device->sequence.store(device->sequence.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+}
+
+BluetoothBroker::BluetoothBroker(const std::string &name,
+    unsigned int device_capacity, size_t ring_size) :
+    name(name), base(nullptr), size(0), header(nullptr), property_id(0),
+    advertisement_id(0), added_handler(0), removed_handler(0),
+    listen_fd(-1), stop_fd(-1), last_client_id(0),
+    completions(std::make_shared<BrokerCompletions>())
+{
+    size_t ring = 4096;
+    while (ring < ring_size)
+        ring *= 2;
+    size_t devices_offset = (sizeof(BrokerHeader) + 63) & ~(size_t) 63;
+    size_t ring_offset = (devices_offset + device_capacity * sizeof(BrokerDevice)
+        + 63) & ~(size_t) 63;
+    size = ring_offset + ring;
+
+    /* Always a new file, clients of a previous broker keep their mapping
+     * of the old one until they reconnect */
+    std::string memory_path = broker_memory_path(name);
+    unlink(memory_path.c_str());
+    int fd = open(memory_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Cannot create " + memory_path + ": " +
+            strerror(errno));
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(memory_path.c_str());
+        throw std::runtime_error("Cannot map " + memory_path + ": " +
+            strerror(error));
+    }
+    base = (unsigned char *) map;
+
+    /* The file is zero filled, which is a valid state of all fields */
+    header = reinterpret_cast<BrokerHeader *>(base);
+    header->version = BROKER_VERSION;
+    header->device_capacity = device_capacity;
+    header->devices_offset = devices_offset;
+    header->ring_offset = ring_offset;
+    header->ring_size = ring;
+
+    std::string socket_path = broker_socket_path(name);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    copy_string(address.sun_path, sizeof(address.sun_path), socket_path.c_str());
+
+    unlink(socket_path.c_str());
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (listen_fd < 0 || stop_fd < 0 || completions->fd < 0 ||
+        bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+        listen(listen_fd, 16) != 0) {
+        error = errno;
+        if (listen_fd >= 0)
+            close(listen_fd);
+        if (stop_fd >= 0)
+            close(stop_fd);
+        munmap(base, size);
+        unlink(memory_path.c_str());
+        throw std::runtime_error("Cannot listen on " + socket_path + ": " +
+            strerror(error));
+    }
+
+    /* Subscribe before reading the current state, so that no change is
+     * missed; the callbacks wait for the lock */
+    BluetoothManager *manager = BluetoothManager::get_bluetooth_manager();
+    std::lock_guard<std::mutex> lk(lock);
+
+    added_handler = g_signal_connect(gdbus_manager, "object-added",
+        G_CALLBACK(object_added_callback), this);
+    removed_handler = g_signal_connect(gdbus_manager, "object-removed",
+        G_CALLBACK(object_removed_callback), this);
+    property_id = manager->subscribe_property_changes(property_callback, this);
+    advertisement_id = manager->subscribe_advertisements(advertisement_callback, this);
+
+    GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
+    for (l = objects; l != NULL; l = l->next) {
+        Device1 *device = object_peek_device1(OBJECT(l->data));
+        if (device != NULL)
+            update_device(device);
+    }
+    g_list_free_full(objects, g_object_unref);
+
+    /* Clients check the magic last */
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, BROKER_MAGIC, sizeof(header->magic));
+
+    control = std::thread(&BluetoothBroker::control_loop, this);
+}
+
+BluetoothBroker::~BluetoothBroker()
+{
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+        g_printerr("Error: cannot stop the broker control thread\n");
+    control.join();
+
+    for (auto &client : clients) {
+        release(client);
+        close(client.fd);
+    }
+
+    BluetoothManager *manager = BluetoothManager::get_bluetooth_manager();
+    manager->unsubscribe_advertisements(advertisement_id);
+    manager->unsubscribe_property_changes(property_id);
+
+    /* The signal callbacks run on the event thread, once the handlers are
+     * disconnected there none of them is running or can start */
+    run_on_event_thread([](void *data) {
+        BluetoothBroker *broker = static_cast<BluetoothBroker *>(data);
+        g_signal_handler_disconnect(gdbus_manager, broker->added_handler);
+        g_signal_handler_disconnect(gdbus_manager, broker->removed_handler);
+    }, this);
+
+    close(listen_fd);
+    close(stop_fd);
+    unlink(broker_socket_path(name).c_str());
+    unlink(broker_memory_path(name).c_str());
+    munmap(base, size);
+}
+
+/* Must be called with lock held */
+BrokerDevice *BluetoothBroker::get_device(const std::string &path, bool create)
+{
+    BrokerDevice *devices = reinterpret_cast<BrokerDevice *>(
+        base + header->devices_offset);
+
+    auto it = device_slots.find(path);
+    if (it != device_slots.end())
+        return &devices[it->second];
+    if (!create)
+        return nullptr;
+
+    uint32_t slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else if (header->device_count.load(std::memory_order_relaxed) <
+        header->device_capacity) {
+        slot = header->device_count.load(std::memory_order_relaxed);
+    } else {
+        return nullptr;
+    }
+
+    BrokerDevice *device = &devices[slot];
+    begin_update(device);
+    device->flags = BROKER_DEVICE_PRESENT;
+    copy_string(device->path, sizeof(device->path), path.c_str());
+    device->address[0] = '\0';
+    device->name[0] = '\0';
+    device->rssi = 0;
+    end_update(device);
+
+    if (slot == header->device_count.load(std::memory_order_relaxed))
+        header->device_count.store(slot + 1, std::memory_order_release);
+    device_slots[path] = slot;
+    return device;
+}
+
+/* Must be called with lock held */
+void BluetoothBroker::remove_device(const std::string &path)
+{
+    BrokerDevice *device = get_device(path, false);
+    if (device == nullptr)
+        return;
+
+    begin_update(device);
+    device->flags = 0;
+    end_update(device);
+
+    free_slots.push_back(device_slots[path]);
+    device_slots.erase(path);
+    write_record((uint16_t) BrokerRecordType::DEVICE_REMOVED, path, 0, NULL, 0);
+}
+
+/* Must be called with lock held */
+void BluetoothBroker::update_device(Device1 *device)
+{
+    std::string path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(device));
+    BrokerDevice *entry = get_device(path, true);
+    if (entry == nullptr)
+        return;
+
+    const gchar *name = device1_get_name(device);
+    if (name == NULL)
+        name = device1_get_alias(device);
+
+    begin_update(entry);
+    entry->flags = BROKER_DEVICE_PRESENT |
+        (device1_get_connected(device) ? BROKER_DEVICE_CONNECTED : 0) |
+        (device1_get_paired(device) ? BROKER_DEVICE_PAIRED : 0) |
+        (device1_get_trusted(device) ? BROKER_DEVICE_TRUSTED : 0);
+    entry->rssi = device1_get_rssi(device);
+    copy_string(entry->address, sizeof(entry->address), device1_get_address(device));
+    copy_string(entry->name, sizeof(entry->name), name);
+    end_update(entry);
+
+    write_record((uint16_t) BrokerRecordType::DEVICE_CHANGED, path, entry->rssi,
+        NULL, 0);
+}
+
+/* Must be called with lock held */
+void BluetoothBroker::write_record(uint16_t type, const std::string &path,
+    int16_t rssi, const unsigned char *data, size_t data_size)
+{
+    uint64_t ring_size = header->ring_size;
+    unsigned char *ring = base + header->ring_offset;
+    size_t path_size = std::min(path.size(), (size_t) UINT16_MAX);
+    size_t record_size = broker_align8(sizeof(BrokerRecord) + path_size + data_size);
+
+    /* Records larger than a quarter of the ring would overwrite most of it */
+    if (record_size > ring_size / 4)
+        return;
+
+    uint64_t head = header->ring_head.load(std::memory_order_relaxed);
+    uint64_t offset = head & (ring_size - 1);
+    uint64_t end = head + record_size;
+    if (offset + record_size > ring_size)
+        end += ring_size - offset;
+
+    /* Readers must see the reservation before the overwritten bytes */
+    header->ring_reserved.store(end, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (offset + record_size > ring_size) {
+        if (ring_size - offset >= sizeof(BrokerRecord)) {
+            BrokerRecord padding;
+            memset(&padding, 0, sizeof(padding));
+            padding.size = ring_size - offset;
+            padding.type = BrokerRecordType::PADDING;
+            memcpy(ring + offset, &padding, sizeof(padding));
+        }
+        offset = 0;
+    }
+
+    BrokerRecord record;
+    memset(&record, 0, sizeof(record));
+    record.size = record_size;
+    record.type = (BrokerRecordType) type;
+    record.path_size = path_size;
+    record.data_size = data_size;
+    record.rssi = rssi;
+    record.timestamp = g_get_monotonic_time();
+    memcpy(ring + offset, &record, sizeof(record));
+    memcpy(ring + offset + sizeof(record), path.data(), path_size);
+    if (data_size > 0)
+        memcpy(ring + offset + sizeof(record) + path_size, data, data_size);
+
+    header->ring_head.store(end, std::memory_order_release);
+    header->ring_wake.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->ring_wake),
+        FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void BluetoothBroker::property_callback(
+    const std::vector<BluetoothPropertyChange> &changes, void *data)
+{
+    BluetoothBroker *broker = static_cast<BluetoothBroker *>(data);
+    std::string last;
+
+    std::lock_guard<std::mutex> lk(broker->lock);
+    for (auto &change : changes) {
+        /* Consecutive changes of a device are applied at once */
+        if (change.type != BluetoothType::DEVICE || change.path == last)
+            continue;
+        last = change.path;
+
+        GDBusInterface *interface = g_dbus_object_manager_get_interface(
+            gdbus_manager, change.path.c_str(), "org.bluez.Device1");
+        if (interface == NULL)
+            continue;
+        broker->update_device(DEVICE1(interface));
+        g_object_unref(interface);
+    }
+}
+
+void BluetoothBroker::advertisement_callback(
+    const BluetoothAdvertisement &advertisement, void *data)
+{
+    BluetoothBroker *broker = static_cast<BluetoothBroker *>(data);
+    std::vector<unsigned char> payload;
+
+    for (auto &it : advertisement.manufacturer_data) {
+        uint16_t length = std::min(it.second.size(), (size_t) UINT16_MAX);
+        payload.push_back(it.first & 0xff);
+        payload.push_back(it.first >> 8);
+        payload.push_back(length & 0xff);
+        payload.push_back(length >> 8);
+        payload.insert(payload.end(), it.second.begin(), it.second.begin() + length);
+    }
+
+    std::lock_guard<std::mutex> lk(broker->lock);
+    BrokerDevice *device = broker->get_device(advertisement.path, true);
+    if (device != nullptr) {
+        begin_update(device);
+        device->rssi = advertisement.rssi;
+        copy_string(device->address, sizeof(device->address),
+            advertisement.address.c_str());
+        copy_string(device->name, sizeof(device->name),
+            advertisement.name.c_str());
+        end_update(device);
+    }
+    broker->write_record((uint16_t) BrokerRecordType::ADVERTISEMENT,
+        advertisement.path, advertisement.rssi, payload.data(), payload.size());
+}
+
+void BluetoothBroker::notification_callback(
+    BluetoothGattCharacteristic &characteristic,
+    std::shared_ptr<const std::vector<unsigned char>> value, void *data)
+{
+    BluetoothBroker *broker = static_cast<BluetoothBroker *>(data);
+
+    std::lock_guard<std::mutex> lk(broker->lock);
+    broker->write_record((uint16_t) BrokerRecordType::NOTIFICATION,
+        characteristic.get_object_path(), 0, value->data(), value->size());
+}
+
+void BluetoothBroker::object_added_callback(void *manager, void *object,
+    void *data)
+{
+    BluetoothBroker *broker = static_cast<BluetoothBroker *>(data);
+    Device1 *device = object_peek_device1(OBJECT(object));
+
+    (void) manager;
+
+    if (device == NULL)
+        return;
+    std::lock_guard<std::mutex> lk(broker->lock);
+    broker->update_device(device);
+}
+
+void BluetoothBroker::object_removed_callback(void *manager, void *object,
+    void *data)
+{
+    BluetoothBroker *broker = static_cast<BluetoothBroker *>(data);
+
+    (void) manager;
+
+    std::lock_guard<std::mutex> lk(broker->lock);
+    broker->remove_device(g_dbus_object_get_object_path(G_DBUS_OBJECT(object)));
+}
+
+/* Called from the control thread only, like all functions using clients
+ * and streams */
+bool BluetoothBroker::subscribe(const std::string &path)
+{
+    auto it = streams.find(path);
+    if (it != streams.end()) {
+        it->second.clients++;
+        return true;
+    }
+
+    GDBusInterface *interface = g_dbus_object_manager_get_interface(
+        gdbus_manager, path.c_str(), "org.bluez.GattCharacteristic1");
+    if (interface == NULL)
+        return false;
+
+    BluetoothGattCharacteristic characteristic(GATT_CHARACTERISTIC1(interface));
+    g_object_unref(interface);
+
+    unsigned int id = characteristic.subscribe(notification_callback, this);
+    if (id == 0)
+        return false;
+    streams[path] = Stream{id, 1};
+    return true;
+}
+
+bool BluetoothBroker::unsubscribe(const std::string &path)
+{
+    auto it = streams.find(path);
+    if (it == streams.end())
+        return false;
+
+    if (--it->second.clients == 0) {
+        GDBusInterface *interface = g_dbus_object_manager_get_interface(
+            gdbus_manager, path.c_str(), "org.bluez.GattCharacteristic1");
+        if (interface != NULL) {
+            BluetoothGattCharacteristic characteristic(GATT_CHARACTERISTIC1(interface));
+            characteristic.unsubscribe(it->second.id);
+            g_object_unref(interface);
+        }
+        streams.erase(it);
+    }
+    return true;
+}
+
+void BluetoothBroker::release(Client &client)
+{
+    for (auto &path : client.subscriptions)
+        unsubscribe(path);
+    client.subscriptions.clear();
+
+    if (client.discovery != 0) {
+        BluetoothManager::get_bluetooth_manager()->close_discovery_session(
+            client.discovery);
+        client.discovery = 0;
+    }
+}
+
+std::string BluetoothBroker::handle_request(Client &client,
+    const std::string &request)
+{
+    size_t space = request.find(' ');
+    std::string command = request.substr(0, space);
+    std::string path = space == std::string::npos ? "" : request.substr(space + 1);
+    bool result = false;
+
+    if (command == "subscribe") {
+        result = subscribe(path);
+        if (result)
+            client.subscriptions.push_back(path);
+    } else if (command == "unsubscribe") {
+        auto it = std::find(client.subscriptions.begin(),
+            client.subscriptions.end(), path);
+        if (it != client.subscriptions.end()) {
+            client.subscriptions.erase(it);
+            result = unsubscribe(path);
+        }
+    } else if (command == "start-discovery") {
+        if (client.discovery == 0)
+            client.discovery = BluetoothManager::get_bluetooth_manager()->
+                open_discovery_session();
+        result = client.discovery != 0;
+    } else if (command == "stop-discovery") {
+        result = client.discovery != 0;
+        if (result)
+            BluetoothManager::get_bluetooth_manager()->close_discovery_session(
+                client.discovery);
+        client.discovery = 0;
+    } else if (command == "connect" || command == "disconnect") {
+        /* Connecting may take until the D-Bus timeout, so the reply is
+         * sent once the call completes, see send_completions(). Clients
+         * wait for each reply, so replies to a client stay in order. */
+        GDBusInterface *interface = g_dbus_object_manager_get_interface(
+            gdbus_manager, path.c_str(), "org.bluez.Device1");
+        if (interface != NULL) {
+            g_dbus_proxy_call(G_DBUS_PROXY(interface),
+                command == "connect" ? "Connect" : "Disconnect", NULL,
+                G_DBUS_CALL_FLAGS_NONE, -1, NULL, call_callback,
+                new BrokerCall{completions, client.id});
+            g_object_unref(interface);
+            return std::string();
+        }
+    }
+
+    return result ? "ok" : "error";
+}
+
+void BluetoothBroker::send_completions()
+{
+    std::vector<std::pair<unsigned int, bool>> results;
+    uint64_t count;
+
+    if (read(completions->fd, &count, sizeof(count)) != sizeof(count))
+        return;
+    {
+        std::lock_guard<std::mutex> lk(completions->lock);
+        results.swap(completions->results);
+    }
+
+    /* Clients which left meanwhile are not found */
+    for (auto &result : results) {
+        auto client = std::find_if(clients.begin(), clients.end(),
+            [&result](const Client &client) {
+                return client.id == result.first;
+            });
+        if (client == clients.end())
+            continue;
+
+        std::string reply = result.second ? "ok" : "error";
+        if (send(client->fd, reply.data(), reply.size(), MSG_NOSIGNAL) ==
+            (ssize_t) reply.size())
+            continue;
+        release(*client);
+        close(client->fd);
+        clients.erase(client);
+    }
+}
+
+void BluetoothBroker::control_loop()
+{
+    std::vector<struct pollfd> fds;
+    char buffer[512];
+
+    while (true) {
+        fds.clear();
+        fds.push_back({stop_fd, POLLIN, 0});
+        fds.push_back({listen_fd, POLLIN, 0});
+        fds.push_back({completions->fd, POLLIN, 0});
+        for (auto &client : clients)
+            fds.push_back({client.fd, POLLIN, 0});
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            g_printerr("Error: broker poll failed: %s\n", strerror(errno));
+            return;
+        }
+
+        if (fds[0].revents)
+            return;
+
+        /* Clients are handled before the list changes */
+        for (size_t i = clients.size(); i-- > 0;) {
+            if (fds[i + 3].revents == 0)
+                continue;
+
+            ssize_t n = recv(clients[i].fd, buffer, sizeof(buffer) - 1, 0);
+            if (n > 0) {
+                std::string reply = handle_request(clients[i],
+                    std::string(buffer, n));
+                if (reply.empty())
+                    continue;
+                if (send(clients[i].fd, reply.data(), reply.size(),
+                    MSG_NOSIGNAL) == (ssize_t) reply.size())
+                    continue;
+            }
+
+            release(clients[i]);
+            close(clients[i].fd);
+            clients.erase(clients.begin() + i);
+        }
+
+        if (fds[2].revents)
+            send_completions();
+
+        if (fds[1].revents) {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (++last_client_id == 0)
+                ++last_client_id;
+            if (fd >= 0)
+                clients.push_back(Client{last_client_id, fd,
+                    std::vector<std::string>(), 0});
+        }
+    }
+}
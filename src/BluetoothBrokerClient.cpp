@@ -0,0 +1,270 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tinyb_broker.hpp"
+#include "BluetoothBroker.hpp"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace tinyb;
+
+BluetoothBrokerClient::BluetoothBrokerClient(const std::string &name) :
+    socket_fd(-1), base(nullptr), size(0), header(nullptr), tail(0), lost(0)
+{
+    std::string memory_path = broker_memory_path(name);
+    int fd = open(memory_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + memory_path + ": " +
+            strerror(errno));
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(BrokerHeader)) {
+        size = st.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+        throw std::runtime_error("Cannot map " + memory_path);
+    base = (const unsigned char *) map;
+    header = reinterpret_cast<const BrokerHeader *>(base);
+
+    bool valid = memcmp(header->magic, BROKER_MAGIC, sizeof(header->magic)) == 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid && header->version == BROKER_VERSION &&
+        header->devices_offset + header->device_capacity * sizeof(BrokerDevice) <=
+            header->ring_offset &&
+        header->ring_offset + header->ring_size <= size;
+    if (!valid) {
+        munmap((void *) base, size);
+        throw std::runtime_error(memory_path + " is not a tinyb broker");
+    }
+
+    std::string socket_path = broker_socket_path(name);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0 ||
+        ::connect(socket_fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        int error = errno;
+        if (socket_fd >= 0)
+            close(socket_fd);
+        munmap((void *) base, size);
+        throw std::runtime_error("Cannot connect to " + socket_path + ": " +
+            strerror(error));
+    }
+
+    tail = header->ring_head.load(std::memory_order_acquire);
+}
+
+BluetoothBrokerClient::~BluetoothBrokerClient()
+{
+    close(socket_fd);
+    munmap((void *) base, size);
+}
+
+std::vector<BluetoothBrokerDevice> BluetoothBrokerClient::get_devices()
+{
+    std::vector<BluetoothBrokerDevice> result;
+    const BrokerDevice *devices = reinterpret_cast<const BrokerDevice *>(
+        base + header->devices_offset);
+    uint32_t count = std::min(header->device_count.load(std::memory_order_acquire),
+        header->device_capacity);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const BrokerDevice &entry = devices[i];
+        uint32_t flags, sequence;
+        int16_t rssi;
+        int64_t updated;
+        char path[sizeof(entry.path)];
+        char address[sizeof(entry.address)];
+        char name[sizeof(entry.name)];
+
+        /* Retry while the broker updates the entry */
+        do {
+            while ((sequence = entry.sequence.load(std::memory_order_acquire)) & 1)
+                sched_yield();
+            flags = entry.flags;
+            rssi = entry.rssi;
+            updated = entry.updated;
+            memcpy(path, entry.path, sizeof(path));
+            memcpy(address, entry.address, sizeof(address));
+            memcpy(name, entry.name, sizeof(name));
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while (entry.sequence.load(std::memory_order_relaxed) != sequence);
+
+        if (!(flags & BROKER_DEVICE_PRESENT))
+            continue;
+
+        path[sizeof(path) - 1] = '\0';
+        address[sizeof(address) - 1] = '\0';
+        name[sizeof(name) - 1] = '\0';
+
+        BluetoothBrokerDevice device;
+        device.path = path;
+        device.address = address;
+        device.name = name;
+        device.rssi = rssi;
+        device.connected = flags & BROKER_DEVICE_CONNECTED;
+        device.paired = flags & BROKER_DEVICE_PAIRED;
+        device.trusted = flags & BROKER_DEVICE_TRUSTED;
+        device.updated = updated;
+        result.push_back(std::move(device));
+    }
+
+    return result;
+}
+
+bool BluetoothBrokerClient::next(BluetoothBrokerEvent &event,
+    std::chrono::milliseconds timeout)
+{
+    const unsigned char *ring = base + header->ring_offset;
+    uint64_t ring_size = header->ring_size;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (true) {
+        uint32_t wake = header->ring_wake.load(std::memory_order_acquire);
+        uint64_t head = header->ring_head.load(std::memory_order_acquire);
+
+        if (tail == head) {
+            auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+                return false;
+
+            struct timespec ts;
+            ts.tv_sec = remaining.count() / 1000000000;
+            ts.tv_nsec = remaining.count() % 1000000000;
+            syscall(SYS_futex, reinterpret_cast<const uint32_t *>(&header->ring_wake),
+                FUTEX_WAIT, wake, &ts, NULL, 0);
+            continue;
+        }
+
+        if (head - tail > ring_size) {
+            lost++;
+            tail = head;
+            continue;
+        }
+
+        uint64_t offset = tail & (ring_size - 1);
+        uint64_t left = ring_size - offset;
+        if (left < sizeof(BrokerRecord)) {
+            tail += left;
+            continue;
+        }
+
+        BrokerRecord record;
+        memcpy(&record, ring + offset, sizeof(record));
+        bool valid = record.size >= sizeof(record) && record.size <= left &&
+            (record.type == BrokerRecordType::PADDING ||
+             sizeof(record) + record.path_size + record.data_size <= record.size);
+
+        if (valid && record.type != BrokerRecordType::PADDING) {
+            const unsigned char *payload = ring + offset + sizeof(record);
+            event.type = (BluetoothBrokerEvent::Type) record.type;
+            event.path.assign((const char *) payload, record.path_size);
+            event.rssi = record.rssi;
+            event.timestamp = record.timestamp;
+            event.data.assign(payload + record.path_size,
+                payload + record.path_size + record.data_size);
+        }
+
+        /* The record is only valid if the broker did not start overwriting
+         * it while it was copied */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t reserved = header->ring_reserved.load(std::memory_order_relaxed);
+        if (!valid || reserved - tail > ring_size) {
+            lost++;
+            tail = header->ring_head.load(std::memory_order_acquire);
+            continue;
+        }
+
+        tail += record.size;
+        if (record.type != BrokerRecordType::PADDING)
+            return true;
+    }
+}
+
+uint64_t BluetoothBrokerClient::get_lost()
+{
+    return lost;
+}
+
+bool BluetoothBrokerClient::request(const std::string &request)
+{
+    char reply[16];
+
+    if (send(socket_fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+        (ssize_t) request.size())
+        return false;
+
+    ssize_t n = recv(socket_fd, reply, sizeof(reply), 0);
+    return n == 2 && memcmp(reply, "ok", 2) == 0;
+}
+
+bool BluetoothBrokerClient::subscribe(const std::string &path)
+{
+    return request("subscribe " + path);
+}
+
+bool BluetoothBrokerClient::unsubscribe(const std::string &path)
+{
+    return request("unsubscribe " + path);
+}
+
+bool BluetoothBrokerClient::start_discovery()
+{
+    return request("start-discovery");
+}
+
+bool BluetoothBrokerClient::stop_discovery()
+{
+    return request("stop-discovery");
+}
+
+bool BluetoothBrokerClient::connect(const std::string &path)
+{
+    return request("connect " + path);
+}
+
+bool BluetoothBrokerClient::disconnect(const std::string &path)
+{
+    return request("disconnect " + path);
+}
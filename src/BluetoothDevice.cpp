@@ -24,12 +24,56 @@
 
 #include "generated-code.h"
 #include "tinyb_utils.hpp"
+#include "tinyb_bluez.hpp"
 #include "BluetoothDevice.hpp"
 #include "BluetoothGattService.hpp"
 #include "BluetoothManager.hpp"
 
+#include <mutex>
+
 using namespace tinyb;
 
+/* A pending wait for a boolean property of a device, see watch_state() */
+struct BluetoothDevice::StateWatch {
+    std::shared_ptr<BluetoothEvent> event;
+    Device1 *object;
+    std::string property;
+    bool value;
+    std::mutex lock;
+    gulong handler;
+    bool done;
+
+    bool get_state() const {
+        if (property == "paired")
+            return device1_get_paired(object);
+        return device1_get_connected(object);
+    }
+
+    /* Marks the watch as done and disconnects it, only the first caller
+     * wins */
+    bool finish() {
+        gulong id;
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            if (done)
+                return false;
+            done = true;
+            id = handler;
+            handler = 0;
+        }
+
+        if (id != 0)
+            g_signal_handler_disconnect(object, id);
+        BluetoothManager::get_bluetooth_manager()->remove_event_timeout(*event);
+        return true;
+    }
+
+    static void free(gpointer data, GClosure *closure) {
+        (void) closure;
+        delete static_cast<std::shared_ptr<StateWatch> *>(data);
+    }
+};
+
 std::string BluetoothDevice::get_class_name() const
 {
     return std::string("BluetoothDevice");
@@ -56,9 +100,9 @@ BluetoothDevice::BluetoothDevice(Device1 *object)
     g_object_ref(object);
 }
 
-BluetoothDevice::BluetoothDevice(const BluetoothDevice &object)
+BluetoothDevice::BluetoothDevice(const BluetoothDevice &object) :
+    BluetoothDevice(object.object)
 {
-    BluetoothDevice(object.object);
 }
 
 BluetoothDevice::~BluetoothDevice()
@@ -72,13 +116,14 @@ std::unique_ptr<BluetoothDevice> BluetoothDevice::make(Object *object,
 {
     Device1 *device;
     if((type == BluetoothType::NONE || type == BluetoothType::DEVICE) &&
-        (device = object_get_device1(object)) != NULL) {
+        (device = object_peek_device1(object)) != NULL) {
 
         std::unique_ptr<BluetoothDevice> p(new BluetoothDevice(device));
 
         if ((name == nullptr || *name == p->get_name()) &&
             (identifier == nullptr || *identifier == p->get_address()) &&
-            (parent == nullptr || *parent == p->get_adapter()))
+            (parent == nullptr || is_same_object(parent, BluetoothType::ADAPTER,
+                device1_get_adapter(device))))
             return p;
     }
 
@@ -107,93 +152,150 @@ std::vector<std::unique_ptr<BluetoothGattService>> BluetoothDevice::get_services
     return vector;
 }
 
+void BluetoothDevice::state_changed_callback(void *object, void *pspec, void *data)
+{
+    (void) pspec;
+    auto watch = *static_cast<std::shared_ptr<StateWatch> *>(data);
+
+    if (watch->event->is_canceled()) {
+        watch->finish();
+        return;
+    }
+
+    if (watch->get_state() != watch->value)
+        return;
+
+    if (watch->finish()) {
+        BluetoothDevice device(DEVICE1(object));
+        watch->event->execute_callback(device);
+    }
+}
+
+std::shared_ptr<BluetoothDevice::StateWatch> BluetoothDevice::watch_state(
+    const char *property, bool value, BluetoothCallback cb, void *data,
+    std::chrono::milliseconds timeout)
+{
+    auto watch = std::make_shared<StateWatch>();
+    if (cb == nullptr)
+        watch->event = std::shared_ptr<BluetoothEvent>(new BluetoothEvent(
+            BluetoothType::DEVICE, nullptr, nullptr, nullptr));
+    else
+        watch->event = std::shared_ptr<BluetoothEvent>(new BluetoothEvent(
+            BluetoothType::DEVICE, nullptr, nullptr, nullptr, true, cb, data));
+    watch->object = object;
+    watch->property = property;
+    watch->value = value;
+    watch->handler = 0;
+    watch->done = false;
+
+    std::string signal("notify::");
+    signal += property;
+
+    /* Subscribe before checking the current state, so a change happening in
+     * between is not missed */
+    {
+        std::lock_guard<std::mutex> lk(watch->lock);
+        watch->handler = g_signal_connect_data(object, signal.c_str(),
+            G_CALLBACK(state_changed_callback),
+            new std::shared_ptr<StateWatch>(watch),
+            StateWatch::free, (GConnectFlags) 0);
+    }
+
+    /* Canceling or expiring the event disconnects the handler right away,
+     * instead of on the next change of the property */
+    std::weak_ptr<StateWatch> weak(watch);
+    watch->event->set_cancel_hook([weak] {
+        auto w = weak.lock();
+        if (w != nullptr)
+            w->finish();
+    });
+
+    if (watch->get_state() == value && watch->finish())
+        watch->event->execute_callback(*this);
+    else
+        BluetoothManager::get_bluetooth_manager()->add_event_timeout(
+            watch->event, timeout);
+
+    return watch;
+}
+
+bool BluetoothDevice::wait_state(const char *property, bool value,
+    std::chrono::milliseconds timeout)
+{
+    auto watch = watch_state(property, value, nullptr, nullptr,
+        std::chrono::milliseconds::zero());
+    watch->event->wait(timeout);
+    watch->finish();
+
+    std::unique_ptr<BluetoothObject> result(watch->event->get_result());
+
+    return result != nullptr || watch->get_state() == value;
+}
+
+bool BluetoothDevice::wait_connected (std::chrono::milliseconds timeout)
+{
+    return wait_state("connected", true, timeout);
+}
+
+bool BluetoothDevice::wait_disconnected (std::chrono::milliseconds timeout)
+{
+    return wait_state("connected", false, timeout);
+}
+
+bool BluetoothDevice::wait_paired (std::chrono::milliseconds timeout)
+{
+    return wait_state("paired", true, timeout);
+}
+
+std::weak_ptr<BluetoothEvent> BluetoothDevice::wait_connected_async (
+    BluetoothCallback cb, void *data, std::chrono::milliseconds timeout)
+{
+    return watch_state("connected", true, cb, data, timeout)->event;
+}
+
+std::weak_ptr<BluetoothEvent> BluetoothDevice::wait_disconnected_async (
+    BluetoothCallback cb, void *data, std::chrono::milliseconds timeout)
+{
+    return watch_state("connected", false, cb, data, timeout)->event;
+}
+
+std::weak_ptr<BluetoothEvent> BluetoothDevice::wait_paired_async (
+    BluetoothCallback cb, void *data, std::chrono::milliseconds timeout)
+{
+    return watch_state("paired", true, cb, data, timeout)->event;
+}
+
 /* D-Bus method calls: */
 bool BluetoothDevice::disconnect ()
 {
-    GError *error = NULL;
-    bool result;
-    result = device1_call_disconnect_sync(
-        object,
-        NULL,
-        &error
-    );
-    if (error)
-        g_printerr("Error: %s\n", error->message);
-    return result;
+    return call_method<bluez::Device1::Disconnect>(G_DBUS_PROXY(object));
 }
 
 bool BluetoothDevice::connect ()
 {
-    GError *error = NULL;
-    bool result;
-    result = device1_call_connect_sync(
-        object,
-        NULL,
-        &error
-    );
-    if (error)
-        g_printerr("Error: %s\n", error->message);
-    return result;
+    return call_method<bluez::Device1::Connect>(G_DBUS_PROXY(object));
 }
 
 bool BluetoothDevice::connect_profile (
     const std::string &arg_UUID)
 {
-    GError *error = NULL;
-    bool result;
-    result = device1_call_connect_profile_sync(
-        object,
-        arg_UUID.c_str(),
-        NULL,
-        &error
-    );
-    if (error)
-        g_printerr("Error: %s\n", error->message);
-    return result;
+    return call_method<bluez::Device1::ConnectProfile>(G_DBUS_PROXY(object), arg_UUID);
 }
 
 bool BluetoothDevice::disconnect_profile (
     const std::string &arg_UUID)
 {
-    GError *error = NULL;
-    bool result;
-    result = device1_call_disconnect_profile_sync(
-        object,
-        arg_UUID.c_str(),
-        NULL,
-        &error
-    );
-    if (error)
-        g_printerr("Error: %s\n", error->message);
-    return result;
+    return call_method<bluez::Device1::DisconnectProfile>(G_DBUS_PROXY(object), arg_UUID);
 }
 
 bool BluetoothDevice::pair ()
 {
-    GError *error = NULL;
-    bool result;
-    result = device1_call_pair_sync(
-        object,
-        NULL,
-        &error
-    );
-    if (error)
-        g_printerr("Error: %s\n", error->message);
-    return result;
+    return call_method<bluez::Device1::Pair>(G_DBUS_PROXY(object));
 }
 
 bool BluetoothDevice::cancel_pairing ()
 {
-    GError *error = NULL;
-    bool result;
-    result = device1_call_cancel_pairing_sync(
-        object,
-        NULL,
-        &error
-    );
-    if (error)
-        g_printerr("Error: %s\n", error->message);
-    return result;
+    return call_method<bluez::Device1::CancelPairing>(G_DBUS_PROXY(object));
 }
 
 
@@ -301,14 +403,22 @@ std::unique_ptr<std::string> BluetoothDevice::get_modalias ()
 BluetoothAdapter BluetoothDevice::get_adapter ()
 {
     GError *error = NULL;
-
-    Adapter1 *adapter = adapter1_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SYSTEM,
-        G_DBUS_PROXY_FLAGS_NONE,
-        "org.bluez",
-        device1_get_adapter (object),
-        NULL,
-        &error);
+    Adapter1 *adapter;
+
+    /* Reuse the proxy of the object manager if the adapter is known to it */
+    GDBusInterface *interface = g_dbus_object_manager_get_interface(gdbus_manager,
+        device1_get_adapter (object), "org.bluez.Adapter1");
+
+    if (interface != NULL)
+        adapter = ADAPTER1(interface);
+    else
+        adapter = adapter1_proxy_new_for_bus_sync(
+            G_BUS_TYPE_SYSTEM,
+            G_DBUS_PROXY_FLAGS_NONE,
+            "org.bluez",
+            device1_get_adapter (object),
+            NULL,
+            &error);
 
    if (adapter == NULL) {
         std::string error_msg("Error occured while instantiating adapter: ");
@@ -317,5 +427,64 @@ BluetoothAdapter BluetoothDevice::get_adapter ()
         throw std::runtime_error(error_msg);
    }
 
-   return BluetoothAdapter(adapter);
+   BluetoothAdapter result(adapter);
+   g_object_unref(adapter);
+   return result;
+}
+
+static void fill_snapshot(Device1 *object, BluetoothDevice::Snapshot &snapshot)
+{
+    GDBusProxy *proxy = G_DBUS_PROXY(object);
+
+    snapshot.path = g_dbus_proxy_get_object_path(proxy);
+    read_property<bluez::Device1::Address>(proxy, snapshot.address);
+    if (!read_property<bluez::Device1::Name>(proxy, snapshot.name))
+        read_property<bluez::Device1::Alias>(proxy, snapshot.name);
+    read_property<bluez::Device1::Alias>(proxy, snapshot.alias);
+    read_property<bluez::Device1::Icon>(proxy, snapshot.icon);
+    read_property<bluez::Device1::Modalias>(proxy, snapshot.modalias);
+    read_property<bluez::Device1::Adapter>(proxy, snapshot.adapter);
+    read_property<bluez::Device1::UUIDs>(proxy, snapshot.uuids);
+    read_property<bluez::Device1::Class>(proxy, snapshot.device_class);
+    read_property<bluez::Device1::Appearance>(proxy, snapshot.appearance);
+    read_property<bluez::Device1::RSSI>(proxy, snapshot.rssi);
+    read_property<bluez::Device1::Connected>(proxy, snapshot.connected);
+    read_property<bluez::Device1::Paired>(proxy, snapshot.paired);
+    read_property<bluez::Device1::Trusted>(proxy, snapshot.trusted);
+    read_property<bluez::Device1::Blocked>(proxy, snapshot.blocked);
+    read_property<bluez::Device1::LegacyPairing>(proxy, snapshot.legacy_pairing);
+}
+
+BluetoothDevice::Snapshot BluetoothDevice::snapshot ()
+{
+    std::vector<Snapshot> snapshots;
+    take_snapshots(std::vector<Device1 *>{object}, snapshots, fill_snapshot);
+    return snapshots[0];
+}
+
+void BluetoothDevice::snapshot (
+    const std::vector<std::unique_ptr<BluetoothDevice>> &devices,
+    std::vector<Snapshot> &snapshots)
+{
+    std::vector<Device1 *> proxies;
+    proxies.reserve(devices.size());
+    for (auto &p : devices)
+        proxies.push_back(p->object);
+    take_snapshots(proxies, snapshots, fill_snapshot);
+}
+
+void BluetoothDevice::snapshot_all (
+    std::vector<Snapshot> &snapshots)
+{
+    std::vector<Device1 *> proxies;
+    GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
+
+    /* The list keeps the proxies alive until the snapshots are taken */
+    for (l = objects; l != NULL; l = l->next) {
+        Device1 *device = object_peek_device1(OBJECT(l->data));
+        if (device != NULL)
+            proxies.push_back(device);
+    }
+    take_snapshots(proxies, snapshots, fill_snapshot);
+    g_list_free_full(objects, g_object_unref);
 }
@@ -16,9 +16,11 @@ void BluetoothEvent::generic_callback(BluetoothObject &object, void *data)
 
 BluetoothEvent::BluetoothEvent(BluetoothType type, std::string *name,
     std::string *identifier, BluetoothObject *parent, bool execute_once,
-    BluetoothCallback cb, void *data)
+    BluetoothCallback cb, void *data, BluetoothExpiredCallback expired_cb)
 {
     canceled = false;
+    timeout_timer = 0;
+    this->expired_cb = expired_cb;
     this->type = type;
     if (name != nullptr)
     	this->name = new std::string(*name);
@@ -46,6 +48,10 @@ BluetoothEvent::BluetoothEvent(BluetoothType type, std::string *name,
 
 bool BluetoothEvent::execute_callback(BluetoothObject &object)
 {
+    /* A canceled event must not fire, it only needs to be removed */
+    if (canceled)
+        return true;
+
     if (has_callback()) {
         cb(object, data);
         cv.notify();
@@ -67,12 +73,47 @@ void BluetoothEvent::wait(std::chrono::milliseconds timeout)
 
 void BluetoothEvent::cancel()
 {
+    std::function<void()> hook;
+
+    canceled = true;
+
     BluetoothManager *manager = BluetoothManager::get_bluetooth_manager();
     manager->remove_event(*this);
+    manager->remove_event_timeout(*this);
+
+    {
+        std::lock_guard<std::mutex> lk(hook_lock);
+        hook.swap(cancel_hook);
+    }
+    if (hook)
+        hook();
 
     cv.notify();
 }
 
+void BluetoothEvent::expire()
+{
+    /* Only the first of the expiry and a cancel by the application wins */
+    bool was_canceled = canceled.exchange(true);
+
+    cancel();
+    if (!was_canceled && expired_cb != nullptr)
+        expired_cb(data);
+}
+
+void BluetoothEvent::set_cancel_hook(std::function<void()> hook)
+{
+    {
+        std::lock_guard<std::mutex> lk(hook_lock);
+        if (!canceled) {
+            cancel_hook = std::move(hook);
+            return;
+        }
+    }
+    if (hook)
+        hook();
+}
+
 BluetoothEvent::~BluetoothEvent()
 {
     if (name != nullptr)
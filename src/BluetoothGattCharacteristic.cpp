@@ -24,12 +24,97 @@
 
 #include "generated-code.h"
 #include "tinyb_utils.hpp"
+#include "tinyb_bluez.hpp"
+#include "tinyb_delivery.hpp"
+#include "tinyb_stats.hpp"
 #include "BluetoothGattCharacteristic.hpp"
 #include "BluetoothGattService.hpp"
 #include "BluetoothGattDescriptor.hpp"
 
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+
 using namespace tinyb;
 
+typedef std::shared_ptr<const std::vector<unsigned char>> NotificationValue;
+
+struct NotificationSubscriber {
+    unsigned int id;
+    std::shared_ptr<DeliveryQueue<NotificationValue>> queue;
+};
+
+/* StartNotify and StopNotify are called outside of sessions_lock, the
+ * session is STARTING or STOPPING meanwhile and other subscribers wait */
+enum class NotificationState {
+    STARTING,
+    ACTIVE,
+    STOPPING,
+    STOPPED
+};
+
+/* Notification session shared by all subscribers of one characteristic. The
+ * subscriber list is replaced, never modified, so delivery only needs the
+ * lock to take a reference to it. object, handler and state are guarded by
+ * sessions_lock; object is NULL once the characteristic was removed. */
+struct NotificationSession {
+    GattCharacteristic1 *object;
+    gulong handler;
+    NotificationState state;
+    std::mutex lock;
+    std::shared_ptr<const std::vector<NotificationSubscriber>> subscribers;
+    /* Stats entry of the characteristic, only used on the event thread
+     * once the handler is connected. Resolved again for each object, as
+     * the entry is reused once the characteristic is removed. */
+    StatsEntry *stats;
+    bool stats_resolved;
+
+    ~NotificationSession() {
+        if (object != NULL)
+            g_object_unref(object);
+    }
+};
+
+static std::mutex sessions_lock;
+static std::condition_variable sessions_cv;
+static std::map<std::string, std::shared_ptr<NotificationSession>> sessions;
+static std::map<unsigned int, std::string> subscriptions;
+static unsigned int last_subscription_id;
+
+static void free_session(gpointer data, GClosure *closure)
+{
+    (void) closure;
+    delete static_cast<std::shared_ptr<NotificationSession> *>(data);
+}
+
+static bool call_notify(GattCharacteristic1 *object, bool start)
+{
+    GError *error = NULL;
+    bool result;
+
+    if (start)
+        result = gatt_characteristic1_call_start_notify_sync(object, NULL, &error);
+    else
+        result = gatt_characteristic1_call_stop_notify_sync(object, NULL, &error);
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+    }
+    return result;
+}
+
+/* Disconnects a session from its proxy, must be called with sessions_lock
+ * held */
+static void detach_session(NotificationSession &session)
+{
+    if (session.object == NULL)
+        return;
+    g_signal_handler_disconnect(session.object, session.handler);
+    g_object_unref(session.object);
+    session.object = NULL;
+}
+
 std::string BluetoothGattCharacteristic::get_class_name() const
 {
     return std::string("BluetoothGattCharacteristic");
@@ -56,9 +141,9 @@ BluetoothGattCharacteristic::BluetoothGattCharacteristic(GattCharacteristic1 *ob
     g_object_ref(object);
 }
 
-BluetoothGattCharacteristic::BluetoothGattCharacteristic(const BluetoothGattCharacteristic &object)
+BluetoothGattCharacteristic::BluetoothGattCharacteristic(const BluetoothGattCharacteristic &object) :
+    BluetoothGattCharacteristic(object.object)
 {
-    BluetoothGattCharacteristic(object.object);
 }
 
 BluetoothGattCharacteristic::~BluetoothGattCharacteristic()
@@ -77,14 +162,15 @@ std::unique_ptr<BluetoothGattCharacteristic> BluetoothGattCharacteristic::make(
 {
     GattCharacteristic1 *characteristic;
     if((type == BluetoothType::NONE || type == BluetoothType::GATT_CHARACTERISTIC) &&
-        (characteristic = object_get_gatt_characteristic1(object)) != NULL) {
+        (characteristic = object_peek_gatt_characteristic1(object)) != NULL) {
 
         std::unique_ptr<BluetoothGattCharacteristic> p(
             new BluetoothGattCharacteristic(characteristic));
 
         if ((name == nullptr) &&
             (identifier == nullptr || *identifier == p->get_uuid()) &&
-            (parent == nullptr || *parent == p->get_service()))
+            (parent == nullptr || is_same_object(parent, BluetoothType::GATT_SERVICE,
+                gatt_characteristic1_get_service(characteristic))))
             return p;
     }
 
@@ -96,12 +182,15 @@ std::vector<unsigned char> BluetoothGattCharacteristic::read_value ()
 {
     GError *error = NULL;
     GBytes *result_gbytes;
+    gint64 started = g_get_monotonic_time();
     gatt_characteristic1_call_read_value_sync(
         object,
         &result_gbytes,
         NULL,
         &error
     );
+    stats_latency(StatsOperation::READ, g_get_monotonic_time() - started,
+        error != NULL);
     if (error)
         g_printerr("Error: %s\n", error->message);
 
@@ -121,12 +210,15 @@ bool BluetoothGattCharacteristic::write_value (
 
     GBytes *arg_value_gbytes = from_vector_to_gbytes(arg_value);
 
+    gint64 started = g_get_monotonic_time();
     result = gatt_characteristic1_call_write_value_sync(
         object,
         arg_value_gbytes,
         NULL,
         &error
     );
+    stats_latency(StatsOperation::WRITE, g_get_monotonic_time() - started,
+        error != NULL);
     if (error)
         g_printerr("Error: %s\n", error->message);
 
@@ -136,35 +228,448 @@ bool BluetoothGattCharacteristic::write_value (
     return result;
 }
 
-bool BluetoothGattCharacteristic::start_notify ()
+/* Minimum ATT MTU, and the header of ATT write operations */
+#define ATT_DEFAULT_MTU 23
+#define ATT_WRITE_HEADER 3
+
+struct Transfer {
+    GDBusProxy *proxy;
+    const std::vector<unsigned char> *value;
+    size_t chunk;
+    const gchar *type;
+    unsigned int window;
+    /* Offset of the next chunk to send, and up to which all were written */
+    size_t next;
+    size_t written;
+    /* Chunks written after one still in flight, by offset */
+    std::set<size_t> completed;
+    unsigned int in_flight;
+    bool failed;
+    /* Set once BlueZ rejected the options of WriteValue, chunks are then
+     * sent with the WriteValue(ay) of releases before 5.40 */
+    bool legacy;
+    /* Chunks to send again, by offset */
+    std::vector<size_t> retry;
+};
+
+struct TransferWrite {
+    Transfer *transfer;
+    size_t offset;
+    gint64 started;
+    bool legacy;
+};
+
+static void transfer_callback(GObject *source, GAsyncResult *res, gpointer data)
 {
+    std::unique_ptr<TransferWrite> write(static_cast<TransferWrite *>(data));
+    Transfer &transfer = *write->transfer;
     GError *error = NULL;
-    bool result;
-    result = gatt_characteristic1_call_start_notify_sync(
-        object,
-        NULL,
-        &error
-    );
-    if (error)
+
+    GVariant *result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source),
+        res, &error);
+    stats_latency(StatsOperation::WRITE, g_get_monotonic_time() - write->started,
+        error != NULL);
+    transfer.in_flight--;
+
+    if (error) {
+        if (!write->legacy &&
+            (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) ||
+            g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS))) {
+            g_error_free(error);
+            transfer.legacy = true;
+            transfer.retry.push_back(write->offset);
+            return;
+        }
         g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        transfer.failed = true;
+        return;
+    }
+    g_variant_unref(result);
+
+    /* Replies come in order, but this does not depend on it */
+    transfer.completed.insert(write->offset);
+    while (!transfer.completed.empty() &&
+        *transfer.completed.begin() == transfer.written) {
+        transfer.completed.erase(transfer.completed.begin());
+        transfer.written = std::min(transfer.written + transfer.chunk,
+            transfer.value->size());
+    }
+}
+
+static void transfer_send(Transfer &transfer)
+{
+    size_t offset = transfer.next;
+    if (!transfer.retry.empty()) {
+        offset = transfer.retry.back();
+        transfer.retry.pop_back();
+    }
+    size_t length = std::min(transfer.chunk, transfer.value->size() - offset);
+    if (offset == transfer.next)
+        transfer.next += length;
+
+    GVariant *chunk = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+        transfer.value->data() + offset, length, 1);
+    GVariant *parameters;
+    if (transfer.legacy) {
+        parameters = g_variant_new("(@ay)", chunk);
+    } else {
+        GVariantBuilder options;
+        g_variant_builder_init(&options, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&options, "{sv}", "type",
+            g_variant_new_string(transfer.type));
+        parameters = g_variant_new("(@aya{sv})", chunk, &options);
+    }
+
+    g_dbus_proxy_call(transfer.proxy, "WriteValue", parameters,
+        G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        transfer_callback,
+        new TransferWrite{&transfer, offset, g_get_monotonic_time(),
+            transfer.legacy});
+
+    transfer.in_flight++;
+}
+
+size_t BluetoothGattCharacteristic::transfer (
+    const std::vector<unsigned char> &value, size_t offset,
+    unsigned int window, BluetoothTransferCallback cb, void *data)
+{
+    if (offset >= value.size())
+        return value.size();
+
+    bool without_response = false;
+    for (auto &flag : get_flags())
+        if (flag == "write-without-response")
+            without_response = true;
+
+    Transfer transfer;
+    transfer.proxy = G_DBUS_PROXY(object);
+    transfer.value = &value;
+    transfer.chunk = get_mtu() - ATT_WRITE_HEADER;
+    transfer.type = without_response ? "command" : "request";
+    transfer.window = window > 0 ? window : 1;
+    transfer.next = offset;
+    transfer.written = offset;
+    transfer.in_flight = 0;
+    transfer.failed = false;
+    transfer.legacy = false;
+
+    /* The replies are dispatched on a private context, so this works from
+     * any thread, including the event thread */
+    GMainContext *context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+
+    gint64 started = g_get_monotonic_time();
+    size_t reported = offset;
+
+    for (;;) {
+        while (!transfer.failed && transfer.in_flight < transfer.window &&
+            (!transfer.retry.empty() || transfer.next < value.size()))
+            transfer_send(transfer);
+        if (transfer.in_flight == 0)
+            break;
+
+        g_main_context_iteration(context, TRUE);
+
+        if (cb != nullptr && transfer.written != reported) {
+            reported = transfer.written;
+            gint64 elapsed = g_get_monotonic_time() - started;
+            BluetoothTransferProgress progress;
+            progress.offset = transfer.written;
+            progress.total = value.size();
+            progress.throughput = elapsed > 0 ?
+                (transfer.written - offset) * 1000000.0 / elapsed : 0;
+            cb(*this, progress, data);
+        }
+    }
+
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
+
+    return transfer.written;
+}
+
+uint16_t BluetoothGattCharacteristic::get_mtu ()
+{
+    /* Only exported by BlueZ 5.62 and later */
+    GVariant *mtu = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(object), "MTU");
+    uint16_t result = ATT_DEFAULT_MTU;
+
+    if (mtu != NULL) {
+        if (g_variant_is_of_type(mtu, G_VARIANT_TYPE_UINT16) &&
+            g_variant_get_uint16(mtu) > ATT_DEFAULT_MTU)
+            result = g_variant_get_uint16(mtu);
+        g_variant_unref(mtu);
+    }
     return result;
 }
 
+bool BluetoothGattCharacteristic::start_notify ()
+{
+    return call_notify(object, true);
+}
+
 bool BluetoothGattCharacteristic::stop_notify ()
 {
-    GError *error = NULL;
-    bool result;
-    result = gatt_characteristic1_call_stop_notify_sync(
-        object,
-        NULL,
-        &error
-    );
-    if (error)
-        g_printerr("Error: %s\n", error->message);
-    return result;
+    /* Ends the session, the next subscriber starts notifications again */
+    {
+        std::lock_guard<std::mutex> lk(sessions_lock);
+        auto it = sessions.find(get_object_path());
+        if (it != sessions.end() && it->second->object == object &&
+            it->second->state == NotificationState::ACTIVE)
+            it->second->state = NotificationState::STOPPED;
+    }
+    return call_notify(object, false);
+}
+
+void BluetoothGattCharacteristic::forget_session(const std::string &path)
+{
+    std::lock_guard<std::mutex> lk(sessions_lock);
+    auto it = sessions.find(path);
+    if (it == sessions.end())
+        return;
+
+    /* The proxy is dead, the subscribers are kept so that the next
+     * subscriber restarts notifications on the object BlueZ re-creates */
+    std::shared_ptr<NotificationSession> session = it->second;
+    detach_session(*session);
+    if (session->state == NotificationState::ACTIVE)
+        session->state = NotificationState::STOPPED;
+
+    bool empty;
+    {
+        std::lock_guard<std::mutex> slk(session->lock);
+        empty = session->subscribers->empty();
+    }
+    if (empty && session->state == NotificationState::STOPPED)
+        sessions.erase(it);
+}
+
+
+
+void BluetoothGattCharacteristic::value_changed_callback(void *object,
+    void *pspec, void *data)
+{
+    (void) pspec;
+    auto session = *static_cast<std::shared_ptr<NotificationSession> *>(data);
+    std::shared_ptr<const std::vector<NotificationSubscriber>> subscribers;
+
+    /* Stats may have been enabled after the object was bound */
+    if (!session->stats_resolved && stats_header != NULL) {
+        session->stats = stats_characteristic(
+            g_dbus_proxy_get_object_path(G_DBUS_PROXY(object)));
+        session->stats_resolved = true;
+    }
+    stats_notification(session->stats);
+
+    {
+        std::lock_guard<std::mutex> lk(session->lock);
+        subscribers = session->subscribers;
+    }
+
+    if (subscribers->empty())
+        return;
+
+    GBytes *value_gbytes = const_cast<GBytes *>(
+        gatt_characteristic1_get_value(GATT_CHARACTERISTIC1(object)));
+    if (value_gbytes == NULL)
+        return;
+
+    /* A single buffer is shared by all subscribers */
+    std::shared_ptr<const std::vector<unsigned char>> value;
+    try {
+        value = std::make_shared<const std::vector<unsigned char>>(
+            from_gbytes_to_vector(value_gbytes));
+    } catch (std::exception &e) {
+        g_bytes_unref(value_gbytes);
+        return;
+    }
+    g_bytes_unref(value_gbytes);
+
+    for (auto &subscriber : *subscribers)
+        subscriber.queue->offer(value);
+}
+
+unsigned int BluetoothGattCharacteristic::subscribe (
+    BluetoothNotificationCallback cb, void *data,
+    const BluetoothDeliveryPolicy &policy)
+{
+    if (cb == nullptr)
+        throw std::runtime_error("Notification callback must not be null");
+
+    std::string path = get_object_path();
+    std::unique_lock<std::mutex> lk(sessions_lock);
+    std::shared_ptr<NotificationSession> session;
+
+    for (;;) {
+        auto it = sessions.find(path);
+        if (it != sessions.end()) {
+            session = it->second;
+        } else {
+            session = std::make_shared<NotificationSession>();
+            session->object = NULL;
+            session->handler = 0;
+            session->state = NotificationState::STOPPED;
+            session->subscribers =
+                std::make_shared<const std::vector<NotificationSubscriber>>();
+            sessions[path] = session;
+        }
+
+        if (session->state == NotificationState::STARTING ||
+            session->state == NotificationState::STOPPING) {
+            sessions_cv.wait(lk);
+            continue;
+        }
+        if (session->state == NotificationState::ACTIVE &&
+            session->object == object)
+            break;
+
+        /* New, stopped, or BlueZ re-created the characteristic */
+        detach_session(*session);
+        session->object = object;
+        g_object_ref(object);
+        session->stats = NULL;
+        session->stats_resolved = false;
+        session->handler = g_signal_connect_data(object, "notify::value",
+            G_CALLBACK(value_changed_callback),
+            new std::shared_ptr<NotificationSession>(session),
+            free_session, (GConnectFlags) 0);
+        session->state = NotificationState::STARTING;
+
+        lk.unlock();
+        bool started = start_notify();
+        lk.lock();
+
+        sessions_cv.notify_all();
+        if (started) {
+            session->state = NotificationState::ACTIVE;
+            break;
+        }
+
+        session->state = NotificationState::STOPPED;
+        detach_session(*session);
+        bool empty;
+        {
+            std::lock_guard<std::mutex> slk(session->lock);
+            empty = session->subscribers->empty();
+        }
+        auto current = sessions.find(path);
+        if (empty && current != sessions.end() && current->second == session)
+            sessions.erase(current);
+        return 0;
+    }
+
+    if (++last_subscription_id == 0)
+        ++last_subscription_id;
+    unsigned int id = last_subscription_id;
+
+    /* Deliveries may happen on another thread, so each subscription owns
+     * its characteristic */
+    std::shared_ptr<BluetoothGattCharacteristic> characteristic(clone());
+    auto queue = std::make_shared<DeliveryQueue<NotificationValue>>(policy,
+        [characteristic, cb, data](NotificationValue &value) {
+            cb(*characteristic, value, data);
+        });
+
+    {
+        std::lock_guard<std::mutex> slk(session->lock);
+        auto list = std::make_shared<std::vector<NotificationSubscriber>>(
+            *session->subscribers);
+        list->push_back(NotificationSubscriber{id, queue});
+        session->subscribers = list;
+    }
+    subscriptions[id] = path;
+
+    return id;
 }
 
+bool BluetoothGattCharacteristic::unsubscribe (unsigned int id)
+{
+    std::string path = get_object_path();
+    std::shared_ptr<DeliveryQueue<NotificationValue>> queue;
+    std::shared_ptr<NotificationSession> session;
+    GattCharacteristic1 *stop_object = NULL;
+
+    {
+        std::lock_guard<std::mutex> lk(sessions_lock);
+
+        auto sub = subscriptions.find(id);
+        if (sub == subscriptions.end() || sub->second != path)
+            return false;
+        subscriptions.erase(sub);
+
+        auto it = sessions.find(path);
+        if (it == sessions.end())
+            return false;
+        session = it->second;
+        bool last;
+        {
+            std::lock_guard<std::mutex> slk(session->lock);
+            auto list = std::make_shared<std::vector<NotificationSubscriber>>();
+            for (auto &subscriber : *session->subscribers)
+                if (subscriber.id != id)
+                    list->push_back(subscriber);
+                else
+                    queue = subscriber.queue;
+            session->subscribers = list;
+            last = list->empty();
+        }
+
+        /* A subscriber starting the session meanwhile keeps it */
+        if (last && session->state == NotificationState::ACTIVE) {
+            stop_object = GATT_CHARACTERISTIC1(g_object_ref(session->object));
+            session->state = NotificationState::STOPPING;
+        } else if (last && session->state == NotificationState::STOPPED) {
+            detach_session(*session);
+            sessions.erase(it);
+        }
+    }
+
+    /* Outside of the lock, StopNotify may block for long */
+    if (stop_object != NULL) {
+        call_notify(stop_object, false);
+        g_object_unref(stop_object);
+
+        std::lock_guard<std::mutex> lk(sessions_lock);
+        session->state = NotificationState::STOPPED;
+        bool empty;
+        {
+            std::lock_guard<std::mutex> slk(session->lock);
+            empty = session->subscribers->empty();
+        }
+        auto it = sessions.find(path);
+        if (empty && it != sessions.end() && it->second == session) {
+            detach_session(*session);
+            sessions.erase(it);
+        }
+        sessions_cv.notify_all();
+    }
+
+    /* Outside of the lock, the callback being waited for may subscribe */
+    if (queue != nullptr)
+        queue->stop();
 
+    return true;
+}
+
+uint64_t BluetoothGattCharacteristic::get_dropped (unsigned int id)
+{
+    std::lock_guard<std::mutex> lk(sessions_lock);
+
+    auto sub = subscriptions.find(id);
+    if (sub == subscriptions.end())
+        return 0;
+
+    auto it = sessions.find(sub->second);
+    if (it == sessions.end())
+        return 0;
+    std::shared_ptr<NotificationSession> session = it->second;
+    std::lock_guard<std::mutex> slk(session->lock);
+    for (auto &subscriber : *session->subscribers)
+        if (subscriber.id == id)
+            return subscriber.queue->get_dropped();
+    return 0;
+}
 
 /* D-Bus property accessors: */
 std::string BluetoothGattCharacteristic::get_uuid ()
@@ -175,14 +680,22 @@ std::string BluetoothGattCharacteristic::get_uuid ()
 BluetoothGattService BluetoothGattCharacteristic::get_service ()
 {
     GError *error = NULL;
-
-    GattService1 *service = gatt_service1_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SYSTEM,
-        G_DBUS_PROXY_FLAGS_NONE,
-        "org.bluez",
-        gatt_characteristic1_get_service (object),
-        NULL,
-        &error);
+    GattService1 *service;
+
+    /* Reuse the proxy of the object manager if the service is known to it */
+    GDBusInterface *interface = g_dbus_object_manager_get_interface(gdbus_manager,
+        gatt_characteristic1_get_service (object), "org.bluez.GattService1");
+
+    if (interface != NULL)
+        service = GATT_SERVICE1(interface);
+    else
+        service = gatt_service1_proxy_new_for_bus_sync(
+            G_BUS_TYPE_SYSTEM,
+            G_DBUS_PROXY_FLAGS_NONE,
+            "org.bluez",
+            gatt_characteristic1_get_service (object),
+            NULL,
+            &error);
 
     if (service == nullptr) {
         std::string error_msg("Error occured while instantiating service: ");
@@ -191,7 +704,9 @@ BluetoothGattService BluetoothGattCharacteristic::get_service ()
         throw std::runtime_error(error_msg);
     }
 
-    return BluetoothGattService(service);
+    BluetoothGattService result(service);
+    g_object_unref(service);
+    return result;
 }
 
 std::vector<unsigned char> BluetoothGattCharacteristic::get_value ()
@@ -229,6 +744,23 @@ std::vector<std::string> BluetoothGattCharacteristic::get_flags ()
 std::vector<std::unique_ptr<BluetoothGattDescriptor>> BluetoothGattCharacteristic::get_descriptors ()
 {
     std::vector<std::unique_ptr<BluetoothGattDescriptor>> vector;
+    const gchar * const *paths = gatt_characteristic1_get_descriptors (object);
+
+    /* Resolve the children directly when BlueZ exposes their paths */
+    if (paths != NULL) {
+        for (int i = 0; paths[i] != NULL; i++) {
+            GDBusObject *child = g_dbus_object_manager_get_object(gdbus_manager, paths[i]);
+            if (child == NULL)
+                continue;
+
+            auto p = BluetoothGattDescriptor::make(OBJECT(child));
+            if (p != nullptr)
+                vector.push_back(std::move(p));
+            g_object_unref(child);
+        }
+        return vector;
+    }
+
     GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
 
     for (l = objects; l != NULL; l = l->next) {
@@ -239,7 +771,37 @@ std::vector<std::unique_ptr<BluetoothGattDescriptor>> BluetoothGattCharacteristi
         if (p != nullptr)
             vector.push_back(std::move(p));
     }
+    g_list_free_full(objects, g_object_unref);
 
     return vector;
 }
 
+static void fill_snapshot(GattCharacteristic1 *object, BluetoothGattCharacteristic::Snapshot &snapshot)
+{
+    GDBusProxy *proxy = G_DBUS_PROXY(object);
+
+    snapshot.path = g_dbus_proxy_get_object_path(proxy);
+    read_property<bluez::GattCharacteristic1::UUID>(proxy, snapshot.uuid);
+    read_property<bluez::GattCharacteristic1::Service>(proxy, snapshot.service);
+    read_property<bluez::GattCharacteristic1::Value>(proxy, snapshot.value);
+    read_property<bluez::GattCharacteristic1::Flags>(proxy, snapshot.flags);
+    read_property<bluez::GattCharacteristic1::Notifying>(proxy, snapshot.notifying);
+}
+
+BluetoothGattCharacteristic::Snapshot BluetoothGattCharacteristic::snapshot ()
+{
+    std::vector<Snapshot> snapshots;
+    take_snapshots(std::vector<GattCharacteristic1 *>{object}, snapshots, fill_snapshot);
+    return snapshots[0];
+}
+
+void BluetoothGattCharacteristic::snapshot (
+    const std::vector<std::unique_ptr<BluetoothGattCharacteristic>> &characteristics,
+    std::vector<Snapshot> &snapshots)
+{
+    std::vector<GattCharacteristic1 *> proxies;
+    proxies.reserve(characteristics.size());
+    for (auto &p : characteristics)
+        proxies.push_back(p->object);
+    take_snapshots(proxies, snapshots, fill_snapshot);
+}
@@ -24,6 +24,8 @@
 
 #include "generated-code.h"
 #include "tinyb_utils.hpp"
+#include "tinyb_bluez.hpp"
+#include "tinyb_stats.hpp"
 #include "BluetoothGattDescriptor.hpp"
 #include "BluetoothGattCharacteristic.hpp"
 
@@ -55,9 +57,9 @@ BluetoothGattDescriptor::BluetoothGattDescriptor(GattDescriptor1 *object)
     g_object_ref(object);
 }
 
-BluetoothGattDescriptor::BluetoothGattDescriptor(const BluetoothGattDescriptor &object)
+BluetoothGattDescriptor::BluetoothGattDescriptor(const BluetoothGattDescriptor &object) :
+    BluetoothGattDescriptor(object.object)
 {
-    BluetoothGattDescriptor(object.object);
 }
 
 BluetoothGattDescriptor::~BluetoothGattDescriptor()
@@ -71,14 +73,15 @@ std::unique_ptr<BluetoothGattDescriptor> BluetoothGattDescriptor::make(
 {
     GattDescriptor1 *descriptor;
     if((type == BluetoothType::NONE || type == BluetoothType::GATT_DESCRIPTOR) &&
-        (descriptor = object_get_gatt_descriptor1(object)) != NULL) {
+        (descriptor = object_peek_gatt_descriptor1(object)) != NULL) {
 
         std::unique_ptr<BluetoothGattDescriptor> p(
             new BluetoothGattDescriptor(descriptor));
 
         if ((name == nullptr) &&
             (identifier == nullptr || *identifier == p->get_uuid()) &&
-            (parent == nullptr || *parent == p->get_characteristic()))
+            (parent == nullptr || is_same_object(parent, BluetoothType::GATT_CHARACTERISTIC,
+                gatt_descriptor1_get_characteristic(descriptor))))
             return p;
     }
 
@@ -97,12 +100,15 @@ std::vector<unsigned char> BluetoothGattDescriptor::read_value ()
 {
     GError *error = NULL;
     GBytes *result_gbytes;
+    gint64 started = g_get_monotonic_time();
     gatt_descriptor1_call_read_value_sync(
         object,
         &result_gbytes,
         NULL,
         &error
     );
+    stats_latency(StatsOperation::READ, g_get_monotonic_time() - started,
+        error != NULL);
     if (error)
         g_printerr("Error: %s\n", error->message);
 
@@ -122,12 +128,15 @@ bool BluetoothGattDescriptor::write_value (
 
     GBytes *arg_value_gbytes = from_vector_to_gbytes(arg_value);
 
+    gint64 started = g_get_monotonic_time();
     result = gatt_descriptor1_call_write_value_sync(
         object,
         arg_value_gbytes,
         NULL,
         &error
     );
+    stats_latency(StatsOperation::WRITE, g_get_monotonic_time() - started,
+        error != NULL);
     if (error)
         g_printerr("Error: %s\n", error->message);
 
@@ -148,14 +157,22 @@ std::string BluetoothGattDescriptor::get_uuid ()
 BluetoothGattCharacteristic BluetoothGattDescriptor::get_characteristic ()
 {
     GError *error = NULL;
-
-    GattCharacteristic1* characteristic = gatt_characteristic1_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SYSTEM,
-        G_DBUS_PROXY_FLAGS_NONE,
-        "org.bluez",
-        gatt_descriptor1_get_characteristic (object),
-        NULL,
-        &error);
+    GattCharacteristic1 *characteristic;
+
+    /* Reuse the proxy of the object manager if the characteristic is known to it */
+    GDBusInterface *interface = g_dbus_object_manager_get_interface(gdbus_manager,
+        gatt_descriptor1_get_characteristic (object), "org.bluez.GattCharacteristic1");
+
+    if (interface != NULL)
+        characteristic = GATT_CHARACTERISTIC1(interface);
+    else
+        characteristic = gatt_characteristic1_proxy_new_for_bus_sync(
+            G_BUS_TYPE_SYSTEM,
+            G_DBUS_PROXY_FLAGS_NONE,
+            "org.bluez",
+            gatt_descriptor1_get_characteristic (object),
+            NULL,
+            &error);
 
     if (characteristic == NULL) {
         std::string error_msg("Error occured while instantiating characteristic: ");
@@ -164,7 +181,9 @@ BluetoothGattCharacteristic BluetoothGattDescriptor::get_characteristic ()
         throw std::runtime_error(error_msg);
     }
 
-    return BluetoothGattCharacteristic(characteristic);
+    BluetoothGattCharacteristic result(characteristic);
+    g_object_unref(characteristic);
+    return result;
 }
 
 std::vector<unsigned char> BluetoothGattDescriptor::get_value ()
@@ -182,3 +201,31 @@ std::vector<unsigned char> BluetoothGattDescriptor::get_value ()
 
     return result;
 }
+
+static void fill_snapshot(GattDescriptor1 *object, BluetoothGattDescriptor::Snapshot &snapshot)
+{
+    GDBusProxy *proxy = G_DBUS_PROXY(object);
+
+    snapshot.path = g_dbus_proxy_get_object_path(proxy);
+    read_property<bluez::GattDescriptor1::UUID>(proxy, snapshot.uuid);
+    read_property<bluez::GattDescriptor1::Characteristic>(proxy, snapshot.characteristic);
+    read_property<bluez::GattDescriptor1::Value>(proxy, snapshot.value);
+}
+
+BluetoothGattDescriptor::Snapshot BluetoothGattDescriptor::snapshot ()
+{
+    std::vector<Snapshot> snapshots;
+    take_snapshots(std::vector<GattDescriptor1 *>{object}, snapshots, fill_snapshot);
+    return snapshots[0];
+}
+
+void BluetoothGattDescriptor::snapshot (
+    const std::vector<std::unique_ptr<BluetoothGattDescriptor>> &descriptors,
+    std::vector<Snapshot> &snapshots)
+{
+    std::vector<GattDescriptor1 *> proxies;
+    proxies.reserve(descriptors.size());
+    for (auto &p : descriptors)
+        proxies.push_back(p->object);
+    take_snapshots(proxies, snapshots, fill_snapshot);
+}
@@ -0,0 +1,673 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "generated-code.h"
+#include "tinyb_utils.hpp"
+#include "BluetoothGattServer.hpp"
+#include "BluetoothDevice.hpp"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+
+using namespace tinyb;
+
+typedef std::shared_ptr<const std::vector<unsigned char>> ValuePtr;
+
+/* The exported objects, with the ReadValue and WriteValue of BlueZ 5.40 and
+ * later, which take an options dictionary. The generated code follows the
+ * older revision, so it cannot be used here. */
+static const gchar server_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+    "    <method name='GetManagedObjects'>"
+    "      <arg name='objects' type='a{oa{sa{sv}}}' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.bluez.GattService1'>"
+    "    <property name='UUID' type='s' access='read'/>"
+    "    <property name='Primary' type='b' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.bluez.GattCharacteristic1'>"
+    "    <method name='ReadValue'>"
+    "      <arg name='options' type='a{sv}' direction='in'/>"
+    "      <arg name='value' type='ay' direction='out'/>"
+    "    </method>"
+    "    <method name='WriteValue'>"
+    "      <arg name='value' type='ay' direction='in'/>"
+    "      <arg name='options' type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <method name='StartNotify'/>"
+    "    <method name='StopNotify'/>"
+    "    <property name='UUID' type='s' access='read'/>"
+    "    <property name='Service' type='o' access='read'/>"
+    "    <property name='Flags' type='as' access='read'/>"
+    "    <property name='Value' type='ay' access='read'/>"
+    "    <property name='Notifying' type='b' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+static const char *const service_properties[] = {
+    "UUID", "Primary", NULL
+};
+
+static const char *const characteristic_properties[] = {
+    "UUID", "Service", "Flags", "Value", "Notifying", NULL
+};
+
+struct ServerService {
+    std::string path;
+    std::string uuid;
+    bool primary;
+    unsigned int characteristics;
+};
+
+struct ServerCharacteristic {
+    std::string path;
+    std::string uuid;
+    /* Path of the service */
+    std::string service;
+    std::vector<std::string> flags;
+    /* Current value, wrapping the buffer given to set_value() */
+    GBytes *value;
+    BluetoothGattWriteCallback cb;
+    void *data;
+    bool notifying;
+};
+
+struct ServerNotification {
+    std::string path;
+    GBytes *value;
+};
+
+struct BluetoothGattServer::State {
+    std::mutex lock;
+    std::string path;
+    GDBusConnection *connection;
+    /* Path of the adapter while registered */
+    std::string adapter;
+    std::map<unsigned int, ServerService> services;
+    std::map<unsigned int, ServerCharacteristic> characteristics;
+    /* Objects registered on the connection while registered */
+    std::vector<guint> registrations;
+    std::vector<ServerNotification> pending;
+    guint flush_source;
+};
+
+/* Identifies the service or characteristic of a registered object in its
+ * callbacks, it does not keep the server alive */
+struct ServerHandle {
+    std::weak_ptr<void> state;
+    unsigned int id;
+};
+
+static GDBusNodeInfo *server_info()
+{
+    /* Parsed once and never freed */
+    static GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(server_xml, NULL);
+    return info;
+}
+
+static void free_value(gpointer data)
+{
+    delete static_cast<ValuePtr *>(data);
+}
+
+/* A GBytes keeping the buffer alive instead of copying it */
+static GBytes *bytes_from_value(ValuePtr value)
+{
+    ValuePtr *holder = new ValuePtr(std::move(value));
+    return g_bytes_new_with_free_func((*holder)->data(), (*holder)->size(),
+        free_value, holder);
+}
+
+static GVariant *variant_from_bytes(GBytes *bytes)
+{
+    return g_variant_new_from_bytes(G_VARIANT_TYPE("ay"), bytes, TRUE);
+}
+
+static GVariant *service_property(const ServerService &service,
+    const std::string &name)
+{
+    if (name == "UUID")
+        return g_variant_new_string(service.uuid.c_str());
+    if (name == "Primary")
+        return g_variant_new_boolean(service.primary);
+    return NULL;
+}
+
+static GVariant *characteristic_property(
+    const ServerCharacteristic &characteristic, const std::string &name)
+{
+    if (name == "UUID")
+        return g_variant_new_string(characteristic.uuid.c_str());
+    if (name == "Service")
+        return g_variant_new_object_path(characteristic.service.c_str());
+    if (name == "Flags") {
+        std::vector<const gchar *> flags;
+        for (auto &flag : characteristic.flags)
+            flags.push_back(flag.c_str());
+        return g_variant_new_strv(flags.data(), flags.size());
+    }
+    if (name == "Value") {
+        if (characteristic.value != NULL)
+            return variant_from_bytes(characteristic.value);
+        GBytes *empty = g_bytes_new(NULL, 0);
+        GVariant *value = variant_from_bytes(empty);
+        g_bytes_unref(empty);
+        return value;
+    }
+    if (name == "Notifying")
+        return g_variant_new_boolean(characteristic.notifying);
+    return NULL;
+}
+
+/* Adds an object with a single interface to a GetManagedObjects reply */
+template <typename Object>
+static void add_managed_object(GVariantBuilder *objects, const std::string &path,
+    const char *interface, const char *const *names, const Object &object,
+    GVariant *(*property)(const Object &, const std::string &))
+{
+    GVariantBuilder properties, interfaces;
+
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+    for (; *names != NULL; names++)
+        g_variant_builder_add(&properties, "{sv}", *names, property(object, *names));
+
+    g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+    g_variant_builder_add(&interfaces, "{sa{sv}}", interface, &properties);
+    g_variant_builder_add(objects, "{oa{sa{sv}}}", path.c_str(), &interfaces);
+}
+
+void BluetoothGattServer::free_state(void *data)
+{
+    delete static_cast<std::weak_ptr<State> *>(data);
+}
+
+void BluetoothGattServer::free_handle(void *data)
+{
+    delete static_cast<ServerHandle *>(data);
+}
+
+int BluetoothGattServer::flush_callback(void *data)
+{
+    auto state = static_cast<std::weak_ptr<State> *>(data)->lock();
+    std::vector<ServerNotification> pending;
+    GDBusConnection *connection = NULL;
+
+    if (state == nullptr)
+        return G_SOURCE_REMOVE;
+
+    {
+        std::lock_guard<std::mutex> lk(state->lock);
+        pending.swap(state->pending);
+        state->flush_source = 0;
+        if (state->connection != NULL)
+            connection = G_DBUS_CONNECTION(g_object_ref(state->connection));
+    }
+
+    for (auto &notification : pending) {
+        if (connection != NULL) {
+            GVariantBuilder changed;
+            g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+            g_variant_builder_add(&changed, "{sv}", "Value",
+                variant_from_bytes(notification.value));
+
+            g_dbus_connection_emit_signal(connection, NULL,
+                notification.path.c_str(), "org.freedesktop.DBus.Properties",
+                "PropertiesChanged",
+                g_variant_new("(sa{sv}@as)", "org.bluez.GattCharacteristic1",
+                    &changed, g_variant_new_strv(NULL, 0)),
+                NULL);
+        }
+        g_bytes_unref(notification.value);
+    }
+
+    if (connection != NULL)
+        g_object_unref(connection);
+    return G_SOURCE_REMOVE;
+}
+
+void BluetoothGattServer::method_call(void *connection, const char *sender,
+    const char *path, const char *interface, const char *method,
+    void *parameters, void *invocation, void *data)
+{
+    ServerHandle *handle = static_cast<ServerHandle *>(data);
+    auto state = std::static_pointer_cast<State>(handle->state.lock());
+    GDBusMethodInvocation *call = G_DBUS_METHOD_INVOCATION(invocation);
+    std::string name = method;
+
+    (void) connection;
+    (void) sender;
+    (void) path;
+    (void) interface;
+
+    if (state == nullptr)
+        g_dbus_method_invocation_return_dbus_error(call,
+            "org.bluez.Error.Failed", "The application was destroyed");
+    else if (name == "GetManagedObjects")
+        get_managed_objects(*state, call);
+    else if (name == "ReadValue")
+        read_value(*state, handle->id, parameters, call);
+    else if (name == "WriteValue")
+        write_value(*state, handle->id, parameters, call);
+    else
+        set_notifying(*state, handle->id, call, name == "StartNotify");
+}
+
+void *BluetoothGattServer::get_property(void *connection, const char *sender,
+    const char *path, const char *interface, const char *property,
+    void *error, void *data)
+{
+    ServerHandle *handle = static_cast<ServerHandle *>(data);
+    auto state = std::static_pointer_cast<State>(handle->state.lock());
+    GVariant *result = NULL;
+
+    (void) connection;
+    (void) sender;
+    (void) path;
+
+    if (state != nullptr) {
+        std::lock_guard<std::mutex> lk(state->lock);
+        if (strcmp(interface, "org.bluez.GattService1") == 0) {
+            auto it = state->services.find(handle->id);
+            if (it != state->services.end())
+                result = service_property(it->second, property);
+        } else {
+            auto it = state->characteristics.find(handle->id);
+            if (it != state->characteristics.end())
+                result = characteristic_property(it->second, property);
+        }
+    }
+
+    if (result == NULL)
+        g_set_error(static_cast<GError **>(error), G_DBUS_ERROR,
+            G_DBUS_ERROR_UNKNOWN_PROPERTY, "Unknown property %s", property);
+    return result;
+}
+
+void BluetoothGattServer::get_managed_objects(State &state, void *invocation)
+{
+    GVariantBuilder objects;
+
+    g_variant_builder_init(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+    {
+        std::lock_guard<std::mutex> lk(state.lock);
+        for (auto &it : state.services)
+            add_managed_object(&objects, it.second.path,
+                "org.bluez.GattService1", service_properties, it.second,
+                service_property);
+        for (auto &it : state.characteristics)
+            add_managed_object(&objects, it.second.path,
+                "org.bluez.GattCharacteristic1", characteristic_properties,
+                it.second, characteristic_property);
+    }
+
+    g_dbus_method_invocation_return_value(G_DBUS_METHOD_INVOCATION(invocation),
+        g_variant_new("(a{oa{sa{sv}}})", &objects));
+}
+
+void BluetoothGattServer::read_value(State &state, unsigned int id,
+    void *parameters, void *invocation)
+{
+    GBytes *value = NULL;
+    guint16 offset = 0;
+
+    GVariant *options = g_variant_get_child_value(
+        static_cast<GVariant *>(parameters), 0);
+    g_variant_lookup(options, "offset", "q", &offset);
+    g_variant_unref(options);
+
+    {
+        std::lock_guard<std::mutex> lk(state.lock);
+        auto it = state.characteristics.find(id);
+        if (it != state.characteristics.end() && it->second.value != NULL)
+            value = g_bytes_ref(it->second.value);
+    }
+    if (value == NULL)
+        value = g_bytes_new(NULL, 0);
+
+    gsize size = g_bytes_get_size(value);
+    if (offset > size) {
+        g_bytes_unref(value);
+        g_dbus_method_invocation_return_dbus_error(
+            G_DBUS_METHOD_INVOCATION(invocation),
+            "org.bluez.Error.InvalidOffset", "Offset past the end of the value");
+        return;
+    }
+
+    /* The reply references the value instead of copying it */
+    GBytes *slice = g_bytes_new_from_bytes(value, offset, size - offset);
+    g_dbus_method_invocation_return_value(G_DBUS_METHOD_INVOCATION(invocation),
+        g_variant_new("(@ay)", variant_from_bytes(slice)));
+    g_bytes_unref(slice);
+    g_bytes_unref(value);
+}
+
+void BluetoothGattServer::write_value(State &state, unsigned int id,
+    void *parameters, void *invocation)
+{
+    std::shared_ptr<std::vector<unsigned char>> buffer;
+    BluetoothGattWriteCallback cb = nullptr;
+    void *cb_data = nullptr;
+    guint16 offset = 0;
+
+    GVariant *bytes = g_variant_get_child_value(
+        static_cast<GVariant *>(parameters), 0);
+    GVariant *options = g_variant_get_child_value(
+        static_cast<GVariant *>(parameters), 1);
+    g_variant_lookup(options, "offset", "q", &offset);
+    g_variant_unref(options);
+
+    gsize size;
+    const unsigned char *written = static_cast<const unsigned char *>(
+        g_variant_get_fixed_array(bytes, &size, 1));
+
+    {
+        std::lock_guard<std::mutex> lk(state.lock);
+        auto it = state.characteristics.find(id);
+        gsize current_size = 0;
+        const unsigned char *current = NULL;
+        if (it != state.characteristics.end() && it->second.value != NULL)
+            current = static_cast<const unsigned char *>(
+                g_bytes_get_data(it->second.value, &current_size));
+
+        /* The written bytes replace the value from offset on, as with
+         * the chunks of a long write */
+        if (it != state.characteristics.end() && offset <= current_size) {
+            buffer = std::make_shared<std::vector<unsigned char>>(current,
+                current + offset);
+            buffer->insert(buffer->end(), written, written + size);
+            if (it->second.value != NULL)
+                g_bytes_unref(it->second.value);
+            it->second.value = bytes_from_value(buffer);
+            cb = it->second.cb;
+            cb_data = it->second.data;
+        }
+    }
+    g_variant_unref(bytes);
+
+    if (buffer == nullptr) {
+        g_dbus_method_invocation_return_dbus_error(
+            G_DBUS_METHOD_INVOCATION(invocation),
+            "org.bluez.Error.InvalidOffset", "Offset past the end of the value");
+        return;
+    }
+    g_dbus_method_invocation_return_value(G_DBUS_METHOD_INVOCATION(invocation),
+        NULL);
+
+    if (cb != nullptr)
+        cb(id, *buffer, cb_data);
+}
+
+void BluetoothGattServer::set_notifying(State &state, unsigned int id,
+    void *invocation, bool notifying)
+{
+    {
+        std::lock_guard<std::mutex> lk(state.lock);
+        auto it = state.characteristics.find(id);
+        if (it != state.characteristics.end())
+            it->second.notifying = notifying;
+    }
+    g_dbus_method_invocation_return_value(G_DBUS_METHOD_INVOCATION(invocation),
+        NULL);
+}
+
+/* Must be called with state->lock held */
+bool BluetoothGattServer::export_objects(const std::shared_ptr<State> &state)
+{
+    static const GDBusInterfaceVTable vtable = {
+        (GDBusInterfaceMethodCallFunc) method_call,
+        (GDBusInterfaceGetPropertyFunc) get_property,
+        NULL,
+        { NULL },
+    };
+    struct Export {
+        std::string path;
+        const char *interface;
+        unsigned int id;
+    };
+    std::vector<Export> exports;
+
+    exports.push_back(Export{state->path, "org.freedesktop.DBus.ObjectManager", 0});
+    for (auto &it : state->services)
+        exports.push_back(Export{it.second.path, "org.bluez.GattService1", it.first});
+    for (auto &it : state->characteristics)
+        exports.push_back(Export{it.second.path, "org.bluez.GattCharacteristic1",
+            it.first});
+
+    for (auto &object : exports) {
+        GError *error = NULL;
+        guint registration = g_dbus_connection_register_object(state->connection,
+            object.path.c_str(),
+            g_dbus_node_info_lookup_interface(server_info(), object.interface),
+            &vtable, new ServerHandle{state, object.id}, free_handle, &error);
+        if (registration == 0) {
+            g_printerr("Error: %s\n", error->message);
+            g_error_free(error);
+            return false;
+        }
+        state->registrations.push_back(registration);
+    }
+    return true;
+}
+
+/* Must be called with state->lock held */
+void BluetoothGattServer::unexport_objects(State &state)
+{
+    for (guint registration : state.registrations)
+        g_dbus_connection_unregister_object(state.connection, registration);
+    state.registrations.clear();
+}
+
+BluetoothGattServer::BluetoothGattServer(const std::string &path) :
+    state(std::make_shared<State>())
+{
+    /* Exported on the connection of the manager */
+    BluetoothManager::get_bluetooth_manager();
+
+    state->path = path;
+    state->connection = NULL;
+    state->flush_source = 0;
+}
+
+BluetoothGattServer::~BluetoothGattServer()
+{
+    unregister_application();
+
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    if (state->flush_source != 0)
+        g_source_remove(state->flush_source);
+    for (auto &notification : state->pending)
+        g_bytes_unref(notification.value);
+    state->pending.clear();
+
+    for (auto &characteristic : state->characteristics)
+        if (characteristic.second.value != NULL)
+            g_bytes_unref(characteristic.second.value);
+    state->characteristics.clear();
+}
+
+unsigned int BluetoothGattServer::add_service(const std::string &uuid,
+    bool primary)
+{
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    if (!state->adapter.empty())
+        throw std::runtime_error("Services must be added before registering");
+
+    unsigned int id = state->services.size() + 1;
+    ServerService service;
+    service.path = state->path + "/service" + std::to_string(id);
+    service.uuid = uuid;
+    service.primary = primary;
+    service.characteristics = 0;
+
+    state->services[id] = service;
+    return id;
+}
+
+unsigned int BluetoothGattServer::add_characteristic(unsigned int service,
+    const std::string &uuid, const std::vector<std::string> &flags,
+    BluetoothGattWriteCallback cb, void *data)
+{
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    if (!state->adapter.empty())
+        throw std::runtime_error("Characteristics must be added before registering");
+
+    auto s = state->services.find(service);
+    if (s == state->services.end())
+        throw std::runtime_error("Unknown service " + std::to_string(service));
+
+    unsigned int id = state->characteristics.size() + 1;
+    ServerCharacteristic characteristic;
+    characteristic.path = s->second.path + "/char" +
+        std::to_string(++s->second.characteristics);
+    characteristic.uuid = uuid;
+    characteristic.service = s->second.path;
+    characteristic.flags = flags;
+    characteristic.value = NULL;
+    characteristic.cb = cb;
+    characteristic.data = data;
+    characteristic.notifying = false;
+
+    state->characteristics[id] = characteristic;
+    return id;
+}
+
+bool BluetoothGattServer::set_value(unsigned int characteristic,
+    std::shared_ptr<const std::vector<unsigned char>> value)
+{
+    GBytes *bytes = bytes_from_value(std::move(value));
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    auto it = state->characteristics.find(characteristic);
+    if (it == state->characteristics.end()) {
+        g_bytes_unref(bytes);
+        return false;
+    }
+
+    if (it->second.value != NULL)
+        g_bytes_unref(it->second.value);
+    it->second.value = bytes;
+
+    if (!it->second.notifying || state->connection == NULL)
+        return false;
+
+    state->pending.push_back(ServerNotification{it->second.path, g_bytes_ref(bytes)});
+    if (state->flush_source == 0)
+        state->flush_source = g_idle_add_full(G_PRIORITY_DEFAULT, flush_callback,
+            new std::weak_ptr<State>(state), free_state);
+    return true;
+}
+
+bool BluetoothGattServer::get_notifying(unsigned int characteristic)
+{
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    auto it = state->characteristics.find(characteristic);
+    return it != state->characteristics.end() && it->second.notifying;
+}
+
+bool BluetoothGattServer::register_application(BluetoothAdapter &adapter)
+{
+    GError *error = NULL;
+    GDBusConnection *connection = g_dbus_object_manager_client_get_connection(
+        G_DBUS_OBJECT_MANAGER_CLIENT(gdbus_manager));
+    std::string adapter_path = adapter.get_object_path();
+
+    {
+        std::lock_guard<std::mutex> lk(state->lock);
+        if (!state->adapter.empty())
+            return false;
+        state->connection = G_DBUS_CONNECTION(g_object_ref(connection));
+        if (!export_objects(state)) {
+            unexport_objects(*state);
+            g_object_unref(state->connection);
+            state->connection = NULL;
+            return false;
+        }
+        state->adapter = adapter_path;
+    }
+
+    GVariant *result = g_dbus_connection_call_sync(connection, "org.bluez",
+        adapter_path.c_str(), "org.bluez.GattManager1", "RegisterApplication",
+        g_variant_new("(o@a{sv})", state->path.c_str(),
+            g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0)),
+        NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+
+        std::lock_guard<std::mutex> lk(state->lock);
+        unexport_objects(*state);
+        state->adapter.clear();
+        g_object_unref(state->connection);
+        state->connection = NULL;
+        return false;
+    }
+
+    g_variant_unref(result);
+    return true;
+}
+
+bool BluetoothGattServer::unregister_application()
+{
+    GError *error = NULL;
+    GDBusConnection *connection;
+    std::string adapter_path;
+
+    {
+        std::lock_guard<std::mutex> lk(state->lock);
+        if (state->adapter.empty())
+            return false;
+        adapter_path.swap(state->adapter);
+        connection = G_DBUS_CONNECTION(g_object_ref(state->connection));
+        for (auto &characteristic : state->characteristics)
+            characteristic.second.notifying = false;
+    }
+
+    GVariant *result = g_dbus_connection_call_sync(connection, "org.bluez",
+        adapter_path.c_str(), "org.bluez.GattManager1", "UnregisterApplication",
+        g_variant_new("(o)", state->path.c_str()),
+        NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+    } else
+        g_variant_unref(result);
+
+    {
+        std::lock_guard<std::mutex> lk(state->lock);
+        unexport_objects(*state);
+        g_object_unref(state->connection);
+        state->connection = NULL;
+    }
+    g_object_unref(connection);
+    return true;
+}
@@ -24,6 +24,7 @@
 
 #include "generated-code.h"
 #include "tinyb_utils.hpp"
+#include "tinyb_bluez.hpp"
 #include "BluetoothGattService.hpp"
 #include "BluetoothGattCharacteristic.hpp"
 #include "BluetoothDevice.hpp"
@@ -56,9 +57,9 @@ BluetoothGattService::BluetoothGattService(GattService1 *object)
     g_object_ref(object);
 }
 
-BluetoothGattService::BluetoothGattService(const BluetoothGattService &object)
+BluetoothGattService::BluetoothGattService(const BluetoothGattService &object) :
+    BluetoothGattService(object.object)
 {
-    BluetoothGattService(object.object);
 }
 
 BluetoothGattService::~BluetoothGattService()
@@ -72,14 +73,15 @@ std::unique_ptr<BluetoothGattService> BluetoothGattService::make(
 {
     GattService1 *service;
     if((type == BluetoothType::NONE || type == BluetoothType::GATT_SERVICE) &&
-        (service = object_get_gatt_service1(object)) != NULL) {
+        (service = object_peek_gatt_service1(object)) != NULL) {
 
         std::unique_ptr<BluetoothGattService> p(
             new BluetoothGattService(service));
 
         if ((name == nullptr) &&
             (identifier == nullptr || *identifier == p->get_uuid()) &&
-            (parent == nullptr || *parent == p->get_device()))
+            (parent == nullptr || is_same_object(parent, BluetoothType::DEVICE,
+                gatt_service1_get_device(service))))
             return p;
     }
 
@@ -100,14 +102,22 @@ std::string BluetoothGattService::get_uuid ()
 BluetoothDevice BluetoothGattService::get_device ()
 {
     GError *error = NULL;
-
-    Device1 *device = device1_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SYSTEM,
-        G_DBUS_PROXY_FLAGS_NONE,
-        "org.bluez",
-        gatt_service1_get_device (object),
-        NULL,
-        &error);
+    Device1 *device;
+
+    /* Reuse the proxy of the object manager if the device is known to it */
+    GDBusInterface *interface = g_dbus_object_manager_get_interface(gdbus_manager,
+        gatt_service1_get_device (object), "org.bluez.Device1");
+
+    if (interface != NULL)
+        device = DEVICE1(interface);
+    else
+        device = device1_proxy_new_for_bus_sync(
+            G_BUS_TYPE_SYSTEM,
+            G_DBUS_PROXY_FLAGS_NONE,
+            "org.bluez",
+            gatt_service1_get_device (object),
+            NULL,
+            &error);
 
     if (device == nullptr) {
         std::string error_msg("Error occured while instantiating device: ");
@@ -116,7 +126,9 @@ BluetoothDevice BluetoothGattService::get_device ()
         throw std::runtime_error(error_msg);
     }
 
-    return BluetoothDevice(device);
+    BluetoothDevice result(device);
+    g_object_unref(device);
+    return result;
 }
 
 bool BluetoothGattService::get_primary ()
@@ -127,6 +139,23 @@ bool BluetoothGattService::get_primary ()
 std::vector<std::unique_ptr<BluetoothGattCharacteristic>> BluetoothGattService::get_characteristics ()
 {
     std::vector<std::unique_ptr<BluetoothGattCharacteristic>> vector;
+    const gchar * const *paths = gatt_service1_get_characteristics (object);
+
+    /* Resolve the children directly when BlueZ exposes their paths */
+    if (paths != NULL) {
+        for (int i = 0; paths[i] != NULL; i++) {
+            GDBusObject *child = g_dbus_object_manager_get_object(gdbus_manager, paths[i]);
+            if (child == NULL)
+                continue;
+
+            auto p = BluetoothGattCharacteristic::make(OBJECT(child));
+            if (p != nullptr)
+                vector.push_back(std::move(p));
+            g_object_unref(child);
+        }
+        return vector;
+    }
+
     GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
 
     for (l = objects; l != NULL; l = l->next) {
@@ -137,7 +166,35 @@ std::vector<std::unique_ptr<BluetoothGattCharacteristic>> BluetoothGattService::
         if (p != nullptr)
             vector.push_back(std::move(p));
     }
+    g_list_free_full(objects, g_object_unref);
 
     return vector;
 }
 
+static void fill_snapshot(GattService1 *object, BluetoothGattService::Snapshot &snapshot)
+{
+    GDBusProxy *proxy = G_DBUS_PROXY(object);
+
+    snapshot.path = g_dbus_proxy_get_object_path(proxy);
+    read_property<bluez::GattService1::UUID>(proxy, snapshot.uuid);
+    read_property<bluez::GattService1::Device>(proxy, snapshot.device);
+    read_property<bluez::GattService1::Primary>(proxy, snapshot.primary);
+}
+
+BluetoothGattService::Snapshot BluetoothGattService::snapshot ()
+{
+    std::vector<Snapshot> snapshots;
+    take_snapshots(std::vector<GattService1 *>{object}, snapshots, fill_snapshot);
+    return snapshots[0];
+}
+
+void BluetoothGattService::snapshot (
+    const std::vector<std::unique_ptr<BluetoothGattService>> &services,
+    std::vector<Snapshot> &snapshots)
+{
+    std::vector<GattService1 *> proxies;
+    proxies.reserve(services.size());
+    for (auto &p : services)
+        proxies.push_back(p->object);
+    take_snapshots(proxies, snapshots, fill_snapshot);
+}
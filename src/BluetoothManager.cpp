@@ -23,6 +23,7 @@
  */
 
 #include "generated-code.h"
+#include "tinyb_utils.hpp"
 #include "BluetoothManager.hpp"
 #include "BluetoothAdapter.hpp"
 #include "BluetoothDevice.hpp"
@@ -30,14 +31,522 @@
 #include "BluetoothGattCharacteristic.hpp"
 #include "BluetoothGattDescriptor.hpp"
 #include "BluetoothEvent.hpp"
+#include "tinyb_recorder.hpp"
+#include "tinyb_watch.hpp"
+#include "tinyb_delivery.hpp"
+#include "tinyb_timing_wheel.hpp"
+#include "tinyb_advertisement_cache.hpp"
+#include "tinyb_stats.hpp"
 #include "version.h"
 
 #include <pthread.h>
+#include <unistd.h>
 #include <cassert>
 #include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <map>
+#include <queue>
+#include <unordered_map>
 
 using namespace tinyb;
 
+typedef std::shared_ptr<const std::vector<BluetoothPropertyChange>> PropertyBatch;
+
+struct PropertySubscriber {
+    unsigned int id;
+    std::shared_ptr<DeliveryQueue<PropertyBatch>> queue;
+};
+
+/* Property changes are collected in property_pending until the flush source
+ * runs on the event thread */
+static std::mutex property_lock;
+static std::vector<PropertySubscriber> property_subscribers;
+static std::shared_ptr<std::vector<BluetoothPropertyChange>> property_pending;
+static guint property_flush_source = 0;
+static gulong property_handler = 0;
+static guint property_window = 0;
+static unsigned int last_property_id;
+
+typedef std::shared_ptr<const BluetoothAdvertisement> AdvertisementPtr;
+
+struct AdvertisementSubscriber {
+    unsigned int id;
+    std::shared_ptr<DeliveryQueue<AdvertisementPtr>> queue;
+};
+
+/* Device1 properties which are part of the advertised payload */
+static const gchar *const advertisement_properties[] = {
+    "Name", "Alias", "UUIDs", "ManufacturerData", "ServiceData", "TxPower",
+    "Appearance", "AdvertisingFlags", NULL
+};
+
+static std::mutex advertisement_lock;
+static std::vector<AdvertisementSubscriber> advertisement_subscribers;
+/* Only allocated while there are subscribers */
+static std::unique_ptr<AdvertisementCache> advertisement_cache;
+static size_t advertisement_memory = 64 * 1024;
+static gint64 advertisement_heartbeat = 0;
+static gulong advertisement_handler = 0;
+static unsigned int last_advertisement_id;
+
+static bool is_advertisement_property(const gchar *name)
+{
+    if (g_strcmp0(name, "RSSI") == 0)
+        return true;
+    for (int i = 0; advertisement_properties[i] != NULL; i++)
+        if (g_strcmp0(name, advertisement_properties[i]) == 0)
+            return true;
+    return false;
+}
+
+static uint64_t address_to_uint64(const gchar *address)
+{
+    uint64_t result = 0;
+
+    for (int i = 0; address != NULL && i < 6; i++, address += 3) {
+        gint high = g_ascii_xdigit_value(address[0]);
+        gint low = high < 0 ? -1 : g_ascii_xdigit_value(address[1]);
+        if (low < 0)
+            return 0;
+        result = (result << 8) | (high << 4) | low;
+        if (address[2] != ':')
+            break;
+    }
+    return result;
+}
+
+/* FNV-1a hash of the serialized advertised properties */
+static uint64_t advertisement_hash(GDBusProxy *proxy)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; advertisement_properties[i] != NULL; i++) {
+        GVariant *value = g_dbus_proxy_get_cached_property(proxy,
+            advertisement_properties[i]);
+        const guchar *data = NULL;
+        gsize size = 0;
+
+        if (value != NULL) {
+            data = (const guchar *) g_variant_get_data(value);
+            size = g_variant_get_size(value);
+        }
+        for (gsize j = 0; j < size; j++)
+            hash = (hash ^ data[j]) * 0x100000001b3ULL;
+        /* Separates the properties, so that absent ones count too */
+        hash = (hash ^ 0xff) * 0x100000001b3ULL;
+
+        if (value != NULL)
+            g_variant_unref(value);
+    }
+    return hash;
+}
+
+static void get_variant_bytes(GVariant *value, std::vector<unsigned char> &bytes)
+{
+    GVariant *inner = g_variant_is_of_type(value, G_VARIANT_TYPE_VARIANT) ?
+        g_variant_get_variant(value) : g_variant_ref(value);
+
+    if (g_variant_is_of_type(inner, G_VARIANT_TYPE_BYTESTRING)) {
+        gsize size;
+        const unsigned char *data = (const unsigned char *)
+            g_variant_get_fixed_array(inner, &size, 1);
+        bytes.assign(data, data + size);
+    }
+    g_variant_unref(inner);
+}
+
+static AdvertisementPtr make_advertisement(Device1 *device, bool changed)
+{
+    auto advertisement = std::make_shared<BluetoothAdvertisement>();
+    GVariantIter iter;
+    GVariant *value;
+
+    advertisement->path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(device));
+    advertisement->address = device1_get_address(device);
+    const gchar *name = device1_get_name(device);
+    if (name == NULL)
+        name = device1_get_alias(device);
+    if (name != NULL)
+        advertisement->name = name;
+    advertisement->rssi = device1_get_rssi(device);
+    advertisement->changed = changed;
+
+    /* Not part of the generated interface, read from the property cache */
+    GVariant *manufacturer_data = g_dbus_proxy_get_cached_property(
+        G_DBUS_PROXY(device), "ManufacturerData");
+    if (manufacturer_data != NULL) {
+        guint16 key;
+        g_variant_iter_init(&iter, manufacturer_data);
+        while (g_variant_iter_next(&iter, "{qv}", &key, &value)) {
+            get_variant_bytes(value, advertisement->manufacturer_data[key]);
+            g_variant_unref(value);
+        }
+        g_variant_unref(manufacturer_data);
+    }
+
+    GVariant *service_data = g_dbus_proxy_get_cached_property(
+        G_DBUS_PROXY(device), "ServiceData");
+    if (service_data != NULL) {
+        gchar *key;
+        g_variant_iter_init(&iter, service_data);
+        while (g_variant_iter_next(&iter, "{sv}", &key, &value)) {
+            get_variant_bytes(value, advertisement->service_data[key]);
+            g_variant_unref(value);
+            g_free(key);
+        }
+        g_variant_unref(service_data);
+    }
+
+    return advertisement;
+}
+
+/* Stale device eviction, eviction_devices holds the last property change of
+ * each device and is kept up to date by the object manager signals. The queue
+ * orders the devices by the time they become stale, entries are refreshed
+ * lazily from last_seen when they come due, see set_device_eviction().
+ * Each device has at most one live entry, the one of its generation, others
+ * are left over from a removed device or a rescheduling and are dropped;
+ * generation 0 means its removal is in flight. */
+struct EvictionEntry {
+    gint64 expiry;
+    std::string path;
+    uint64_t generation;
+};
+
+struct EvictionDevice {
+    gint64 last_seen;
+    uint64_t generation;
+};
+
+struct EvictionLater {
+    bool operator()(const EvictionEntry &a, const EvictionEntry &b) const {
+        return a.expiry > b.expiry;
+    }
+};
+
+static std::mutex eviction_lock;
+static std::map<std::string, EvictionDevice> eviction_devices;
+static uint64_t eviction_generation = 0;
+static std::priority_queue<EvictionEntry, std::vector<EvictionEntry>,
+    EvictionLater> eviction_queue;
+static std::set<std::string> eviction_allowlist;
+static gint64 eviction_age = 0;
+static unsigned int eviction_rate = 0;
+static guint eviction_source = 0;
+static gulong eviction_handler = 0;
+static gulong eviction_added_handler = 0;
+static gulong eviction_removed_handler = 0;
+
+/* Replaces the entry of a device, must be called with eviction_lock held */
+static void eviction_schedule(const std::string &path, EvictionDevice &device,
+    gint64 expiry)
+{
+    device.generation = ++eviction_generation;
+    eviction_queue.push(EvictionEntry{expiry, path, device.generation});
+}
+
+/* Must be called with eviction_lock held */
+static void eviction_track(const std::string &path, gint64 seen)
+{
+    auto it = eviction_devices.insert(std::make_pair(path,
+        EvictionDevice{seen, 0}));
+    if (!it.second)
+        it.first->second.last_seen = seen;
+    else
+        eviction_schedule(path, it.first->second, seen + eviction_age);
+}
+
+/* Must be called with eviction_lock held */
+static void eviction_reschedule()
+{
+    eviction_queue = decltype(eviction_queue)();
+    for (auto &it : eviction_devices)
+        if (it.second.generation != 0)
+            eviction_schedule(it.first, it.second,
+                it.second.last_seen + eviction_age);
+}
+
+static void on_device_evicted(GObject *source, GAsyncResult *res, gpointer data)
+{
+    gchar *path = static_cast<gchar *>(data);
+    GError *error = NULL;
+
+    GVariant *result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res,
+        &error);
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+
+        /* Tried again once it is due another time */
+        std::lock_guard<std::mutex> lk(eviction_lock);
+        auto it = eviction_devices.find(path);
+        if (it != eviction_devices.end())
+            eviction_schedule(path, it->second,
+                g_get_monotonic_time() + eviction_age);
+    } else {
+        /* The device is forgotten when its object is removed */
+        g_variant_unref(result);
+    }
+    g_free(path);
+}
+
+/* Starts the removal of a stale device unless it is protected, must be
+ * called with eviction_lock held */
+static bool eviction_remove(const std::string &path)
+{
+    GDBusInterface *interface = g_dbus_object_manager_get_interface(
+        gdbus_manager, path.c_str(), "org.bluez.Device1");
+    if (interface == NULL)
+        return false;
+
+    Device1 *device = DEVICE1(interface);
+    const gchar *adapter_path = device1_get_adapter(device);
+    bool stale = adapter_path != NULL && !device1_get_paired(device) &&
+        !device1_get_trusted(device) && !device1_get_connected(device);
+    /* Without its address, it could be in the allowlist */
+    const gchar *address = device1_get_address(device);
+    if (address == NULL)
+        stale = false;
+    if (stale) {
+        gchar *upper = g_ascii_strup(address, -1);
+        stale = eviction_allowlist.count(upper) == 0;
+        g_free(upper);
+    }
+
+    GDBusInterface *adapter = NULL;
+    if (stale)
+        adapter = g_dbus_object_manager_get_interface(gdbus_manager,
+            adapter_path, "org.bluez.Adapter1");
+    if (adapter != NULL) {
+        g_dbus_proxy_call(G_DBUS_PROXY(adapter), "RemoveDevice",
+            g_variant_new("(o)", path.c_str()),
+            G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+            on_device_evicted, g_strdup(path.c_str()));
+        g_object_unref(adapter);
+    }
+    g_object_unref(interface);
+
+    return adapter != NULL;
+}
+
+/* Last change of every object, removed ones being kept as tombstones until
+ * there are more than CHANGE_TOMBSTONES of them */
+#define CHANGE_TOMBSTONES 4096
+
+struct ChangeEntry {
+    BluetoothType type;
+    uint64_t added;
+    uint64_t changed;
+    bool removed;
+};
+
+static std::mutex change_lock;
+static uint64_t change_epoch = 0;
+/* Epochs before this one may have lost their tombstones */
+static uint64_t change_horizon = 0;
+static std::unordered_map<std::string, ChangeEntry> change_objects;
+/* Epoch of the last change to path, and the same for removals */
+static std::map<uint64_t, std::string> change_index;
+static std::map<uint64_t, std::string> change_tombstones;
+
+static void record_change(const gchar *path, BluetoothType type, bool removed)
+{
+    std::lock_guard<std::mutex> lk(change_lock);
+
+    auto it = change_objects.find(path);
+    if (it == change_objects.end()) {
+        if (removed)
+            return;
+        it = change_objects.emplace(path,
+            ChangeEntry{BluetoothType::NONE, 0, 0, false}).first;
+    }
+
+    ChangeEntry &entry = it->second;
+    uint64_t epoch = ++change_epoch;
+
+    if (entry.changed != 0) {
+        change_index.erase(entry.changed);
+        if (entry.removed)
+            change_tombstones.erase(entry.changed);
+    }
+
+    if (removed) {
+        entry.removed = true;
+        change_tombstones[epoch] = path;
+    } else if (entry.changed == 0 || entry.removed) {
+        entry.added = epoch;
+        entry.removed = false;
+    }
+    if (entry.type == BluetoothType::NONE)
+        entry.type = type;
+    entry.changed = epoch;
+    change_index[epoch] = path;
+
+    while (change_tombstones.size() > CHANGE_TOMBSTONES) {
+        auto oldest = change_tombstones.begin();
+        change_horizon = oldest->first;
+        change_index.erase(oldest->first);
+        change_objects.erase(oldest->second);
+        change_tombstones.erase(oldest);
+    }
+}
+
+/* Canonical wrappers by object path, see get_shared_object(). Released
+ * wrappers remove themselves, removed objects are forgotten so that a
+ * new object at the same path gets a new wrapper. The map is never freed,
+ * wrappers held by the application may outlive the static destructors. */
+static std::mutex wrapper_lock;
+static std::unordered_map<std::string, std::weak_ptr<BluetoothObject>> &wrappers =
+    *new std::unordered_map<std::string, std::weak_ptr<BluetoothObject>>();
+
+static void release_wrapper(BluetoothObject *object)
+{
+    std::string path = object->get_object_path();
+    {
+        std::lock_guard<std::mutex> lk(wrapper_lock);
+        auto it = wrappers.find(path);
+        if (it != wrappers.end() && it->second.expired())
+            wrappers.erase(it);
+    }
+    delete object;
+}
+
+static void forget_wrapper(const gchar *path)
+{
+    std::lock_guard<std::mutex> lk(wrapper_lock);
+    wrappers.erase(path);
+}
+
+static std::shared_ptr<BluetoothObject> lookup_wrapper(const std::string &path)
+{
+    std::lock_guard<std::mutex> lk(wrapper_lock);
+    auto it = wrappers.find(path);
+    if (it == wrappers.end())
+        return std::shared_ptr<BluetoothObject>();
+    return it->second.lock();
+}
+
+/* Wrappers are made without the lock held, the one made first wins */
+static std::shared_ptr<BluetoothObject> adopt_wrapper(
+    std::unique_ptr<BluetoothObject> object)
+{
+    std::string path = object->get_object_path();
+    std::lock_guard<std::mutex> lk(wrapper_lock);
+    std::weak_ptr<BluetoothObject> &entry = wrappers[path];
+
+    std::shared_ptr<BluetoothObject> wrapper = entry.lock();
+    if (wrapper == nullptr) {
+        wrapper = std::shared_ptr<BluetoothObject>(object.release(), release_wrapper);
+        entry = wrapper;
+    }
+    return wrapper;
+}
+
+static BluetoothType type_from_interface(const gchar *interface)
+{
+    if (g_strcmp0(interface, "org.bluez.Adapter1") == 0)
+        return BluetoothType::ADAPTER;
+    if (g_strcmp0(interface, "org.bluez.Device1") == 0)
+        return BluetoothType::DEVICE;
+    if (g_strcmp0(interface, "org.bluez.GattService1") == 0)
+        return BluetoothType::GATT_SERVICE;
+    if (g_strcmp0(interface, "org.bluez.GattCharacteristic1") == 0)
+        return BluetoothType::GATT_CHARACTERISTIC;
+    if (g_strcmp0(interface, "org.bluez.GattDescriptor1") == 0)
+        return BluetoothType::GATT_DESCRIPTOR;
+    return BluetoothType::NONE;
+}
+
+static void set_property_value(BluetoothPropertyChange &change, GVariant *value)
+{
+    switch (g_variant_classify(value)) {
+    case G_VARIANT_CLASS_BOOLEAN:
+        change.kind = BluetoothPropertyChange::Kind::BOOLEAN;
+        change.boolean = g_variant_get_boolean(value);
+        return;
+    case G_VARIANT_CLASS_BYTE:
+        change.kind = BluetoothPropertyChange::Kind::INTEGER;
+        change.integer = g_variant_get_byte(value);
+        return;
+    case G_VARIANT_CLASS_INT16:
+        change.kind = BluetoothPropertyChange::Kind::INTEGER;
+        change.integer = g_variant_get_int16(value);
+        return;
+    case G_VARIANT_CLASS_UINT16:
+        change.kind = BluetoothPropertyChange::Kind::INTEGER;
+        change.integer = g_variant_get_uint16(value);
+        return;
+    case G_VARIANT_CLASS_INT32:
+        change.kind = BluetoothPropertyChange::Kind::INTEGER;
+        change.integer = g_variant_get_int32(value);
+        return;
+    case G_VARIANT_CLASS_UINT32:
+        change.kind = BluetoothPropertyChange::Kind::INTEGER;
+        change.integer = g_variant_get_uint32(value);
+        return;
+    case G_VARIANT_CLASS_INT64:
+        change.kind = BluetoothPropertyChange::Kind::INTEGER;
+        change.integer = g_variant_get_int64(value);
+        return;
+    case G_VARIANT_CLASS_UINT64:
+        change.kind = BluetoothPropertyChange::Kind::INTEGER;
+        change.integer = g_variant_get_uint64(value);
+        return;
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
+        change.kind = BluetoothPropertyChange::Kind::STRING;
+        change.string = g_variant_get_string(value, NULL);
+        return;
+    default:
+        break;
+    }
+
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_BYTESTRING)) {
+        gsize size;
+        const unsigned char *bytes = (const unsigned char *)
+            g_variant_get_fixed_array(value, &size, 1);
+        change.kind = BluetoothPropertyChange::Kind::BYTES;
+        change.bytes.assign(bytes, bytes + size);
+    } else if (g_variant_is_of_type(value, G_VARIANT_TYPE_STRING_ARRAY) ||
+        g_variant_is_of_type(value, G_VARIANT_TYPE_OBJECT_PATH_ARRAY)) {
+        gsize n = g_variant_n_children(value);
+        change.kind = BluetoothPropertyChange::Kind::STRINGS;
+        for (gsize i = 0; i < n; i++) {
+            GVariant *child = g_variant_get_child_value(value, i);
+            change.strings.push_back(g_variant_get_string(child, NULL));
+            g_variant_unref(child);
+        }
+    } else {
+        gchar *text = g_variant_print(value, FALSE);
+        change.kind = BluetoothPropertyChange::Kind::OTHER;
+        change.string = text;
+        g_free(text);
+    }
+}
+
+static gboolean flush_property_changes(gpointer data)
+{
+    std::shared_ptr<std::vector<BluetoothPropertyChange>> batch;
+    std::vector<PropertySubscriber> subscribers;
+
+    (void) data;
+
+    {
+        std::lock_guard<std::mutex> lk(property_lock);
+        batch.swap(property_pending);
+        property_flush_source = 0;
+        subscribers = property_subscribers;
+    }
+
+    if (batch != nullptr && !batch->empty())
+        for (auto &subscriber : subscribers)
+            subscriber.queue->offer(batch);
+
+    return G_SOURCE_REMOVE;
+}
+
 class tinyb::BluetoothEventManager {
 public:
     static void on_interface_added (GDBusObject *object,
@@ -50,6 +559,9 @@ public:
         if (info == NULL)
             return;
 
+        record_change(g_dbus_object_get_object_path(object),
+            type_from_interface(info->name), false);
+
         if(IS_GATT_SERVICE1_PROXY(interface)) {
             type = BluetoothType::GATT_SERVICE;
             auto obj = new BluetoothGattService(GATT_SERVICE1(interface));
@@ -88,6 +600,192 @@ public:
         }
     }
 
+    static void on_properties_changed (GDBusObjectManagerClient *manager,
+        GDBusObjectProxy *object_proxy, GDBusProxy *interface_proxy,
+        GVariant *changed_properties, const gchar *const *invalidated_properties,
+        gpointer user_data) {
+        const gchar *path = g_dbus_proxy_get_object_path(interface_proxy);
+        BluetoothType type = type_from_interface(
+            g_dbus_proxy_get_interface_name(interface_proxy));
+        std::vector<BluetoothPropertyChange> changes;
+        GVariantIter iter;
+        const gchar *name;
+        GVariant *value;
+
+        g_variant_iter_init(&iter, changed_properties);
+        while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+            BluetoothPropertyChange change;
+            change.type = type;
+            change.path = path;
+            change.property = name;
+            set_property_value(change, value);
+            changes.push_back(std::move(change));
+            g_variant_unref(value);
+        }
+
+        for (int i = 0; invalidated_properties != NULL &&
+            invalidated_properties[i] != NULL; i++) {
+            BluetoothPropertyChange change;
+            change.type = type;
+            change.path = path;
+            change.property = invalidated_properties[i];
+            change.kind = BluetoothPropertyChange::Kind::INVALIDATED;
+            changes.push_back(std::move(change));
+        }
+
+        std::lock_guard<std::mutex> lk(property_lock);
+        if (property_pending == nullptr)
+            property_pending = std::make_shared<std::vector<BluetoothPropertyChange>>();
+        property_pending->insert(property_pending->end(),
+            std::make_move_iterator(changes.begin()),
+            std::make_move_iterator(changes.end()));
+
+        /* The idle source runs once the signals already queued in this
+         * iteration were dispatched */
+        if (property_flush_source == 0) {
+            if (property_window == 0)
+                property_flush_source = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                    flush_property_changes, NULL, NULL);
+            else
+                property_flush_source = g_timeout_add(property_window,
+                    flush_property_changes, NULL);
+        }
+    }
+
+    static void on_advertisement (GDBusObjectManagerClient *manager,
+        GDBusObjectProxy *object_proxy, GDBusProxy *interface_proxy,
+        GVariant *changed_properties, const gchar *const *invalidated_properties,
+        gpointer user_data) {
+        if (!IS_DEVICE1_PROXY(interface_proxy))
+            return;
+
+        /* Only advertised properties and RSSI, which changes with every
+         * received advertisement */
+        bool advertised = false;
+        GVariantIter iter;
+        const gchar *name;
+        g_variant_iter_init(&iter, changed_properties);
+        while (!advertised && g_variant_iter_next(&iter, "{&sv}", &name, NULL))
+            advertised = is_advertisement_property(name);
+        if (!advertised)
+            return;
+
+        Device1 *device = DEVICE1(interface_proxy);
+        uint64_t hash = advertisement_hash(interface_proxy);
+        std::vector<AdvertisementSubscriber> subscribers;
+        AdvertisementCache::Result result;
+
+        {
+            std::lock_guard<std::mutex> lk(advertisement_lock);
+            if (advertisement_cache == nullptr)
+                return;
+            result = advertisement_cache->update(
+                address_to_uint64(device1_get_address(device)), hash,
+                g_get_monotonic_time(), advertisement_heartbeat);
+            if (result == AdvertisementCache::Result::REPEAT)
+                return;
+            subscribers = advertisement_subscribers;
+        }
+
+        auto advertisement = make_advertisement(device,
+            result == AdvertisementCache::Result::CHANGED);
+        for (auto &subscriber : subscribers)
+            subscriber.queue->offer(advertisement);
+    }
+
+    static void on_device_seen (GDBusObjectManagerClient *manager,
+        GDBusObjectProxy *object_proxy, GDBusProxy *interface_proxy,
+        GVariant *changed_properties, const gchar *const *invalidated_properties,
+        gpointer user_data) {
+        if (!IS_DEVICE1_PROXY(interface_proxy))
+            return;
+
+        std::lock_guard<std::mutex> lk(eviction_lock);
+        eviction_track(g_dbus_proxy_get_object_path(interface_proxy),
+            g_get_monotonic_time());
+    }
+
+    static void on_device_added (GDBusObjectManager *manager,
+        GDBusObject *object, gpointer user_data) {
+        if (object_peek_device1(OBJECT(object)) == NULL)
+            return;
+
+        std::lock_guard<std::mutex> lk(eviction_lock);
+        eviction_track(g_dbus_object_get_object_path(object),
+            g_get_monotonic_time());
+    }
+
+    static void on_device_removed (GDBusObjectManager *manager,
+        GDBusObject *object, gpointer user_data) {
+        std::lock_guard<std::mutex> lk(eviction_lock);
+        eviction_devices.erase(g_dbus_object_get_object_path(object));
+    }
+
+    static gboolean on_eviction_timeout (gpointer data) {
+        gint64 now = g_get_monotonic_time();
+        unsigned int removed = 0;
+
+        (void) data;
+
+        std::lock_guard<std::mutex> lk(eviction_lock);
+
+        /* Only the devices due are looked at, the oldest first */
+        while (!eviction_queue.empty() && removed < eviction_rate &&
+            eviction_queue.top().expiry <= now) {
+            EvictionEntry entry = eviction_queue.top();
+            eviction_queue.pop();
+
+            /* Removed or rescheduled meanwhile */
+            auto it = eviction_devices.find(entry.path);
+            if (it == eviction_devices.end() ||
+                it->second.generation != entry.generation)
+                continue;
+
+            /* Seen meanwhile */
+            gint64 expiry = it->second.last_seen + eviction_age;
+            if (expiry > now) {
+                eviction_schedule(entry.path, it->second, expiry);
+                continue;
+            }
+
+            /* Protected devices are checked again after max_age */
+            if (eviction_remove(entry.path)) {
+                it->second.generation = 0;
+                removed++;
+            } else {
+                eviction_schedule(entry.path, it->second, now + eviction_age);
+            }
+        }
+
+        return G_SOURCE_CONTINUE;
+    }
+
+    static void on_object_changed (GDBusObjectManagerClient *manager,
+        GDBusObjectProxy *object_proxy, GDBusProxy *interface_proxy,
+        GVariant *changed_properties, const gchar *const *invalidated_properties,
+        gpointer user_data) {
+        record_change(g_dbus_proxy_get_object_path(interface_proxy),
+            type_from_interface(g_dbus_proxy_get_interface_name(interface_proxy)),
+            false);
+    }
+
+    static void on_interface_removed (GDBusObjectManager *manager,
+        GDBusObject *object, GDBusInterface *interface, gpointer user_data) {
+        record_change(g_dbus_object_get_object_path(object), BluetoothType::NONE,
+            false);
+    }
+
+    static void on_object_removed (GDBusObjectManager *manager,
+        GDBusObject *object, gpointer user_data) {
+        forget_wrapper(g_dbus_object_get_object_path(object));
+        BluetoothGattCharacteristic::forget_session(
+            g_dbus_object_get_object_path(object));
+        BluetoothAdapter::forget_discovery_sessions(
+            g_dbus_object_get_object_path(object));
+        record_change(g_dbus_object_get_object_path(object), BluetoothType::NONE,
+            true);
+    }
+
     static void on_object_added (GDBusObjectManager *manager,
         GDBusObject *object, gpointer user_data) {
         GList *l, *interfaces = g_dbus_object_get_interfaces(object);
@@ -102,6 +800,29 @@ public:
 GDBusObjectManager *gdbus_manager = NULL;
 GThread *manager_thread = NULL;
 
+bool BluetoothManager::event_thread_enabled = true;
+static bool manager_initialized = false;
+
+/* State of the external event loop iteration, see prepare_events() */
+static std::vector<GPollFD> poll_fds;
+static gint dispatch_priority;
+
+/* Timeouts of all events, on a timing wheel driven from the event thread
+ * while there are timers */
+#define TIMEOUT_RESOLUTION 10
+static std::mutex timeout_lock;
+static TimingWheel<std::weak_ptr<BluetoothEvent>> timeout_wheel;
+static guint timeout_source = 0;
+static gint64 timeout_start;
+
+static uint64_t timeout_now()
+{
+    return (g_get_monotonic_time() / 1000 - timeout_start) / TIMEOUT_RESOLUTION;
+}
+
+static std::string replay_path;
+static bool replay_realtime;
+
 std::string BluetoothManager::get_class_name() const
 {
     return std::string("BluetoothManager");
@@ -145,6 +866,31 @@ std::vector<std::unique_ptr<BluetoothObject>> BluetoothManager::get_objects(
     BluetoothObject *parent)
 {
     std::vector<std::unique_ptr<BluetoothObject>> vector;
+
+    /* Only characteristics have a service as parent and only descriptors a
+     * characteristic, so these can be resolved through the parent directly */
+    if (parent != nullptr && parent->get_bluetooth_type() == BluetoothType::GATT_SERVICE) {
+        auto service = dynamic_cast<BluetoothGattService *>(parent);
+        if (service != nullptr && name == nullptr &&
+            (type == BluetoothType::NONE || type == BluetoothType::GATT_CHARACTERISTIC)) {
+            for (auto &p : service->get_characteristics())
+                if (identifier == nullptr || *identifier == p->get_uuid())
+                    vector.push_back(std::move(p));
+        }
+        return vector;
+    }
+
+    if (parent != nullptr && parent->get_bluetooth_type() == BluetoothType::GATT_CHARACTERISTIC) {
+        auto characteristic = dynamic_cast<BluetoothGattCharacteristic *>(parent);
+        if (characteristic != nullptr && name == nullptr &&
+            (type == BluetoothType::NONE || type == BluetoothType::GATT_DESCRIPTOR)) {
+            for (auto &p : characteristic->get_descriptors())
+                if (identifier == nullptr || *identifier == p->get_uuid())
+                    vector.push_back(std::move(p));
+        }
+        return vector;
+    }
+
     GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
 
     for (l = objects; l != NULL; l = l->next) {
@@ -170,9 +916,62 @@ std::vector<std::unique_ptr<BluetoothObject>> BluetoothManager::get_objects(
         if (p_adapter != nullptr)
             vector.push_back(std::move(p_adapter));
     }
+    g_list_free_full(objects, g_object_unref);
     return vector;
 }
 
+static gboolean timeout_tick(gpointer data)
+{
+    std::vector<std::weak_ptr<BluetoothEvent>> expired;
+    gboolean more;
+
+    (void) data;
+
+    {
+        std::lock_guard<std::mutex> lk(timeout_lock);
+        timeout_wheel.advance(timeout_now(), expired);
+        more = !timeout_wheel.empty();
+        if (!more)
+            timeout_source = 0;
+    }
+
+    /* Canceling removes the event and wakes up its waiters */
+    for (auto &e : expired) {
+        auto event = e.lock();
+        if (event != nullptr)
+            event->expire();
+    }
+
+    return more ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+void BluetoothManager::add_event_timeout(std::shared_ptr<BluetoothEvent> &event,
+    std::chrono::milliseconds timeout)
+{
+    if (timeout == std::chrono::milliseconds::zero())
+        return;
+
+    std::lock_guard<std::mutex> lk(timeout_lock);
+    uint64_t ticks = (timeout.count() + TIMEOUT_RESOLUTION - 1) / TIMEOUT_RESOLUTION;
+    /* The wheel is not advanced while it is empty */
+    timeout_wheel.reset(timeout_now());
+    uint64_t current = std::max(timeout_wheel.get_current(), timeout_now());
+
+    event->timeout_timer = timeout_wheel.schedule(current + ticks, event);
+    if (timeout_source == 0)
+        timeout_source = g_timeout_add(TIMEOUT_RESOLUTION, timeout_tick, NULL);
+}
+
+void BluetoothManager::remove_event_timeout(BluetoothEvent &event)
+{
+    std::lock_guard<std::mutex> lk(timeout_lock);
+
+    if (event.timeout_timer != 0) {
+        timeout_wheel.cancel(event.timeout_timer);
+        event.timeout_timer = 0;
+    }
+}
+
 std::unique_ptr<BluetoothObject> BluetoothManager::find(BluetoothType type,
     std::string *name, std::string* identifier, BluetoothObject *parent,
     std::chrono::milliseconds timeout)
@@ -184,6 +983,11 @@ std::unique_ptr<BluetoothObject> BluetoothManager::find(BluetoothType type,
     auto object = get_object(type, name, identifier, parent);
 
     if (object == nullptr) {
+        /* The expiry on the event thread cancels the event, which wakes up
+         * the wait. The wait has its own timeout as well, the expiry cannot
+         * run without the event thread or if find() is called from it. */
+        if (event_thread_enabled)
+            add_event_timeout(event, timeout);
         event->wait(timeout);
         object = std::unique_ptr<BluetoothObject>(event->get_result());
     }
@@ -195,80 +999,434 @@ std::unique_ptr<BluetoothObject> BluetoothManager::find(BluetoothType type,
 std::weak_ptr<BluetoothEvent> BluetoothManager::find(BluetoothType type,
     std::string *name, std::string* identifier, BluetoothObject *parent,
     BluetoothCallback cb, bool execute_once,
-    std::chrono::milliseconds timeout)
+    std::chrono::milliseconds timeout, void *data,
+    BluetoothExpiredCallback expired_cb)
 {
     std::shared_ptr<BluetoothEvent> event(new BluetoothEvent(type, name,
-        identifier, parent));
+        identifier, parent, execute_once, cb, data, expired_cb));
     add_event(event);
+    add_event_timeout(event, timeout);
     return std::weak_ptr<BluetoothEvent>(event);
 }
 
+static bool event_matches(BluetoothEvent &event, BluetoothType type,
+    std::string *name, std::string *identifier, BluetoothObject *parent)
+{
+    if (event.get_type() != BluetoothType::NONE && event.get_type() != type)
+        return false;
+    if (event.get_name() != NULL)
+        if (name == NULL || *(event.get_name()) != *name)
+            return false;
+    if (event.get_identifier() != NULL)
+        if (identifier == NULL || *(event.get_identifier()) != *identifier)
+            return false;
+    if (event.get_parent() != NULL)
+        if (parent == NULL || *(event.get_parent()) != *parent)
+            return false;
+    return true;
+}
+
 void BluetoothManager::handle_event(BluetoothType type, std::string *name,
     std::string *identifier, BluetoothObject *parent, BluetoothObject &object)
 {
-    for (auto it = event_list.begin();
-        it != event_list.end();) {
-        if ((*it)->get_type() != BluetoothType::NONE && ((*it)->get_type()) != type) {
-            ++it;
-            continue; /* this event does not match */
+    std::vector<std::shared_ptr<BluetoothEvent>> matches;
+
+    stats_add(StatsCounter::EVENTS);
+
+    /* Callbacks run without the lock, they may add or cancel events */
+    {
+        std::lock_guard<std::mutex> lk(event_lock);
+        for (auto &event : event_list)
+            if (event_matches(*event, type, name, identifier, parent))
+                matches.push_back(event);
+    }
+
+    /* The event matches, execute and see if it needs to reexecute */
+    for (auto &event : matches) {
+        if (event->execute_callback(object)) {
+            remove_event(*event);
+            remove_event_timeout(*event);
         }
-        if ((*it)->get_name() != NULL)
-            if (name == NULL || *((*it)->get_name()) != *name) {
-                ++it;
-                continue; /* this event does not match */
-            }
-        if ((*it)->get_identifier() != NULL)
-            if (identifier == NULL || *((*it)->get_identifier()) != *identifier) {
-                ++it;
-                continue; /* this event does not match */
-            }
-        if ((*it)->get_parent() != NULL)
-            if (parent == NULL || *((*it)->get_parent()) != *parent) {
-                ++it;
-                continue; /* this event does not match */
-            }
-        /* The event matches, execute and see if it needs to reexecute */
-        if ((*it)->execute_callback(object))
-            it = event_list.erase(it);
-        else
-            ++it;
     }
 }
 
 static gpointer init_manager_thread(void *data)
 {
     GMainLoop *loop;
-    GDBusObjectManager *gdbus_manager = (GDBusObjectManager *) data;
+
+    (void) data;
 
     loop = g_main_loop_new(NULL, FALSE);
+    g_main_loop_run(loop);
+    return NULL;
+}
 
-    g_signal_connect(gdbus_manager,
-        "interface-added",
-         G_CALLBACK(BluetoothEventManager::on_interface_added),
-         NULL);
+bool BluetoothManager::set_event_thread_enabled(bool enabled)
+{
+    if (manager_initialized)
+        return false;
 
-    g_signal_connect(gdbus_manager,
-        "object-added",
-         G_CALLBACK(BluetoothEventManager::on_object_added),
-         NULL);
+    event_thread_enabled = enabled;
+    return true;
+}
 
-    g_main_loop_run(loop);
-    return NULL;
+bool BluetoothManager::get_event_thread_enabled()
+{
+    return event_thread_enabled;
+}
+
+/* How long prepare_events() waits for another thread to release the
+ * context, in microseconds */
+#define PREPARE_ACQUIRE_TIMEOUT G_USEC_PER_SEC
+
+int BluetoothManager::prepare_events(std::vector<struct pollfd> &fds)
+{
+    GMainContext *context = g_main_context_default();
+    gint timeout = -1;
+    gint n_fds;
+    gboolean ready;
+
+    if (event_thread_enabled)
+        throw std::logic_error("Events are dispatched by tinyb's event thread");
+
+    /* Other threads briefly own the context while they run a function
+     * inline, see run_on_event_thread(), so only a lasting owner is an
+     * error */
+    gint64 deadline = g_get_monotonic_time() + PREPARE_ACQUIRE_TIMEOUT;
+    while (!g_main_context_acquire(context)) {
+        if (g_get_monotonic_time() >= deadline)
+            throw std::runtime_error("Event loop is owned by another thread");
+        g_usleep(100);
+    }
+
+    ready = g_main_context_prepare(context, &dispatch_priority);
+
+    if (poll_fds.empty())
+        poll_fds.resize(4);
+    while ((n_fds = g_main_context_query(context, dispatch_priority, &timeout,
+            poll_fds.data(), (gint) poll_fds.size())) > (gint) poll_fds.size())
+        poll_fds.resize(n_fds);
+
+    fds.resize(n_fds);
+    for (gint i = 0; i < n_fds; i++) {
+        fds[i].fd = poll_fds[i].fd;
+        fds[i].events = poll_fds[i].events;
+        fds[i].revents = 0;
+    }
+
+    if (ready)
+        timeout = 0;
+    return timeout;
+}
+
+void BluetoothManager::dispatch_events(const std::vector<struct pollfd> &fds)
+{
+    GMainContext *context = g_main_context_default();
+    gint n_fds = std::min(fds.size(), poll_fds.size());
+
+    if (event_thread_enabled)
+        throw std::logic_error("Events are dispatched by tinyb's event thread");
+
+    for (gint i = 0; i < n_fds; i++)
+        poll_fds[i].revents = fds[i].revents;
+
+    if (g_main_context_check(context, dispatch_priority, poll_fds.data(), n_fds))
+        g_main_context_dispatch(context);
+
+    g_main_context_release(context);
+}
+
+unsigned int BluetoothManager::subscribe_property_changes(
+    BluetoothPropertyBatchCallback cb, void *data,
+    const BluetoothDeliveryPolicy &policy)
+{
+    if (cb == nullptr)
+        throw std::runtime_error("Property callback must not be null");
+
+    auto queue = std::make_shared<DeliveryQueue<PropertyBatch>>(policy,
+        [cb, data](PropertyBatch &batch) {
+            cb(*batch, data);
+        });
+
+    std::lock_guard<std::mutex> lk(property_lock);
+    if (++last_property_id == 0)
+        ++last_property_id;
+    property_subscribers.push_back(PropertySubscriber{last_property_id, queue});
+
+    if (property_handler == 0)
+        property_handler = g_signal_connect(gdbus_manager,
+            "interface-proxy-properties-changed",
+            G_CALLBACK(BluetoothEventManager::on_properties_changed),
+            NULL);
+
+    return last_property_id;
+}
+
+bool BluetoothManager::unsubscribe_property_changes(unsigned int id)
+{
+    std::shared_ptr<DeliveryQueue<PropertyBatch>> queue;
+
+    {
+        std::lock_guard<std::mutex> lk(property_lock);
+        for (auto it = property_subscribers.begin();
+            it != property_subscribers.end(); ++it) {
+            if (it->id == id) {
+                queue = it->queue;
+                property_subscribers.erase(it);
+                break;
+            }
+        }
+
+        if (queue == nullptr)
+            return false;
+
+        if (property_subscribers.empty() && property_handler != 0) {
+            g_signal_handler_disconnect(gdbus_manager, property_handler);
+            property_handler = 0;
+        }
+    }
+
+    queue->stop();
+    return true;
+}
+
+void BluetoothManager::set_property_batch_window(std::chrono::milliseconds window)
+{
+    std::lock_guard<std::mutex> lk(property_lock);
+    property_window = window.count();
+}
+
+unsigned int BluetoothManager::subscribe_advertisements(
+    BluetoothAdvertisementCallback cb, void *data,
+    const BluetoothDeliveryPolicy &policy)
+{
+    if (cb == nullptr)
+        throw std::runtime_error("Advertisement callback must not be null");
+
+    auto queue = std::make_shared<DeliveryQueue<AdvertisementPtr>>(policy,
+        [cb, data](AdvertisementPtr &advertisement) {
+            cb(*advertisement, data);
+        });
+
+    std::lock_guard<std::mutex> lk(advertisement_lock);
+    if (++last_advertisement_id == 0)
+        ++last_advertisement_id;
+    advertisement_subscribers.push_back(
+        AdvertisementSubscriber{last_advertisement_id, queue});
+
+    if (advertisement_cache == nullptr)
+        advertisement_cache.reset(new AdvertisementCache(advertisement_memory));
+
+    if (advertisement_handler == 0)
+        advertisement_handler = g_signal_connect(gdbus_manager,
+            "interface-proxy-properties-changed",
+            G_CALLBACK(BluetoothEventManager::on_advertisement),
+            NULL);
+
+    return last_advertisement_id;
+}
+
+bool BluetoothManager::unsubscribe_advertisements(unsigned int id)
+{
+    std::shared_ptr<DeliveryQueue<AdvertisementPtr>> queue;
+
+    {
+        std::lock_guard<std::mutex> lk(advertisement_lock);
+        for (auto it = advertisement_subscribers.begin();
+            it != advertisement_subscribers.end(); ++it) {
+            if (it->id == id) {
+                queue = it->queue;
+                advertisement_subscribers.erase(it);
+                break;
+            }
+        }
+
+        if (queue == nullptr)
+            return false;
+
+        /* Devices must be delivered again to the next subscriber */
+        if (advertisement_subscribers.empty() && advertisement_handler != 0) {
+            g_signal_handler_disconnect(gdbus_manager, advertisement_handler);
+            advertisement_handler = 0;
+            advertisement_cache.reset();
+        }
+    }
+
+    queue->stop();
+    return true;
+}
+
+void BluetoothManager::set_advertisement_cache(size_t memory,
+    std::chrono::milliseconds heartbeat)
+{
+    std::lock_guard<std::mutex> lk(advertisement_lock);
+    advertisement_memory = memory;
+    if (advertisement_cache != nullptr)
+        advertisement_cache.reset(new AdvertisementCache(memory));
+    advertisement_heartbeat = heartbeat.count() * 1000;
+}
+
+void BluetoothManager::set_device_eviction(std::chrono::seconds max_age,
+    unsigned int rate, const std::vector<std::string> &allowlist)
+{
+    std::lock_guard<std::mutex> lk(eviction_lock);
+
+    eviction_age = max_age.count() * G_USEC_PER_SEC;
+    eviction_rate = rate;
+    eviction_allowlist.clear();
+    for (auto &address : allowlist) {
+        gchar *upper = g_ascii_strup(address.c_str(), -1);
+        eviction_allowlist.insert(upper);
+        g_free(upper);
+    }
+
+    if (max_age.count() > 0 && eviction_source == 0) {
+        eviction_handler = g_signal_connect(gdbus_manager,
+            "interface-proxy-properties-changed",
+            G_CALLBACK(BluetoothEventManager::on_device_seen),
+            NULL);
+        eviction_added_handler = g_signal_connect(gdbus_manager,
+            "object-added",
+            G_CALLBACK(BluetoothEventManager::on_device_added),
+            NULL);
+        eviction_removed_handler = g_signal_connect(gdbus_manager,
+            "object-removed",
+            G_CALLBACK(BluetoothEventManager::on_device_removed),
+            NULL);
+
+        /* Devices already known are first seen now */
+        GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
+        gint64 now = g_get_monotonic_time();
+        for (l = objects; l != NULL; l = l->next) {
+            Device1 *device = object_peek_device1(OBJECT(l->data));
+            if (device != NULL)
+                eviction_track(g_dbus_proxy_get_object_path(G_DBUS_PROXY(device)),
+                    now);
+        }
+        g_list_free_full(objects, g_object_unref);
+
+        eviction_source = g_timeout_add_seconds(1,
+            BluetoothEventManager::on_eviction_timeout, NULL);
+    } else if (max_age.count() <= 0 && eviction_source != 0) {
+        g_signal_handler_disconnect(gdbus_manager, eviction_handler);
+        g_signal_handler_disconnect(gdbus_manager, eviction_added_handler);
+        g_signal_handler_disconnect(gdbus_manager, eviction_removed_handler);
+        g_source_remove(eviction_source);
+        eviction_handler = 0;
+        eviction_added_handler = 0;
+        eviction_removed_handler = 0;
+        eviction_source = 0;
+        eviction_devices.clear();
+        eviction_queue = decltype(eviction_queue)();
+    } else if (eviction_source != 0) {
+        /* The expiries depend on max_age */
+        eviction_reschedule();
+    }
+}
+
+bool BluetoothManager::enable_stats(const std::string &name)
+{
+    if (name.empty())
+        return stats_enable(std::to_string(getpid()));
+    return stats_enable(name);
+}
+
+bool BluetoothManager::start_recording(const std::string &path)
+{
+    GError *error = NULL;
+    GDBusObjectManagerClient *client = G_DBUS_OBJECT_MANAGER_CLIENT(gdbus_manager);
+
+    if (!recorder_start(g_dbus_object_manager_client_get_connection(client),
+            g_dbus_object_manager_client_get_name(client), path.c_str(), &error)) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        return false;
+    }
+    return true;
+}
+
+void BluetoothManager::stop_recording()
+{
+    recorder_stop();
+}
+
+bool BluetoothManager::set_replay_file(const std::string &path, bool realtime)
+{
+    if (manager_initialized)
+        return false;
+
+    replay_path = path;
+    replay_realtime = realtime;
+    return true;
+}
+
+bool BluetoothManager::set_watched_paths(const std::vector<std::string> &paths)
+{
+    if (manager_initialized)
+        return false;
+
+    watch_set_paths(paths);
+    return true;
+}
+
+bool BluetoothManager::set_discovery_feed(bool enabled)
+{
+    GError *error = NULL;
+
+    if (!watch_set_discovery(enabled, &error)) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        return false;
+    }
+    return true;
+}
+
+bool BluetoothManager::get_replay_finished()
+{
+    return replayer_finished();
 }
 
 BluetoothManager::BluetoothManager() : event_list()
 {
     GError *error = NULL;
     GList *objects, *l;
+    GDBusConnection *connection;
+    const gchar *bus_name = "org.bluez";
+
+    if (!replay_path.empty()) {
+        connection = replayer_new_connection(replay_path.c_str(),
+            replay_realtime, &error);
+        /* A peer connection has no bus names */
+        bus_name = NULL;
+    } else if (watch_enabled())
+        connection = watch_new_connection(&error);
+    else
+        connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+
+    if (connection == nullptr) {
+        std::string error_str("Error connecting to D-Bus: ");
+        error_str += error->message;
+        g_error_free(error);
+        throw std::runtime_error(error_str);
+    }
 
+    /* Before the object manager client adds its match rule */
+    if (watch_enabled() && !watch_start(connection, bus_name, &error)) {
+        std::string error_str("Error watching the selected paths: ");
+        error_str += error->message;
+        g_error_free(error);
+        g_object_unref(connection);
+        throw std::runtime_error(error_str);
+    }
 
-    gdbus_manager = object_manager_client_new_for_bus_sync(
-            G_BUS_TYPE_SYSTEM,
+    gdbus_manager = object_manager_client_new_sync(
+            connection,
             G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
-            "org.bluez",
+            bus_name,
             "/",
             NULL, /* GCancellable */
             &error);
+    g_object_unref(connection);
 
     if (gdbus_manager == nullptr) {
         std::string error_str("Error getting object manager client: ");
@@ -277,7 +1435,48 @@ BluetoothManager::BluetoothManager() : event_list()
         throw std::runtime_error(error_str);
     }
 
-    manager_thread = g_thread_new(NULL, init_manager_thread, gdbus_manager);
+    manager_initialized = true;
+    timeout_start = g_get_monotonic_time() / 1000;
+
+    g_signal_connect(gdbus_manager,
+        "interface-added",
+         G_CALLBACK(BluetoothEventManager::on_interface_added),
+         NULL);
+
+    g_signal_connect(gdbus_manager,
+        "object-added",
+         G_CALLBACK(BluetoothEventManager::on_object_added),
+         NULL);
+
+    g_signal_connect(gdbus_manager,
+        "interface-removed",
+         G_CALLBACK(BluetoothEventManager::on_interface_removed),
+         NULL);
+
+    g_signal_connect(gdbus_manager,
+        "object-removed",
+         G_CALLBACK(BluetoothEventManager::on_object_removed),
+         NULL);
+
+    g_signal_connect(gdbus_manager,
+        "interface-proxy-properties-changed",
+         G_CALLBACK(BluetoothEventManager::on_object_changed),
+         NULL);
+
+    /* The objects present at startup are the first changes */
+    objects = g_dbus_object_manager_get_objects(gdbus_manager);
+    for (l = objects; l != NULL; l = l->next) {
+        GList *i, *interfaces = g_dbus_object_get_interfaces(G_DBUS_OBJECT(l->data));
+        for (i = interfaces; i != NULL; i = i->next)
+            record_change(g_dbus_object_get_object_path(G_DBUS_OBJECT(l->data)),
+                type_from_interface(g_dbus_proxy_get_interface_name(
+                    G_DBUS_PROXY(i->data))), false);
+        g_list_free_full(interfaces, g_object_unref);
+    }
+    g_list_free_full(objects, g_object_unref);
+
+    if (event_thread_enabled)
+        manager_thread = g_thread_new(NULL, init_manager_thread, NULL);
 
     objects = g_dbus_object_manager_get_objects(gdbus_manager);
 
@@ -345,6 +1544,71 @@ std::vector<std::unique_ptr<BluetoothDevice>> BluetoothManager::get_devices()
     return vector;
 }
 
+std::shared_ptr<BluetoothObject> BluetoothManager::get_shared_object(
+    const std::string &path)
+{
+    auto wrapper = lookup_wrapper(path);
+    if (wrapper != nullptr)
+        return wrapper;
+
+    GDBusObject *object = g_dbus_object_manager_get_object(gdbus_manager, path.c_str());
+    if (object == NULL)
+        return wrapper;
+
+    std::unique_ptr<BluetoothObject> made;
+    Object *o = OBJECT(object);
+    if (object_peek_adapter1(o) != NULL)
+        made = BluetoothAdapter::make(o);
+    else if (object_peek_device1(o) != NULL)
+        made = BluetoothDevice::make(o);
+    else if (object_peek_gatt_service1(o) != NULL)
+        made = BluetoothGattService::make(o);
+    else if (object_peek_gatt_characteristic1(o) != NULL)
+        made = BluetoothGattCharacteristic::make(o);
+    else if (object_peek_gatt_descriptor1(o) != NULL)
+        made = BluetoothGattDescriptor::make(o);
+    g_object_unref(object);
+    if (made == nullptr)
+        return wrapper;
+    return adopt_wrapper(std::move(made));
+}
+
+std::shared_ptr<BluetoothObject> BluetoothManager::get_shared_object(
+    std::unique_ptr<BluetoothObject> object)
+{
+    auto wrapper = lookup_wrapper(object->get_object_path());
+    if (wrapper != nullptr)
+        return wrapper;
+    return adopt_wrapper(std::move(object));
+}
+
+std::vector<std::shared_ptr<BluetoothDevice>> BluetoothManager::get_shared_devices()
+{
+    std::vector<std::shared_ptr<BluetoothDevice>> vector;
+    GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
+
+    for (l = objects; l != NULL; l = l->next) {
+        Object *object = OBJECT(l->data);
+        if (object_peek_device1(object) == NULL)
+            continue;
+
+        auto wrapper = lookup_wrapper(g_dbus_object_get_object_path(G_DBUS_OBJECT(object)));
+        if (wrapper == nullptr) {
+            auto p = BluetoothDevice::make(object);
+            if (p == nullptr)
+                continue;
+            wrapper = adopt_wrapper(std::move(p));
+        }
+
+        auto device = std::dynamic_pointer_cast<BluetoothDevice>(wrapper);
+        if (device != nullptr)
+            vector.push_back(std::move(device));
+    }
+    g_list_free_full(objects, g_object_unref);
+
+    return vector;
+}
+
 std::vector<std::unique_ptr<BluetoothGattService>> BluetoothManager::get_services()
 {
     std::vector<std::unique_ptr<BluetoothGattService>> vector;
@@ -387,3 +1651,58 @@ bool BluetoothManager::stop_discovery()
     else
         return false;
 }
+
+uint64_t BluetoothManager::get_epoch()
+{
+    std::lock_guard<std::mutex> lk(change_lock);
+    return change_epoch;
+}
+
+bool BluetoothManager::changes_since(uint64_t epoch,
+    std::vector<BluetoothObjectChange> &changes, uint64_t &current)
+{
+    std::lock_guard<std::mutex> lk(change_lock);
+
+    /* Without the tombstones since epoch, start over from the beginning */
+    bool complete = epoch >= change_horizon;
+    if (!complete)
+        epoch = 0;
+
+    changes.clear();
+    for (auto it = change_index.upper_bound(epoch); it != change_index.end(); ++it) {
+        const ChangeEntry &entry = change_objects[it->second];
+        BluetoothObjectChange change;
+
+        if (entry.removed) {
+            /* Appeared and went away since epoch */
+            if (entry.added > epoch)
+                continue;
+            change.kind = BluetoothObjectChange::Kind::REMOVED;
+        } else if (entry.added > epoch)
+            change.kind = BluetoothObjectChange::Kind::ADDED;
+        else
+            change.kind = BluetoothObjectChange::Kind::MODIFIED;
+
+        change.type = entry.type;
+        change.path = it->second;
+        change.epoch = entry.changed;
+        changes.push_back(std::move(change));
+    }
+
+    current = change_epoch;
+    return complete;
+}
+
+unsigned int BluetoothManager::open_discovery_session(
+    const BluetoothDiscoveryFilter &filter)
+{
+    if (default_adapter != nullptr)
+        return default_adapter->open_discovery_session(filter);
+    else
+        return 0;
+}
+
+bool BluetoothManager::close_discovery_session(unsigned int id)
+{
+    return BluetoothAdapter::close_discovery_session(id);
+}
@@ -0,0 +1,308 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "generated-code.h"
+#include "tinyb_utils.hpp"
+#include "tinyb_timing_wheel.hpp"
+#include "tinyb_stats.hpp"
+#include "BluetoothPollScheduler.hpp"
+
+#include <map>
+#include <deque>
+#include <mutex>
+
+using namespace tinyb;
+
+struct PollEntry {
+    GattCharacteristic1 *object;
+    std::shared_ptr<BluetoothGattCharacteristic> characteristic;
+    std::string device;
+    uint64_t period;
+    uint64_t expiry;
+    uint64_t timer;
+    BluetoothNotificationCallback cb;
+    void *data;
+    bool pending;
+    uint64_t dropped;
+};
+
+struct PollDevice {
+    bool busy;
+    std::deque<unsigned int> waiting;
+};
+
+struct BluetoothPollScheduler::State {
+    std::mutex lock;
+    TimingWheel<unsigned int> wheel;
+    std::map<unsigned int, PollEntry> entries;
+    std::map<std::string, PollDevice> devices;
+    unsigned int last_id;
+    guint64 resolution;
+    guint64 start;
+    guint source;
+
+    uint64_t now() const {
+        return (g_get_monotonic_time() / 1000 - start) / resolution;
+    }
+
+    /* The following are called with lock held */
+    void fire(unsigned int id, std::shared_ptr<State> &self);
+    void start_read(unsigned int id, PollEntry &entry, std::shared_ptr<State> &self);
+    void read_next(const std::string &device, std::shared_ptr<State> &self);
+};
+
+/* A read in flight, it does not keep the scheduler alive */
+struct PollRead {
+    std::weak_ptr<void> state;
+    unsigned int id;
+    std::string device;
+    gint64 started;
+};
+
+void BluetoothPollScheduler::free_state(void *data)
+{
+    delete static_cast<std::weak_ptr<State> *>(data);
+}
+
+void BluetoothPollScheduler::State::fire(unsigned int id, std::shared_ptr<State> &self)
+{
+    auto it = entries.find(id);
+    if (it == entries.end())
+        return;
+    PollEntry &entry = it->second;
+
+    /* Periods are kept relative to the first expiry so they do not drift,
+     * the ones missed while the event thread was busy are dropped */
+    entry.expiry += entry.period;
+    uint64_t current = wheel.get_current();
+    if (entry.expiry <= current) {
+        uint64_t missed = (current - entry.expiry) / entry.period + 1;
+        entry.expiry += missed * entry.period;
+        entry.dropped += missed;
+    }
+    entry.timer = wheel.schedule(entry.expiry, id);
+
+    if (entry.pending) {
+        entry.dropped++;
+        return;
+    }
+    entry.pending = true;
+
+    PollDevice &device = devices[entry.device];
+    if (device.busy)
+        device.waiting.push_back(id);
+    else {
+        device.busy = true;
+        start_read(id, entry, self);
+    }
+}
+
+void BluetoothPollScheduler::State::start_read(unsigned int id, PollEntry &entry,
+    std::shared_ptr<State> &self)
+{
+    gatt_characteristic1_call_read_value(entry.object, NULL,
+        (GAsyncReadyCallback) read_callback, new PollRead{self, id, entry.device, g_get_monotonic_time()});
+}
+
+void BluetoothPollScheduler::State::read_next(const std::string &device,
+    std::shared_ptr<State> &self)
+{
+    auto d = devices.find(device);
+    if (d == devices.end())
+        return;
+
+    while (!d->second.waiting.empty()) {
+        unsigned int id = d->second.waiting.front();
+        d->second.waiting.pop_front();
+
+        auto it = entries.find(id);
+        if (it != entries.end()) {
+            start_read(id, it->second, self);
+            return;
+        }
+    }
+
+    d->second.busy = false;
+}
+
+int BluetoothPollScheduler::tick_callback(void *data)
+{
+    auto state = static_cast<std::weak_ptr<State> *>(data)->lock();
+    std::vector<unsigned int> expired;
+
+    if (state == nullptr)
+        return G_SOURCE_REMOVE;
+
+    std::lock_guard<std::mutex> lk(state->lock);
+    state->wheel.advance(state->now(), expired);
+    for (auto id : expired)
+        state->fire(id, state);
+
+    return G_SOURCE_CONTINUE;
+}
+
+void BluetoothPollScheduler::read_callback(void *source, void *res, void *data)
+{
+    std::unique_ptr<PollRead> read(static_cast<PollRead *>(data));
+    GError *error = NULL;
+    GBytes *value_gbytes = NULL;
+
+    gatt_characteristic1_call_read_value_finish(GATT_CHARACTERISTIC1(source),
+        &value_gbytes, G_ASYNC_RESULT(res), &error);
+    stats_latency(StatsOperation::READ, g_get_monotonic_time() - read->started,
+        error != NULL);
+    if (error) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> value;
+    if (value_gbytes != NULL) {
+        try {
+            value = std::make_shared<const std::vector<unsigned char>>(
+                from_gbytes_to_vector(value_gbytes));
+        } catch (std::exception &e) {
+        }
+        g_bytes_unref(value_gbytes);
+    }
+
+    auto state = std::static_pointer_cast<State>(read->state.lock());
+    if (state == nullptr)
+        return;
+
+    std::shared_ptr<BluetoothGattCharacteristic> characteristic;
+    BluetoothNotificationCallback cb = nullptr;
+    void *cb_data = nullptr;
+    {
+        std::lock_guard<std::mutex> lk(state->lock);
+        auto it = state->entries.find(read->id);
+        if (it != state->entries.end()) {
+            it->second.pending = false;
+            characteristic = it->second.characteristic;
+            cb = it->second.cb;
+            cb_data = it->second.data;
+        }
+        state->read_next(read->device, state);
+    }
+
+    if (cb != nullptr && value != nullptr)
+        cb(*characteristic, value, cb_data);
+}
+
+BluetoothPollScheduler::BluetoothPollScheduler(std::chrono::milliseconds resolution) :
+    state(std::make_shared<State>())
+{
+    state->last_id = 0;
+    state->resolution = resolution.count() > 0 ? resolution.count() : 1;
+    state->start = g_get_monotonic_time() / 1000;
+    state->source = 0;
+}
+
+BluetoothPollScheduler::~BluetoothPollScheduler()
+{
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    if (state->source != 0)
+        g_source_remove(state->source);
+    for (auto &entry : state->entries)
+        g_object_unref(entry.second.object);
+    state->entries.clear();
+}
+
+unsigned int BluetoothPollScheduler::add(BluetoothGattCharacteristic &characteristic,
+    std::chrono::milliseconds period, BluetoothNotificationCallback cb, void *data)
+{
+    if (cb == nullptr)
+        throw std::runtime_error("Poll callback must not be null");
+
+    std::string path = characteristic.get_object_path();
+    GDBusInterface *interface = g_dbus_object_manager_get_interface(gdbus_manager,
+        path.c_str(), "org.bluez.GattCharacteristic1");
+    if (interface == NULL)
+        throw std::runtime_error("Unknown characteristic " + path);
+
+    PollEntry entry;
+    entry.object = GATT_CHARACTERISTIC1(interface);
+    entry.characteristic = std::shared_ptr<BluetoothGattCharacteristic>(
+        characteristic.clone());
+
+    /* Reads are serialized per device, the parent of the service */
+    std::string service(gatt_characteristic1_get_service(entry.object));
+    entry.device = service.substr(0, service.rfind('/'));
+
+    entry.period = (period.count() + state->resolution - 1) / state->resolution;
+    if (entry.period == 0)
+        entry.period = 1;
+    entry.cb = cb;
+    entry.data = data;
+    entry.pending = false;
+    entry.dropped = 0;
+
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    /* A random phase spreads polls with equal periods. The wheel is not
+     * advanced while it is empty. */
+    state->wheel.reset(state->now());
+    uint64_t current = std::max(state->wheel.get_current(), state->now());
+    entry.expiry = current + 1 + g_random_int_range(0, std::min<uint64_t>(entry.period, G_MAXINT32));
+
+    unsigned int id = ++state->last_id;
+    entry.timer = state->wheel.schedule(entry.expiry, id);
+    state->entries[id] = entry;
+
+    if (state->source == 0)
+        state->source = g_timeout_add_full(G_PRIORITY_DEFAULT, state->resolution,
+            tick_callback, new std::weak_ptr<State>(state), free_state);
+
+    return id;
+}
+
+bool BluetoothPollScheduler::remove(unsigned int id)
+{
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    auto it = state->entries.find(id);
+    if (it == state->entries.end())
+        return false;
+
+    state->wheel.cancel(it->second.timer);
+    g_object_unref(it->second.object);
+    state->entries.erase(it);
+
+    if (state->entries.empty() && state->source != 0) {
+        g_source_remove(state->source);
+        state->source = 0;
+    }
+    return true;
+}
+
+uint64_t BluetoothPollScheduler::get_dropped(unsigned int id)
+{
+    std::lock_guard<std::mutex> lk(state->lock);
+
+    auto it = state->entries.find(id);
+    if (it == state->entries.end())
+        return 0;
+    return it->second.dropped;
+}
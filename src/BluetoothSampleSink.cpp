@@ -0,0 +1,501 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "BluetoothSampleSink.hpp"
+#include "BluetoothGattCharacteristic.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace tinyb;
+
+/* Segment layout: a header, a table of max_streams streams and the samples,
+ * each one aligned to 8 bytes. The writer publishes a sample by advancing
+ * header.used after copying it, so readers never see partial samples.
+ * Version 1 segments have no max_streams and a table of 64 streams. */
+
+#define SEGMENT_MAGIC "TINYBSEG"
+#define SEGMENT_VERSION 2
+#define SEGMENT_V1_STREAMS 64
+#define SEGMENT_STREAM_NAME 96
+#define SEGMENT_SUFFIX ".seg"
+
+struct SegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t stream_count;
+    uint64_t size;
+    uint64_t used;
+    uint32_t max_streams;
+    uint8_t reserved[28];
+};
+
+struct SegmentStream {
+    char name[SEGMENT_STREAM_NAME];
+    uint32_t count;
+    uint32_t reserved;
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+};
+
+struct SegmentSample {
+    int64_t timestamp;
+    uint16_t stream;
+    uint16_t size;
+    uint32_t reserved;
+};
+
+static size_t segment_data_offset(unsigned int max_streams)
+{
+    return sizeof(SegmentHeader) + max_streams * sizeof(SegmentStream);
+}
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t) 7;
+}
+
+static SegmentStream *segment_streams(unsigned char *base)
+{
+    return reinterpret_cast<SegmentStream *>(base + sizeof(SegmentHeader));
+}
+
+static const SegmentStream *segment_streams(const unsigned char *base)
+{
+    return reinterpret_cast<const SegmentStream *>(base + sizeof(SegmentHeader));
+}
+
+/* Syncs [from, to) of a mapping, from being rounded down to a page */
+static void sync_range(unsigned char *base, size_t from, size_t to)
+{
+    static const size_t page = sysconf(_SC_PAGESIZE);
+
+    if (to <= from)
+        return;
+    from -= from % page;
+    msync(base + from, to - from, MS_SYNC);
+}
+
+std::vector<std::string> BluetoothSampleReader::list_segments(
+    const std::string &directory)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(directory.c_str());
+
+    if (dir == NULL)
+        return names;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name(entry->d_name);
+        size_t suffix = strlen(SEGMENT_SUFFIX);
+        if (name.size() == 16 + suffix &&
+            name.compare(16, suffix, SEGMENT_SUFFIX) == 0 &&
+            name.find_first_not_of("0123456789") == 16)
+            names.push_back(name);
+    }
+    closedir(dir);
+
+    /* Fixed width numbers, so lexical order is the sequence order */
+    std::sort(names.begin(), names.end());
+    for (auto &name : names)
+        name = directory + "/" + name;
+    return names;
+}
+
+BluetoothSampleSink::BluetoothSampleSink(const std::string &directory,
+    size_t segment_size, std::chrono::milliseconds sync_interval,
+    unsigned int max_segments, unsigned int max_streams) :
+    directory(directory), segment_size(segment_size),
+    sync_interval(sync_interval), max_segments(max_segments),
+    max_streams(max_streams), data_offset(segment_data_offset(max_streams)),
+    next_sequence(0), dropped(0), spare_failed(false), sync_requested(false),
+    stopping(false)
+{
+    if (max_streams == 0 || max_streams > UINT16_MAX)
+        throw std::runtime_error("Invalid number of streams");
+    if (segment_size < data_offset + align8(sizeof(SegmentSample) + UINT16_MAX))
+        throw std::runtime_error("Segment size too small");
+
+    current.base = nullptr;
+    spare.base = nullptr;
+
+    for (auto &path : BluetoothSampleReader::list_segments(directory)) {
+        uint64_t sequence = strtoull(path.c_str() + directory.size() + 1, NULL, 10);
+        next_sequence = std::max(next_sequence, sequence + 1);
+    }
+
+    if (!open_segment(current, next_sequence++))
+        throw std::runtime_error("Cannot create segment in " + directory +
+            ": " + strerror(errno));
+
+    flusher = std::thread(&BluetoothSampleSink::flush_loop, this);
+}
+
+BluetoothSampleSink::~BluetoothSampleSink()
+{
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        stopping = true;
+        flusher_cv.notify_all();
+    }
+    flusher.join();
+
+    close_segment(current);
+
+    /* The spare segment was never written */
+    if (spare.base != nullptr) {
+        munmap(spare.base, spare.size);
+        close(spare.fd);
+        unlink(spare.path.c_str());
+    }
+}
+
+bool BluetoothSampleSink::open_segment(Segment &segment, uint64_t sequence)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "%016llu" SEGMENT_SUFFIX,
+        (unsigned long long) sequence);
+    segment.path = directory + "/" + name;
+
+    segment.fd = open(segment.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (segment.fd < 0)
+        return false;
+
+    if (ftruncate(segment.fd, segment_size) != 0) {
+        close(segment.fd);
+        unlink(segment.path.c_str());
+        return false;
+    }
+
+    void *base = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        segment.fd, 0);
+    if (base == MAP_FAILED) {
+        close(segment.fd);
+        unlink(segment.path.c_str());
+        return false;
+    }
+
+    segment.base = static_cast<unsigned char *>(base);
+    segment.size = segment_size;
+    segment.synced = 0;
+
+    SegmentHeader *header = reinterpret_cast<SegmentHeader *>(segment.base);
+    memcpy(header->magic, SEGMENT_MAGIC, sizeof(header->magic));
+    header->version = SEGMENT_VERSION;
+    header->stream_count = 0;
+    header->size = segment_size;
+    header->used = data_offset;
+    header->max_streams = max_streams;
+
+    return true;
+}
+
+void BluetoothSampleSink::close_segment(Segment &segment)
+{
+    if (segment.base == nullptr)
+        return;
+
+    SegmentHeader *header = reinterpret_cast<SegmentHeader *>(segment.base);
+    sync_range(segment.base, segment.synced, header->used);
+    munmap(segment.base, segment.size);
+    close(segment.fd);
+    segment.base = nullptr;
+}
+
+/* Called with lock held. Only switches to the spare segment, creating one
+ * is left to the flusher. */
+bool BluetoothSampleSink::rotate()
+{
+    if (spare.base == nullptr) {
+        /* A failed spare is retried at the flusher's own pace */
+        if (!spare_failed)
+            flusher_cv.notify_all();
+        return false;
+    }
+
+    if (current.base != nullptr)
+        retired.push_back(current);
+    current = spare;
+    spare.base = nullptr;
+
+    streams.clear();
+    flusher_cv.notify_all();
+    return true;
+}
+
+void BluetoothSampleSink::remove_old_segments(const std::string &current_path,
+    const std::string &spare_path)
+{
+    std::vector<std::string> old;
+
+    for (auto &path : BluetoothSampleReader::list_segments(directory))
+        if (path != current_path && path != spare_path)
+            old.push_back(path);
+
+    /* The current segment counts towards max_segments */
+    for (size_t i = 0; i + max_segments < old.size() + 1; i++)
+        unlink(old[i].c_str());
+}
+
+void BluetoothSampleSink::flush_loop()
+{
+    std::unique_lock<std::mutex> lk(lock);
+    std::chrono::steady_clock::time_point next_retry;
+
+    while (true) {
+        /* A spare which could not be created is retried at the next sync */
+        if (!stopping && !sync_requested && retired.empty() &&
+            (spare.base != nullptr || spare_failed))
+            flusher_cv.wait_for(lk, sync_interval);
+
+        std::vector<Segment> done;
+        done.swap(retired);
+        Segment active = current;
+        size_t used = 0;
+        if (active.base != nullptr)
+            used = reinterpret_cast<SegmentHeader *>(active.base)->used;
+        bool requested = sync_requested;
+        /* Other wakeups, like sync(), do not retry a failed spare early */
+        bool need_spare = spare.base == nullptr && !stopping &&
+            (!spare_failed || std::chrono::steady_clock::now() >= next_retry);
+        uint64_t sequence = need_spare ? next_sequence++ : 0;
+        bool stop = stopping;
+
+        /* Disk work is done without the lock, the mappings used here are
+         * only unmapped by this thread or after it exited */
+        lk.unlock();
+
+        for (auto &segment : done)
+            close_segment(segment);
+
+        if (active.base != nullptr)
+            sync_range(active.base, active.synced, used);
+
+        Segment next;
+        next.base = nullptr;
+        if (need_spare)
+            open_segment(next, sequence);
+
+        if (!done.empty() && max_segments != 0)
+            remove_old_segments(active.path, next.base ? next.path : std::string());
+
+        lk.lock();
+        if (need_spare) {
+            spare_failed = next.base == nullptr;
+            next_retry = std::chrono::steady_clock::now() + sync_interval;
+        }
+        if (next.base != nullptr)
+            spare = next;
+        if (current.base == active.base)
+            current.synced = used;
+        if (requested) {
+            sync_requested = false;
+            flusher_cv.notify_all();
+        }
+        if (stop)
+            break;
+    }
+}
+
+uint64_t BluetoothSampleSink::get_dropped()
+{
+    std::lock_guard<std::mutex> lk(lock);
+    return dropped;
+}
+
+void BluetoothSampleSink::sync()
+{
+    std::unique_lock<std::mutex> lk(lock);
+
+    sync_requested = true;
+    flusher_cv.notify_all();
+    while (sync_requested)
+        flusher_cv.wait(lk);
+}
+
+bool BluetoothSampleSink::append(const std::string &stream,
+    const unsigned char *data, size_t size, int64_t timestamp)
+{
+    if (size > UINT16_MAX)
+        return false;
+
+    std::string key = stream.substr(0, SEGMENT_STREAM_NAME - 1);
+    size_t record = align8(sizeof(SegmentSample) + size);
+    std::lock_guard<std::mutex> lk(lock);
+
+    SegmentHeader *header = reinterpret_cast<SegmentHeader *>(current.base);
+    auto it = streams.find(key);
+
+    if (header->used + record > current.size ||
+        (it == streams.end() && header->stream_count == max_streams)) {
+        if (!rotate()) {
+            dropped++;
+            return false;
+        }
+        header = reinterpret_cast<SegmentHeader *>(current.base);
+        it = streams.end();
+    }
+
+    SegmentStream *entries = segment_streams(current.base);
+    uint16_t id;
+    if (it == streams.end()) {
+        id = header->stream_count;
+        strncpy(entries[id].name, key.c_str(), SEGMENT_STREAM_NAME - 1);
+        entries[id].first_timestamp = timestamp;
+        __atomic_store_n(&header->stream_count, id + 1, __ATOMIC_RELEASE);
+        streams[key] = id;
+    } else
+        id = it->second;
+
+    SegmentSample sample = { timestamp, id, (uint16_t) size, 0 };
+    unsigned char *p = current.base + header->used;
+    memcpy(p, &sample, sizeof(sample));
+    memcpy(p + sizeof(sample), data, size);
+
+    entries[id].count++;
+    entries[id].last_timestamp = timestamp;
+    __atomic_store_n(&header->used, header->used + record, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+bool BluetoothSampleSink::append(BluetoothGattCharacteristic &characteristic,
+    const std::vector<unsigned char> &value)
+{
+    int64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    return append(characteristic.get_object_path(), value.data(), value.size(),
+        timestamp);
+}
+
+void BluetoothSampleSink::notification_callback(
+    BluetoothGattCharacteristic &characteristic,
+    std::shared_ptr<const std::vector<unsigned char>> value, void *data)
+{
+    static_cast<BluetoothSampleSink *>(data)->append(characteristic, *value);
+}
+
+BluetoothSampleReader::BluetoothSampleReader(const std::string &path)
+{
+    struct stat st;
+
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SegmentHeader)) {
+        close(fd);
+        throw std::runtime_error(path + " is not a tinyb segment");
+    }
+    size = st.st_size;
+
+    void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Cannot map " + path + ": " + strerror(errno));
+    }
+    base = static_cast<const unsigned char *>(p);
+
+    const SegmentHeader *header = reinterpret_cast<const SegmentHeader *>(base);
+    max_streams = header->version == 1 ? SEGMENT_V1_STREAMS : header->max_streams;
+    data_offset = segment_data_offset(max_streams);
+    if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version < 1 || header->version > SEGMENT_VERSION ||
+        data_offset > size) {
+        munmap(p, size);
+        close(fd);
+        throw std::runtime_error(path + " is not a tinyb segment");
+    }
+
+    offset = data_offset;
+}
+
+BluetoothSampleReader::~BluetoothSampleReader()
+{
+    munmap(const_cast<unsigned char *>(base), size);
+    close(fd);
+}
+
+std::vector<std::string> BluetoothSampleReader::get_streams() const
+{
+    const SegmentHeader *header = reinterpret_cast<const SegmentHeader *>(base);
+    uint32_t count = __atomic_load_n(&header->stream_count, __ATOMIC_ACQUIRE);
+    const SegmentStream *entries = segment_streams(base);
+    std::vector<std::string> streams;
+
+    for (uint32_t i = 0; i < count && i < max_streams; i++)
+        streams.push_back(std::string(entries[i].name,
+            strnlen(entries[i].name, SEGMENT_STREAM_NAME)));
+    return streams;
+}
+
+uint32_t BluetoothSampleReader::get_stream_info(uint16_t stream, int64_t &first,
+    int64_t &last) const
+{
+    if (stream >= max_streams)
+        return 0;
+
+    const SegmentStream &entry = segment_streams(base)[stream];
+    first = entry.first_timestamp;
+    last = entry.last_timestamp;
+    return entry.count;
+}
+
+bool BluetoothSampleReader::next(Sample &sample)
+{
+    const SegmentHeader *header = reinterpret_cast<const SegmentHeader *>(base);
+    size_t used = std::min((size_t) __atomic_load_n(&header->used, __ATOMIC_ACQUIRE), size);
+    SegmentSample record;
+
+    if (offset + sizeof(record) > used)
+        return false;
+
+    memcpy(&record, base + offset, sizeof(record));
+    if (offset + sizeof(record) + record.size > used)
+        return false;
+
+    sample.timestamp = record.timestamp;
+    sample.stream = record.stream;
+    sample.data = base + offset + sizeof(record);
+    sample.size = record.size;
+    offset += align8(sizeof(record) + record.size);
+
+    return true;
+}
+
+void BluetoothSampleReader::rewind()
+{
+    offset = data_offset;
+}
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# Author: Petre Eftime <petre.p.eftime@intel.com>
+# Copyright (c) 2015 Intel Corporation.
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+# LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+# OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+# WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+"""Generates tag types for the properties and methods of the interfaces in
+org.bluez.xml, used with the templated accessors of tinyb_bluez.hpp.
+
+Usage: generate_bluez_types.py <org.bluez.xml> <output.hpp>
+"""
+
+import sys
+import xml.etree.ElementTree as ElementTree
+
+# D-Bus signature to C++ type, the conversions are in tinyb_bluez.hpp
+TYPES = {
+    'b': 'bool',
+    'y': 'uint8_t',
+    'n': 'int16_t',
+    'q': 'uint16_t',
+    'i': 'int32_t',
+    'u': 'uint32_t',
+    'x': 'int64_t',
+    't': 'uint64_t',
+    'd': 'double',
+    's': 'std::string',
+    'o': 'std::string',
+    'as': 'std::vector<std::string>',
+    'ao': 'std::vector<std::string>',
+    'ay': 'std::vector<unsigned char>',
+}
+
+
+def cpp_type(signature, where):
+    if signature not in TYPES:
+        sys.exit('%s: unsupported signature %s' % (where, signature))
+    return TYPES[signature]
+
+
+def generate_property(interface, prop):
+    name = prop.get('name')
+    signature = prop.get('type')
+    where = '%s.%s' % (interface, name)
+    return [
+        '    struct %s {' % name,
+        '        typedef %s type;' % cpp_type(signature, where),
+        '        static constexpr const char *interface() { return "%s"; }' % interface,
+        '        static constexpr const char *name() { return "%s"; }' % name,
+        '        static constexpr const char *signature() { return "%s"; }' % signature,
+        '        static constexpr bool writable() { return %s; }'
+            % ('true' if 'write' in prop.get('access') else 'false'),
+        '    };',
+    ]
+
+
+def generate_method(interface, method):
+    name = method.get('name')
+    where = '%s.%s' % (interface, name)
+    args_in = [a.get('type') for a in method.findall('arg')
+               if a.get('direction', 'in') == 'in']
+    args_out = [a.get('type') for a in method.findall('arg')
+                if a.get('direction') == 'out']
+    if len(args_out) > 1:
+        sys.exit('%s: more than one out argument' % where)
+
+    for signature in args_in:
+        cpp_type(signature, where)
+    in_signature = ' : '.join('i == %d ? "%s"' % (i, s)
+                              for i, s in enumerate(args_in))
+    in_signature += ' : nullptr' if args_in else 'nullptr'
+
+    return [
+        '    struct %s {' % name,
+        '        typedef %s out_type;'
+            % (cpp_type(args_out[0], where) if args_out else 'void'),
+        '        static constexpr unsigned int in_count = %d;' % len(args_in),
+        '        static constexpr const char *interface() { return "%s"; }' % interface,
+        '        static constexpr const char *name() { return "%s"; }' % name,
+        '        static constexpr const char *in_signature(unsigned int%s) {'
+            % (' i' if args_in else ''),
+        '            return %s;' % in_signature,
+        '        }',
+        '        static constexpr const char *out_signature() { return "(%s)"; }'
+            % ''.join(args_out),
+        '    };',
+    ]
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+
+    lines = [
+        '/* Generated by generate_bluez_types.py from org.bluez.xml, do not edit */',
+        '',
+        '#pragma once',
+        '',
+        '#include <cstdint>',
+        '#include <string>',
+        '#include <vector>',
+        '',
+        'namespace tinyb {',
+        'namespace bluez {',
+    ]
+
+    for interface in ElementTree.parse(sys.argv[1]).getroot().findall('interface'):
+        full_name = interface.get('name')
+        names = set()
+        lines += ['', 'namespace %s {' % full_name.split('.')[-1]]
+        for member in interface:
+            if member.tag not in ('property', 'method'):
+                continue
+            if member.get('name') in names:
+                sys.exit('%s: duplicate member %s' % (full_name, member.get('name')))
+            names.add(member.get('name'))
+            lines.append('')
+            if member.tag == 'property':
+                lines += generate_property(full_name, member)
+            else:
+                lines += generate_method(full_name, member)
+        lines += ['', '}']
+
+    lines += ['', '}', '}']
+
+    with open(sys.argv[2], 'w') as output:
+        output.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
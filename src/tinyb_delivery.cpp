@@ -0,0 +1,86 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "tinyb_delivery.hpp"
+
+using namespace tinyb;
+
+/* Enough for a few slow subscribers not to stall the others */
+#define DELIVERY_THREADS 4
+
+DeliveryWorker &DeliveryWorker::get()
+{
+    /* Never destroyed, its threads run until the process exits */
+    static DeliveryWorker *worker = new DeliveryWorker();
+    return *worker;
+}
+
+void DeliveryWorker::schedule(std::shared_ptr<DeliveryTask> task, TimePoint due)
+{
+    std::lock_guard<std::mutex> lk(lock);
+
+    if (due <= std::chrono::steady_clock::now())
+        ready.push_back(task);
+    else
+        timers.push(Timer{due, ++last_order, task});
+
+    /* Threads are started as they are needed */
+    if (threads < DELIVERY_THREADS && threads < ready.size() + timers.size()) {
+        threads++;
+        std::thread(&DeliveryWorker::loop, this).detach();
+    } else
+        cv.notify_one();
+}
+
+void DeliveryWorker::loop()
+{
+    std::unique_lock<std::mutex> lk(lock);
+
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        while (!timers.empty() && timers.top().due <= now) {
+            ready.push_back(timers.top().task);
+            timers.pop();
+        }
+
+        if (ready.empty()) {
+            if (timers.empty())
+                cv.wait(lk);
+            else
+                cv.wait_until(lk, timers.top().due);
+            continue;
+        }
+
+        auto task = ready.front().lock();
+        ready.pop_front();
+        if (task == nullptr)
+            continue;
+
+        lk.unlock();
+        task->run();
+        task.reset();
+        lk.lock();
+    }
+}
@@ -0,0 +1,407 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tinyb_recorder.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/* Recorder */
+
+static std::mutex recorder_lock;
+static FILE *recorder_file = NULL;
+static GDBusConnection *recorder_connection = NULL;
+static guint recorder_filter_id;
+
+static GDBusMessage *recorder_filter(GDBusConnection *connection,
+    GDBusMessage *message, gboolean incoming, gpointer user_data)
+{
+    GError *error = NULL;
+    guint64 timestamp = g_get_monotonic_time();
+    guint8 direction = incoming ? TINYB_RECORD_INCOMING : TINYB_RECORD_OUTGOING;
+    gsize size;
+
+    (void) connection;
+    (void) user_data;
+
+    guchar *blob = g_dbus_message_to_blob(message, &size,
+        G_DBUS_CAPABILITY_FLAGS_NONE, &error);
+    if (blob == NULL) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        return message;
+    }
+
+    guint32 length = size;
+    {
+        std::lock_guard<std::mutex> lk(recorder_lock);
+        if (recorder_file != NULL) {
+            fwrite(&timestamp, sizeof(timestamp), 1, recorder_file);
+            fwrite(&direction, sizeof(direction), 1, recorder_file);
+            fwrite(&length, sizeof(length), 1, recorder_file);
+            fwrite(blob, 1, length, recorder_file);
+        }
+    }
+    g_free(blob);
+
+    return message;
+}
+
+bool tinyb::recorder_start(GDBusConnection *connection, const gchar *name,
+    const gchar *path, GError **error)
+{
+    {
+        std::lock_guard<std::mutex> lk(recorder_lock);
+        if (recorder_file != NULL) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                "Recording already in progress");
+            return false;
+        }
+
+        recorder_file = fopen(path, "ab");
+        if (recorder_file == NULL) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                "Cannot open %s: %s", path, g_strerror(errno));
+            return false;
+        }
+
+        fseek(recorder_file, 0, SEEK_END);
+        if (ftell(recorder_file) == 0)
+            fwrite(TINYB_RECORD_MAGIC, 1, strlen(TINYB_RECORD_MAGIC), recorder_file);
+
+        recorder_connection = G_DBUS_CONNECTION(g_object_ref(connection));
+        recorder_filter_id = g_dbus_connection_add_filter(connection,
+            recorder_filter, NULL, NULL);
+    }
+
+    /* Log the current objects, a replay starts from this state */
+    GVariant *objects = g_dbus_connection_call_sync(connection, name, "/",
+        "org.freedesktop.DBus.ObjectManager", "GetManagedObjects", NULL, NULL,
+        G_DBUS_CALL_FLAGS_NONE, -1, NULL, error);
+    if (objects == NULL) {
+        recorder_stop();
+        return false;
+    }
+    g_variant_unref(objects);
+
+    return true;
+}
+
+void tinyb::recorder_stop()
+{
+    std::lock_guard<std::mutex> lk(recorder_lock);
+
+    if (recorder_file == NULL)
+        return;
+
+    g_dbus_connection_remove_filter(recorder_connection, recorder_filter_id);
+    g_object_unref(recorder_connection);
+    recorder_connection = NULL;
+
+    fclose(recorder_file);
+    recorder_file = NULL;
+}
+
+/* Replayer */
+
+struct ReplayRecord {
+    guint64 timestamp;
+    GDBusMessage *message;
+};
+
+static std::vector<ReplayRecord> replay_signals;
+/* Recorded replies, by path, interface and method of the call */
+static std::map<std::string, std::deque<GDBusMessage *>> replay_replies;
+static std::mutex replay_lock;
+static std::condition_variable replay_cv;
+static bool replay_started = false;
+static std::atomic_bool replay_done(false);
+static bool replay_realtime;
+
+static std::string call_key(GDBusMessage *message)
+{
+    std::string key;
+    const gchar *s;
+
+    if ((s = g_dbus_message_get_path(message)) != NULL)
+        key += s;
+    key += '\n';
+    if ((s = g_dbus_message_get_interface(message)) != NULL)
+        key += s;
+    key += '\n';
+    if ((s = g_dbus_message_get_member(message)) != NULL)
+        key += s;
+    return key;
+}
+
+static bool is_initial_state_call(GDBusMessage *message)
+{
+    return g_strcmp0(g_dbus_message_get_member(message), "GetManagedObjects") == 0;
+}
+
+static bool replay_load(const gchar *path, GError **error)
+{
+    gchar *contents;
+    gsize length;
+
+    if (!g_file_get_contents(path, &contents, &length, error))
+        return false;
+
+    gsize magic = strlen(TINYB_RECORD_MAGIC);
+    if (length < magic || memcmp(contents, TINYB_RECORD_MAGIC, magic) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+            "%s is not a tinyb recording", path);
+        g_free(contents);
+        return false;
+    }
+
+    std::map<guint32, std::string> calls;
+    bool initial_state = false;
+    gsize offset = magic;
+    const gsize header = sizeof(guint64) + sizeof(guint8) + sizeof(guint32);
+
+    while (offset + header <= length) {
+        guint64 timestamp;
+        guint8 direction;
+        guint32 size;
+
+        memcpy(&timestamp, contents + offset, sizeof(timestamp));
+        memcpy(&direction, contents + offset + sizeof(timestamp), sizeof(direction));
+        memcpy(&size, contents + offset + sizeof(timestamp) + sizeof(direction),
+            sizeof(size));
+        offset += header;
+
+        /* A truncated last record is left by an interrupted recording */
+        if (offset + size > length)
+            break;
+
+        GDBusMessage *message = g_dbus_message_new_from_blob(
+            (guchar *) contents + offset, size, G_DBUS_CAPABILITY_FLAGS_NONE, NULL);
+        offset += size;
+        if (message == NULL)
+            continue;
+
+        GDBusMessageType type = g_dbus_message_get_message_type(message);
+
+        if (direction == TINYB_RECORD_OUTGOING) {
+            if (type == G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+                calls[g_dbus_message_get_serial(message)] = call_key(message);
+            g_object_unref(message);
+        } else if (type == G_DBUS_MESSAGE_TYPE_SIGNAL) {
+            /* Signals older than the initial state are already part of it,
+             * the ones of the bus itself are not meant for tinyb */
+            if (!initial_state || g_strcmp0(g_dbus_message_get_sender(message),
+                    "org.freedesktop.DBus") == 0)
+                g_object_unref(message);
+            else
+                replay_signals.push_back(ReplayRecord{timestamp, message});
+        } else {
+            auto call = calls.find(g_dbus_message_get_reply_serial(message));
+            if (call == calls.end()) {
+                g_object_unref(message);
+                continue;
+            }
+            if (!initial_state && g_str_has_suffix(call->second.c_str(),
+                    "\nGetManagedObjects")) {
+                initial_state = true;
+                replay_signals.push_back(ReplayRecord{timestamp, NULL});
+            }
+            replay_replies[call->second].push_back(message);
+            calls.erase(call);
+        }
+    }
+
+    g_free(contents);
+    return true;
+}
+
+static GDBusMessage *replay_filter(GDBusConnection *connection,
+    GDBusMessage *message, gboolean incoming, gpointer user_data)
+{
+    GDBusMessage *reply = NULL;
+
+    (void) user_data;
+
+    if (!incoming ||
+        g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+        return message;
+
+    {
+        std::lock_guard<std::mutex> lk(replay_lock);
+        auto replies = replay_replies.find(call_key(message));
+
+        /* Replies are used in order, the last one answers repeated calls */
+        if (replies != replay_replies.end() && !replies->second.empty()) {
+            reply = g_dbus_message_copy(replies->second.front(), NULL);
+            if (replies->second.size() > 1) {
+                g_object_unref(replies->second.front());
+                replies->second.pop_front();
+            }
+        }
+    }
+
+    if (reply != NULL) {
+        g_dbus_message_set_reply_serial(reply, g_dbus_message_get_serial(message));
+        g_dbus_message_set_destination(reply, NULL);
+    } else {
+        reply = g_dbus_message_new_method_error(message,
+            "org.freedesktop.DBus.Error.UnknownMethod",
+            "No reply recorded for %s.%s",
+            g_dbus_message_get_interface(message),
+            g_dbus_message_get_member(message));
+    }
+
+    if (!(g_dbus_message_get_flags(message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED))
+        g_dbus_connection_send_message(connection, reply,
+            G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL, NULL);
+    g_object_unref(reply);
+
+    if (is_initial_state_call(message)) {
+        std::lock_guard<std::mutex> lk(replay_lock);
+        replay_started = true;
+        replay_cv.notify_all();
+    }
+
+    g_object_unref(message);
+    return NULL;
+}
+
+static gpointer replay_thread(gpointer data)
+{
+    GIOStream *stream = G_IO_STREAM(data);
+    GError *error = NULL;
+    gchar *guid = g_dbus_generate_guid();
+
+    GDBusConnection *server = g_dbus_connection_new_sync(stream, guid,
+        (GDBusConnectionFlags) (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER |
+        G_DBUS_CONNECTION_FLAGS_DELAY_MESSAGE_PROCESSING), NULL, NULL, &error);
+    g_free(guid);
+    g_object_unref(stream);
+
+    if (server == NULL) {
+        g_printerr("Error: %s\n", error->message);
+        g_error_free(error);
+        replay_done = true;
+        return NULL;
+    }
+
+    g_dbus_connection_add_filter(server, replay_filter, NULL, NULL);
+    g_dbus_connection_start_message_processing(server);
+
+    {
+        std::unique_lock<std::mutex> lk(replay_lock);
+        while (!replay_started)
+            replay_cv.wait(lk);
+    }
+
+    guint64 start = g_get_monotonic_time();
+    guint64 origin = replay_signals.empty() ? 0 : replay_signals.front().timestamp;
+
+    for (auto &record : replay_signals) {
+        if (record.message == NULL)
+            continue;
+
+        if (replay_realtime && record.timestamp > origin) {
+            guint64 due = start + (record.timestamp - origin);
+            guint64 now = g_get_monotonic_time();
+            if (due > now)
+                g_usleep(due - now);
+        }
+
+        GDBusMessage *signal = g_dbus_message_copy(record.message, NULL);
+        if (signal == NULL)
+            continue;
+        g_dbus_message_set_destination(signal, NULL);
+        g_dbus_connection_send_message(server, signal,
+            G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL, NULL);
+        g_object_unref(signal);
+    }
+
+    g_dbus_connection_flush_sync(server, NULL, NULL);
+    replay_done = true;
+
+    /* The server keeps answering calls for the lifetime of the process */
+    return NULL;
+}
+
+GDBusConnection *tinyb::replayer_new_connection(const gchar *path,
+    bool realtime, GError **error)
+{
+    int fds[2];
+
+    if (!replay_load(path, error))
+        return NULL;
+    replay_realtime = realtime;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+            "socketpair: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    GSocket *server_socket = g_socket_new_from_fd(fds[0], error);
+    if (server_socket == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    GSocket *client_socket = g_socket_new_from_fd(fds[1], error);
+    if (client_socket == NULL) {
+        g_object_unref(server_socket);
+        close(fds[1]);
+        return NULL;
+    }
+
+    GSocketConnection *server_stream =
+        g_socket_connection_factory_create_connection(server_socket);
+    GSocketConnection *client_stream =
+        g_socket_connection_factory_create_connection(client_socket);
+    g_object_unref(server_socket);
+    g_object_unref(client_socket);
+
+    /* Both sides have to run the authentication at the same time */
+    g_thread_unref(g_thread_new("tinyb-replay", replay_thread, server_stream));
+
+    GDBusConnection *connection = g_dbus_connection_new_sync(
+        G_IO_STREAM(client_stream), NULL,
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT, NULL, NULL, error);
+    g_object_unref(client_stream);
+
+    return connection;
+}
+
+bool tinyb::replayer_finished()
+{
+    return replay_done;
+}
@@ -0,0 +1,215 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "generated-code.h"
+#include "tinyb_utils.hpp"
+#include "tinyb_stats.hpp"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+StatsHeader *stats_header = NULL;
+
+static std::mutex stats_lock;
+static std::unordered_map<std::string, uint32_t> stats_entries;
+/* Entries of removed objects, below entry_count */
+static std::vector<uint32_t> stats_free;
+
+static StatsEntry *stats_entries_base()
+{
+    return reinterpret_cast<StatsEntry *>(
+        reinterpret_cast<unsigned char *>(stats_header) + stats_header->entries_offset);
+}
+
+static StatsEntry *stats_entry(const char *path, uint32_t type)
+{
+    StatsEntry *entries = stats_entries_base();
+
+    std::lock_guard<std::mutex> lk(stats_lock);
+    auto it = stats_entries.find(path);
+    if (it != stats_entries.end())
+        return &entries[it->second];
+
+    uint32_t index;
+    if (!stats_free.empty()) {
+        index = stats_free.back();
+        stats_free.pop_back();
+    } else {
+        index = stats_header->entry_count.load(std::memory_order_relaxed);
+        if (index >= stats_header->entry_capacity)
+            return NULL;
+        stats_header->entry_count.store(index + 1, std::memory_order_release);
+    }
+
+    StatsEntry *entry = &entries[index];
+    entry->notifications.store(0, std::memory_order_relaxed);
+    entry->type = type;
+    memset(entry->path, 0, sizeof(entry->path));
+    strncpy(entry->path, path, sizeof(entry->path) - 1);
+    entry->flags.store(STATS_FLAG_PRESENT, std::memory_order_release);
+    stats_header->entry_used.fetch_add(1, std::memory_order_relaxed);
+    stats_entries[path] = index;
+    return entry;
+}
+
+/* Returns the entry of a removed object to the free list */
+static void stats_release(const char *path)
+{
+    std::lock_guard<std::mutex> lk(stats_lock);
+    auto it = stats_entries.find(path);
+    if (it == stats_entries.end())
+        return;
+
+    stats_entries_base()[it->second].flags.store(0, std::memory_order_release);
+    stats_header->entry_used.fetch_sub(1, std::memory_order_relaxed);
+    stats_free.push_back(it->second);
+    stats_entries.erase(it);
+}
+
+StatsEntry *stats_characteristic(const char *path)
+{
+    if (stats_header == NULL)
+        return NULL;
+
+    return stats_entry(path, STATS_ENTRY_CHARACTERISTIC);
+}
+
+void stats_device(const char *path, bool connected)
+{
+    if (stats_header == NULL)
+        return;
+
+    StatsEntry *entry = stats_entry(path, STATS_ENTRY_DEVICE);
+    if (entry != NULL)
+        entry->flags.store(STATS_FLAG_PRESENT |
+            (connected ? STATS_FLAG_CONNECTED : 0), std::memory_order_relaxed);
+}
+
+static void on_properties_changed(GDBusObjectManagerClient *manager,
+    GDBusObjectProxy *object_proxy, GDBusProxy *interface_proxy,
+    GVariant *changed_properties, const gchar *const *invalidated_properties,
+    gpointer user_data)
+{
+    (void) manager;
+    (void) object_proxy;
+    (void) invalidated_properties;
+    (void) user_data;
+
+    stats_add(StatsCounter::SIGNALS);
+    stats_add(StatsCounter::PROPERTY_CHANGES,
+        g_variant_n_children(changed_properties));
+
+    if (!IS_DEVICE1_PROXY(interface_proxy))
+        return;
+    GVariant *connected = g_variant_lookup_value(changed_properties,
+        "Connected", G_VARIANT_TYPE_BOOLEAN);
+    if (connected != NULL) {
+        stats_device(g_dbus_proxy_get_object_path(interface_proxy),
+            g_variant_get_boolean(connected));
+        g_variant_unref(connected);
+    }
+}
+
+static void on_object_added(GDBusObjectManager *manager, GDBusObject *object,
+    gpointer user_data)
+{
+    (void) manager;
+    (void) user_data;
+
+    stats_add(StatsCounter::OBJECTS_ADDED);
+    Device1 *device = object_peek_device1(OBJECT(object));
+    if (device != NULL)
+        stats_device(g_dbus_object_get_object_path(object),
+            device1_get_connected(device));
+}
+
+static void on_object_removed(GDBusObjectManager *manager, GDBusObject *object,
+    gpointer user_data)
+{
+    (void) manager;
+    (void) user_data;
+
+    stats_add(StatsCounter::OBJECTS_REMOVED);
+    if (object_peek_device1(OBJECT(object)) != NULL ||
+        object_peek_gatt_characteristic1(OBJECT(object)) != NULL)
+        stats_release(g_dbus_object_get_object_path(object));
+}
+
+bool stats_enable(const std::string &name)
+{
+    if (stats_header != NULL)
+        return true;
+
+    size_t entries_offset = (sizeof(StatsHeader) + 63) & ~(size_t) 63;
+    size_t size = entries_offset + STATS_ENTRIES * sizeof(StatsEntry);
+    std::string path = stats_path(name);
+
+    unlink(path.c_str());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        g_printerr("Error: cannot create %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        g_printerr("Error: cannot map %s\n", path.c_str());
+        unlink(path.c_str());
+        return false;
+    }
+
+    /* The file is zero filled, which is a valid state of all counters */
+    StatsHeader *header = static_cast<StatsHeader *>(map);
+    header->version = STATS_VERSION;
+    header->pid = getpid();
+    header->started = g_get_real_time();
+    header->entry_capacity = STATS_ENTRIES;
+    header->entries_offset = entries_offset;
+    stats_header = header;
+
+    GList *l, *objects = g_dbus_object_manager_get_objects(gdbus_manager);
+    for (l = objects; l != NULL; l = l->next)
+        on_object_added(gdbus_manager, G_DBUS_OBJECT(l->data), NULL);
+    g_list_free_full(objects, g_object_unref);
+
+    g_signal_connect(gdbus_manager, "interface-proxy-properties-changed",
+        G_CALLBACK(on_properties_changed), NULL);
+    g_signal_connect(gdbus_manager, "object-added",
+        G_CALLBACK(on_object_added), NULL);
+    g_signal_connect(gdbus_manager, "object-removed",
+        G_CALLBACK(on_object_removed), NULL);
+
+    /* Tools check the magic last */
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, STATS_MAGIC, sizeof(header->magic));
+    return true;
+}
@@ -24,6 +24,9 @@
 
 #include "tinyb_utils.hpp"
 
+#include <mutex>
+#include <condition_variable>
+
 std::vector<unsigned char> tinyb::from_gbytes_to_vector(const GBytes *bytes)
 {
     gsize result_size;
@@ -38,6 +41,15 @@ std::vector<unsigned char> tinyb::from_gbytes_to_vector(const GBytes *bytes)
     return result;
 }
 
+/* compares by D-Bus path, without instantiating a proxy for path */
+bool tinyb::is_same_object(BluetoothObject *object, BluetoothType type, const gchar *path)
+{
+    if (object == nullptr || path == nullptr)
+        return false;
+
+    return object->get_bluetooth_type() == type && object->get_object_path() == path;
+}
+
 /* it allocates memory - the result that is being returned is from heap */
 GBytes *tinyb::from_vector_to_gbytes(const std::vector<unsigned char>& vector)
 {
@@ -50,3 +62,38 @@ GBytes *tinyb::from_vector_to_gbytes(const std::vector<unsigned char>& vector)
 
     return result;
 }
+
+struct Invocation {
+    void (*fn)(void *);
+    void *data;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool done;
+};
+
+static gboolean invoke_callback(gpointer data)
+{
+    Invocation *invocation = static_cast<Invocation *>(data);
+
+    invocation->fn(invocation->data);
+
+    std::lock_guard<std::mutex> lk(invocation->lock);
+    invocation->done = true;
+    invocation->cv.notify_one();
+    return G_SOURCE_REMOVE;
+}
+
+/* Runs inline if the calling thread owns the context or can acquire it, the
+ * latter also keeping it from dispatching meanwhile */
+void tinyb::run_on_event_thread(void (*fn)(void *), void *data)
+{
+    Invocation invocation;
+    invocation.fn = fn;
+    invocation.data = data;
+    invocation.done = false;
+
+    g_main_context_invoke(g_main_context_default(), invoke_callback, &invocation);
+
+    std::unique_lock<std::mutex> lk(invocation.lock);
+    invocation.cv.wait(lk, [&invocation] { return invocation.done; });
+}
@@ -0,0 +1,315 @@
+/*
+ * Author: Petre Eftime <petre.p.eftime@intel.com>
+ * Copyright (c) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tinyb_watch.hpp"
+
+#include <cstring>
+#include <mutex>
+#include <set>
+
+#define ADAPTER_INTERFACE "org.bluez.Adapter1"
+#define PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
+#define OBJECT_MANAGER_INTERFACE "org.freedesktop.DBus.ObjectManager"
+
+/* The paths are only set before watch_start(), the rest is shared with the
+ * filter, which runs on the GDBus worker thread */
+static std::vector<std::string> watch_paths;
+static std::mutex watch_lock;
+static GDBusConnection *watch_connection = NULL;
+static std::string watch_name;
+static bool watch_discovery = false;
+/* Serials of the GetManagedObjects calls whose replies are filtered */
+static std::set<guint32> watch_managed_calls;
+/* Serializes watch_set_discovery(), which cannot hold watch_lock while
+ * calling the bus as the reply goes through the filter */
+static std::mutex discovery_lock;
+
+static bool is_watched(const gchar *path)
+{
+    if (path == NULL)
+        return false;
+
+    size_t length = strlen(path);
+    for (auto &p : watch_paths) {
+        if (p == "/")
+            return true;
+        if (length >= p.size() && p.compare(0, p.size(), path, p.size()) == 0 &&
+            (length == p.size() || path[p.size()] == '/'))
+            return true;
+    }
+    return false;
+}
+
+/* Properties of the adapters, replacing the rule for every signal */
+static std::string adapter_rule(const std::string &sender)
+{
+    return "type='signal',sender='" + sender + "',interface='" PROPERTIES_INTERFACE
+        "',member='PropertiesChanged',arg0='" ADAPTER_INTERFACE "'";
+}
+
+/* Signals of the objects under path and their addition or removal, which
+ * is signaled on / with the object as first argument */
+static std::vector<std::string> path_rules(const std::string &sender,
+    const std::string &path)
+{
+    std::string prefix = "type='signal',sender='" + sender + "',";
+    std::string manager = prefix + "path='/',interface='" OBJECT_MANAGER_INTERFACE
+        "',arg0path='";
+
+    return {
+        prefix + "path_namespace='" + path + "'",
+        manager + path + "'",
+        manager + path + "/'"
+    };
+}
+
+static std::string discovery_rule(const std::string &sender)
+{
+    return "type='signal',sender='" + sender + "',path='/',interface='"
+        OBJECT_MANAGER_INTERFACE "'";
+}
+
+static bool call_bus(GDBusConnection *connection, const gchar *method,
+    const std::string &rule, GError **error)
+{
+    GVariant *reply = g_dbus_connection_call_sync(connection,
+        "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+        method, g_variant_new("(s)", rule.c_str()), NULL,
+        G_DBUS_CALL_FLAGS_NONE, -1, NULL, error);
+    if (reply == NULL)
+        return false;
+    g_variant_unref(reply);
+    return true;
+}
+
+/* The rule of the object manager client for every signal of the owner of
+ * the objects, with a path_namespace of / in older GLib versions */
+static bool is_broad_rule(const gchar *rule, std::string &sender)
+{
+    static const char prefix[] = "type='signal',sender='";
+    static const char suffix[] = "',path_namespace='/";
+
+    if (strncmp(rule, prefix, strlen(prefix)) != 0)
+        return false;
+
+    sender = rule + strlen(prefix);
+    if (sender.empty() || sender.back() != '\'')
+        return false;
+    sender.pop_back();
+
+    if (sender.size() > strlen(suffix) &&
+        sender.compare(sender.size() - strlen(suffix), std::string::npos, suffix) == 0)
+        sender.resize(sender.size() - strlen(suffix));
+    return sender.find('\'') == std::string::npos;
+}
+
+/* Called with watch_lock held */
+static GVariant *filter_objects(GVariant *body)
+{
+    GVariantBuilder builder;
+    GVariantIter *objects;
+    const gchar *path;
+    GVariant *interfaces;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+    g_variant_get(body, "(a{oa{sa{sv}}})", &objects);
+    while (g_variant_iter_next(objects, "{&o@a{sa{sv}}}", &path, &interfaces)) {
+        GVariant *adapter = g_variant_lookup_value(interfaces, ADAPTER_INTERFACE, NULL);
+
+        if (watch_discovery || adapter != NULL || is_watched(path))
+            g_variant_builder_add(&builder, "{o@a{sa{sv}}}", path, interfaces);
+
+        if (adapter != NULL)
+            g_variant_unref(adapter);
+        g_variant_unref(interfaces);
+    }
+    g_variant_iter_free(objects);
+
+    return g_variant_new("(a{oa{sa{sv}}})", &builder);
+}
+
+static GDBusMessage *watch_outgoing(GDBusMessage *message)
+{
+    const gchar *member = g_dbus_message_get_member(message);
+
+    if (g_strcmp0(member, "GetManagedObjects") == 0 &&
+        g_strcmp0(g_dbus_message_get_interface(message), OBJECT_MANAGER_INTERFACE) == 0) {
+        std::lock_guard<std::mutex> lk(watch_lock);
+        watch_managed_calls.insert(g_dbus_message_get_serial(message));
+        return message;
+    }
+
+    if ((g_strcmp0(member, "AddMatch") != 0 && g_strcmp0(member, "RemoveMatch") != 0) ||
+        g_strcmp0(g_dbus_message_get_destination(message), "org.freedesktop.DBus") != 0)
+        return message;
+
+    GVariant *body = g_dbus_message_get_body(message);
+    const gchar *rule;
+    std::string sender;
+
+    if (body == NULL || !g_variant_is_of_type(body, G_VARIANT_TYPE("(s)")))
+        return message;
+    g_variant_get(body, "(&s)", &rule);
+    if (!is_broad_rule(rule, sender))
+        return message;
+
+    /* Outgoing messages are locked, the serial is kept by the copy */
+    GDBusMessage *copy = g_dbus_message_copy(message, NULL);
+    if (copy == NULL)
+        return message;
+    g_dbus_message_set_body(copy, g_variant_new("(s)", adapter_rule(sender).c_str()));
+    g_object_unref(message);
+    return copy;
+}
+
+static GDBusMessage *watch_filter(GDBusConnection *connection,
+    GDBusMessage *message, gboolean incoming, gpointer user_data)
+{
+    GDBusMessageType type = g_dbus_message_get_message_type(message);
+    GVariant *body = g_dbus_message_get_body(message);
+    bool keep = true;
+
+    (void) connection;
+    (void) user_data;
+
+    if (!incoming)
+        return type == G_DBUS_MESSAGE_TYPE_METHOD_CALL ? watch_outgoing(message) : message;
+
+    std::lock_guard<std::mutex> lk(watch_lock);
+
+    if (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN) {
+        if (watch_managed_calls.erase(g_dbus_message_get_reply_serial(message)) > 0 &&
+            body != NULL && g_variant_is_of_type(body, G_VARIANT_TYPE("(a{oa{sa{sv}}})")))
+            g_dbus_message_set_body(message, filter_objects(body));
+        return message;
+    }
+
+    if (type != G_DBUS_MESSAGE_TYPE_SIGNAL || body == NULL)
+        return message;
+
+    /* Anything the match rules of another connection would let through */
+    const gchar *interface = g_dbus_message_get_interface(message);
+    if (g_strcmp0(interface, PROPERTIES_INTERFACE) == 0 &&
+        g_variant_is_of_type(body, G_VARIANT_TYPE("(sa{sv}as)"))) {
+        const gchar *changed;
+        g_variant_get_child(body, 0, "&s", &changed);
+        keep = g_strcmp0(changed, ADAPTER_INTERFACE) == 0 ||
+            is_watched(g_dbus_message_get_path(message));
+    } else if (g_strcmp0(interface, OBJECT_MANAGER_INTERFACE) == 0 &&
+        g_variant_n_children(body) > 0) {
+        GVariant *object = g_variant_get_child_value(body, 0);
+        if (g_variant_is_of_type(object, G_VARIANT_TYPE_OBJECT_PATH))
+            keep = watch_discovery || is_watched(g_variant_get_string(object, NULL));
+        g_variant_unref(object);
+    }
+
+    if (keep)
+        return message;
+    g_object_unref(message);
+    return NULL;
+}
+
+void tinyb::watch_set_paths(const std::vector<std::string> &paths)
+{
+    watch_paths.clear();
+    for (auto path : paths) {
+        while (path.size() > 1 && path.back() == '/')
+            path.pop_back();
+        if (!path.empty())
+            watch_paths.push_back(path);
+    }
+}
+
+bool tinyb::watch_enabled()
+{
+    return !watch_paths.empty();
+}
+
+GDBusConnection *tinyb::watch_new_connection(GError **error)
+{
+    gchar *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SYSTEM, NULL, error);
+    if (address == NULL)
+        return NULL;
+
+    GDBusConnection *connection = g_dbus_connection_new_for_address_sync(address,
+        (GDBusConnectionFlags) (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION), NULL, NULL, error);
+    g_free(address);
+    return connection;
+}
+
+bool tinyb::watch_start(GDBusConnection *connection, const gchar *name,
+    GError **error)
+{
+    {
+        std::lock_guard<std::mutex> lk(watch_lock);
+        watch_connection = G_DBUS_CONNECTION(g_object_ref(connection));
+        watch_name = name != NULL ? name : "";
+    }
+    g_dbus_connection_add_filter(connection, watch_filter, NULL, NULL);
+
+    if (name == NULL)
+        return true;
+
+    for (auto &path : watch_paths)
+        for (auto &rule : path_rules(name, path))
+            if (!call_bus(connection, "AddMatch", rule, error))
+                return false;
+    return true;
+}
+
+bool tinyb::watch_set_discovery(bool enabled, GError **error)
+{
+    std::lock_guard<std::mutex> discovery(discovery_lock);
+    GDBusConnection *connection;
+    std::string name;
+
+    {
+        std::lock_guard<std::mutex> lk(watch_lock);
+        if (watch_connection == NULL) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+                "Selective watch mode is not enabled");
+            return false;
+        }
+        if (watch_discovery == enabled)
+            return true;
+        connection = watch_connection;
+        name = watch_name;
+
+        /* Objects added once the rule is in place must not be dropped */
+        if (enabled)
+            watch_discovery = true;
+    }
+
+    if (!name.empty() && !call_bus(connection,
+            enabled ? "AddMatch" : "RemoveMatch", discovery_rule(name), error)) {
+        std::lock_guard<std::mutex> lk(watch_lock);
+        watch_discovery = !enabled;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(watch_lock);
+    watch_discovery = enabled;
+    return true;
+}